@@ -2,14 +2,19 @@ package qbackend
 
 import (
 	"bufio"
+	"bytes"
+	"container/heap"
 	"encoding/json"
 	"errors"
 	"fmt"
 	"io"
 	"log"
 	"reflect"
+	"sort"
 	"strconv"
+	"sync"
 	"time"
+	"unsafe"
 )
 
 type Connection struct {
@@ -21,6 +26,27 @@ type Connection struct {
 	// course change its fields at any time.
 	RootObject AnyQObject
 
+	// ParallelMarshal is the number of goroutines that encode object updates.
+	// If set, updates are encoded at the end of Process, or when the lock from
+	// RunLockable is unlocked, instead of when they are sent. Objects whose
+	// properties can't contain a QObject are encoded concurrently, which only
+	// reads their fields; messages are still written in the order they were
+	// sent. MarshalJSON and MarshalText methods of property types must be safe
+	// to call concurrently.
+	//
+	// This field may not be changed after connecting.
+	ParallelMarshal int
+
+	// Shard is the name of this backend, if the client multiplexes several
+	// backends. Identifiers of new objects are prefixed with the name and a
+	// slash, which the client uses to route objects to the backend that owns
+	// them. Objects of other shards are passed to methods as ObjectRef. The
+	// root object is always "root" on its own connection, and identifiers given
+	// to InitObjectId are used as they are.
+	//
+	// This field may not be changed after connecting.
+	Shard string
+
 	in           io.ReadCloser
 	out          io.WriteCloser
 	objects      map[string]*QObject
@@ -28,9 +54,35 @@ type Connection struct {
 	knownTypes   map[string]struct{}
 	err          error
 
+	// Unreferenced objects, ordered by the end of their grace period. Objects
+	// are removed from objects when they reach the front of the queue and are
+	// still unreferenced, a few at a time.
+	collectQueue collectQueue
+
 	started       bool
 	processSignal chan struct{}
 	queue         chan []byte
+	// buffers of processed messages, which are reused by handle()
+	buffers chan []byte
+
+	// Messages are written to out through writer, which is flushed at the end
+	// of Process, or shortly after messages are sent outside of Process.
+	writeLock  sync.Mutex
+	writer     *bufio.Writer
+	flushTimer *time.Timer
+
+	// Object updates and later messages are pending while batching, if
+	// ParallelMarshal is set
+	batching       bool
+	pending        []pendingMessage
+	pendingObjects map[*QObject]struct{}
+
+	// submitted is a lock-free stack of *submission from SubmitSignal and
+	// SubmitChange. signalLock is only used to wake Process for submissions
+	// without racing with handle() closing processSignal.
+	submitted    unsafe.Pointer
+	signalLock   sync.Mutex
+	signalClosed bool
 }
 
 // NewConnection creates a new connection from an open stream. To use the
@@ -45,13 +97,16 @@ func NewConnection(data io.ReadWriteCloser) *Connection {
 // when using stdin and stdout.
 func NewConnectionSplit(in io.ReadCloser, out io.WriteCloser) *Connection {
 	c := &Connection{
-		in:            in,
-		out:           out,
-		objects:       make(map[string]*QObject),
-		instantiable:  make(map[string]instantiableType),
-		knownTypes:    make(map[string]struct{}),
-		processSignal: make(chan struct{}, 2),
-		queue:         make(chan []byte, 128),
+		in:             in,
+		out:            out,
+		objects:        make(map[string]*QObject),
+		instantiable:   make(map[string]instantiableType),
+		knownTypes:     make(map[string]struct{}),
+		processSignal:  make(chan struct{}, 2),
+		pendingObjects: make(map[*QObject]struct{}),
+		queue:          make(chan []byte, 128),
+		buffers:        make(chan []byte, 128),
+		writer:         bufio.NewWriterSize(out, writeBufferSize),
 	}
 	return c
 }
@@ -67,6 +122,21 @@ type messageBase struct {
 	Command string `json:"command"`
 }
 
+// clientMessage has the fields of any message from the client. Parameters are
+// only decoded for INVOKE, when they are used.
+type clientMessage struct {
+	Command    string          `json:"command"`
+	Identifier string          `json:"identifier"`
+	Method     string          `json:"method"`
+	Return     string          `json:"return"`
+	TypeName   string          `json:"typeName"`
+	Parameters json.RawMessage `json:"parameters"`
+}
+
+// Buffers larger than this are not reused, so one large message doesn't hold
+// on to memory
+const maxReusedBuffer = 64 * 1024
+
 func (c *Connection) fatal(fmsg string, p ...interface{}) {
 	msg := fmt.Sprintf(fmsg, p...)
 	log.Print("qbackend: FATAL: " + msg)
@@ -81,40 +151,119 @@ func (c *Connection) warn(fmsg string, p ...interface{}) {
 	log.Printf("qbackend: WARNING: "+fmsg, p...)
 }
 
+// Messages are written when this much is buffered, or after flushDelay
+const (
+	writeBufferSize = 64 * 1024
+	flushDelay      = 2 * time.Millisecond
+)
+
+// encodeBuffers are reused to encode messages before they are written
+var encodeBuffers = sync.Pool{
+	New: func() interface{} { return new(bytes.Buffer) },
+}
+
 func (c *Connection) sendMessage(msg interface{}) {
-	buf, err := json.Marshal(msg)
-	if err != nil {
-		c.fatal("message encoding failed: %s", err)
+	buf := getEncodeBuffer()
+	defer putEncodeBuffer(buf)
+	if !c.encodeMessage(buf, msg) {
+		return
+	}
+	if c.batching && len(c.pending) > 0 {
+		// Keep the order with pending object updates
+		c.pending = append(c.pending, pendingMessage{data: append([]byte(nil), buf.Bytes()...)})
 		return
 	}
-	fmt.Fprintf(c.out, "%d %s\n", len(buf), buf)
+	c.writeMessage(buf.Bytes())
+}
+
+// sendHandshake writes a message immediately, without the batch state. It's
+// used by handle(), which can run at the same time as Process.
+func (c *Connection) sendHandshake(msg interface{}) {
+	buf := getEncodeBuffer()
+	defer putEncodeBuffer(buf)
+	if c.encodeMessage(buf, msg) {
+		c.writeMessage(buf.Bytes())
+	}
+}
+
+func (c *Connection) encodeMessage(buf *bytes.Buffer, msg interface{}) bool {
+	// Encoding may initialize objects and call their InitObject, so it isn't
+	// done while holding writeLock
+	if err := json.NewEncoder(buf).Encode(msg); err != nil {
+		c.fatal("message encoding failed: %s", err)
+		return false
+	}
+	return true
+}
+
+// writeMessage writes an encoded message, which ends with a newline
+func (c *Connection) writeMessage(data []byte) {
+	c.writeLock.Lock()
+	defer c.writeLock.Unlock()
+
+	// The newline isn't part of the size
+	var size [16]byte
+	c.writer.Write(strconv.AppendInt(size[:0], int64(len(data)-1), 10))
+	c.writer.WriteByte(' ')
+	c.writer.Write(data)
+
+	if c.flushTimer == nil && c.writer.Buffered() > 0 {
+		c.flushTimer = time.AfterFunc(flushDelay, c.flush)
+	}
+}
+
+func getEncodeBuffer() *bytes.Buffer {
+	buf := encodeBuffers.Get().(*bytes.Buffer)
+	buf.Reset()
+	return buf
+}
+
+func putEncodeBuffer(buf *bytes.Buffer) {
+	if buf.Cap() <= maxReusedBuffer {
+		encodeBuffers.Put(buf)
+	}
+}
+
+// flush writes any buffered messages. Errors are not reported here; the
+// client closing the connection is noticed by reads.
+func (c *Connection) flush() {
+	c.writeLock.Lock()
+	defer c.writeLock.Unlock()
+
+	if c.flushTimer != nil {
+		c.flushTimer.Stop()
+		c.flushTimer = nil
+	}
+	if c.writer.Buffered() > 0 {
+		c.writer.Flush()
+	}
 }
 
 // handle() runs in an internal goroutine to read from 'in'. Messages are
 // posted to the queue and processSignal is triggered.
 func (c *Connection) handle() {
-	defer close(c.processSignal)
+	defer func() {
+		c.signalLock.Lock()
+		c.signalClosed = true
+		close(c.processSignal)
+		c.signalLock.Unlock()
+	}()
 	defer close(c.queue)
 
 	// VERSION
-	c.sendMessage(struct {
+	c.sendHandshake(struct {
 		messageBase
 		Version int `json:"version"`
 	}{messageBase{"VERSION"}, 2})
 
 	// CREATABLE_TYPES
 	{
-		types := make([]*typeInfo, 0, len(c.instantiable))
-		for _, t := range c.instantiable {
-			types = append(types, t.Type)
-		}
-
-		c.sendMessage(struct {
+		c.sendHandshake(struct {
 			messageBase
 			Types []*typeInfo `json:"types"`
 		}{
 			messageBase{"CREATABLE_TYPES"},
-			types,
+			c.instantiableTypes(),
 		})
 	}
 
@@ -133,22 +282,25 @@ func (c *Connection) handle() {
 			return
 		}
 
-		c.sendMessage(struct {
+		c.sendHandshake(struct {
 			messageBase
 			Identifier string      `json:"identifier"`
 			Type       *typeInfo   `json:"type"`
 			Data       interface{} `json:"data"`
+			Shard      string      `json:"shard,omitempty"`
 		}{
 			messageBase{"ROOT"},
 			"root",
 			impl.typeInfo,
 			data,
+			c.Shard,
 		})
+		c.flush()
 	}
 
 	rd := bufio.NewReader(c.in)
 	for c.err == nil {
-		sizeStr, err := rd.ReadString(' ')
+		sizeStr, err := rd.ReadSlice(' ')
 		if err != nil {
 			c.fatal("read error: %s", err)
 			return
@@ -157,20 +309,19 @@ func (c *Connection) handle() {
 			return
 		}
 
-		byteCnt, _ := strconv.ParseInt(sizeStr[:len(sizeStr)-1], 10, 32)
-		if byteCnt < 1 {
+		byteCnt, ok := parseMessageSize(sizeStr[:len(sizeStr)-1])
+		if !ok {
+			c.fatal("read invalid message: invalid size")
+			return
+		} else if byteCnt < 1 {
 			c.fatal("read invalid message: size too short")
 			return
 		}
 
-		blob := make([]byte, byteCnt)
-		for p := 0; p < len(blob); {
-			if n, err := rd.Read(blob[p:]); err != nil {
-				c.fatal("read error: %s", err)
-				return
-			} else {
-				p += n
-			}
+		blob := c.messageBuffer(byteCnt)
+		if _, err := io.ReadFull(rd, blob); err != nil {
+			c.fatal("read error: %s", err)
+			return
 		}
 
 		// Read the final newline
@@ -188,6 +339,52 @@ func (c *Connection) handle() {
 	}
 }
 
+// parseMessageSize parses the decimal size before a message, without
+// allocating a string for it
+func parseMessageSize(b []byte) (int, bool) {
+	if len(b) > 9 {
+		// Sizes are limited to 32 bits, and 9 digits can't overflow
+		return 0, false
+	}
+	n := 0
+	for _, d := range b {
+		if d < '0' || d > '9' {
+			return 0, false
+		}
+		n = n*10 + int(d-'0')
+	}
+	return n, true
+}
+
+// messageBuffer returns a buffer of size bytes for a message, reusing the
+// buffer of a processed message if possible
+func (c *Connection) messageBuffer(size int) []byte {
+	select {
+	case buf := <-c.buffers:
+		if cap(buf) >= size {
+			return buf[:size]
+		}
+	default:
+	}
+	if size < 512 {
+		// Most messages are small; leave room for the next one to reuse this
+		return make([]byte, size, 512)
+	}
+	return make([]byte, size)
+}
+
+// releaseBuffer is called when a message has been processed, and nothing
+// refers to its buffer
+func (c *Connection) releaseBuffer(buf []byte) {
+	if cap(buf) > maxReusedBuffer {
+		return
+	}
+	select {
+	case c.buffers <- buf:
+	default:
+	}
+}
+
 func (c *Connection) ensureHandler() error {
 	if !c.started {
 		c.started = true
@@ -238,32 +435,50 @@ func (c *Connection) Run() error {
 // Process() or other qbackend methods. By controlling calls to Process, applications
 // can avoid concurrency issues with object data.
 //
+// Messages to the client are buffered and written before Process returns. Messages
+// sent outside of Process, such as signals emitted by other goroutines holding the lock
+// from RunLockable, are written within a few milliseconds.
+//
+// Signals and property changes submitted from other goroutines with SubmitSignal and
+// SubmitChange are applied when Process starts and before it returns.
+//
 // Process returns nil when no messages are pending. All errors are fatal for the
 // connection.
 func (c *Connection) Process() error {
 	c.ensureHandler()
-	lastCollection := time.Now()
+
+	// msg is reused for each message, including the buffer for parameters
+	var msg clientMessage
+	c.beginBatch()
+	c.applySubmissions()
 
 	for {
 		var data []byte
 		select {
 		case data = <-c.queue:
 		default:
+			// Everything sent while processing is written together
+			c.applySubmissions()
+			c.endBatch()
+			c.flush()
 			return c.err
 		}
 
-		var msg map[string]interface{}
-		if err := json.Unmarshal(data, &msg); err != nil {
+		msg = clientMessage{Parameters: msg.Parameters[:0]}
+		err := json.Unmarshal(data, &msg)
+		// Strings and parameters are copied by Unmarshal
+		c.releaseBuffer(data)
+		if err != nil {
 			c.fatal("process invalid message: %s", err)
 			// once queue is closed, the error from fatal will be returned
 			continue
 		}
 
-		identifier := msg["identifier"].(string)
+		identifier := msg.Identifier
 		obj, objExists := c.objects[identifier]
 		impl, _ := asQObject(obj)
 
-		switch msg["command"] {
+		switch msg.Command {
 		case "OBJECT_REF":
 			if objExists {
 				impl.ref = true
@@ -295,8 +510,8 @@ func (c *Connection) Process() error {
 				break
 			}
 
-			if t, ok := c.instantiable[msg["typeName"].(string)]; !ok {
-				c.fatal("create of unknown type %s", msg["typeName"].(string))
+			if t, ok := c.instantiable[msg.TypeName]; !ok {
+				c.fatal("create of unknown type %s", msg.TypeName)
 				break
 			} else {
 				obj := t.Factory()
@@ -305,14 +520,14 @@ func (c *Connection) Process() error {
 			}
 
 		case "INVOKE":
-			method := msg["method"].(string)
+			method := msg.Method
 			if objExists {
-				params, ok := msg["parameters"].([]interface{})
-				if !ok {
+				var params []interface{}
+				if err := json.Unmarshal(msg.Parameters, &params); err != nil || params == nil {
 					c.fatal("invoke with invalid parameters of %s on %s", method, identifier)
 					break
 				}
-				returnId, _ := msg["return"].(string)
+				returnId := msg.Return
 
 				re, err := impl.invoke(method, params...)
 				if returnId != "" {
@@ -340,14 +555,10 @@ func (c *Connection) Process() error {
 			}
 
 		default:
-			c.fatal("unknown command %s", msg["command"])
+			c.fatal("unknown command %s", msg.Command)
 		}
 
-		// Scan references for garbage collection at most every 5 seconds
-		if now := time.Now(); now.Sub(lastCollection) >= 5*time.Second {
-			c.collectObjects()
-			lastCollection = now
-		}
+		c.collectObjects(time.Now(), maxCollectPerProcess)
 	}
 
 	return nil
@@ -373,24 +584,80 @@ func (c *Connection) addObject(obj *QObject) {
 	c.objects[id] = q
 }
 
+// Objects collected by each message in Process, to bound the pause when many
+// objects expire at once
+const maxCollectPerProcess = 1000
+
 // Remove objects that have no property references, are not referenced by
 // the client, and have passed their grace period from the map, allowing
 // the GC to collect them. Under these conditions, there is no valid way
 // for a client to reference the object. If the object is used again, it
 // will be re-added under the same ID.
-func (c *Connection) collectObjects() {
-	for id, obj := range c.objects {
-		impl, _ := asQObject(obj)
-		if !impl.ref && impl.refCount < 1 && time.Now().After(impl.refGraceTime) {
-			delete(c.objects, id)
-			impl.inactive = true
+//
+// Only objects queued by refsChanged are considered, in order of their grace
+// period, and at most limit are removed. Objects that were referenced again
+// are dropped from the queue and are queued again when their references are.
+func (c *Connection) collectObjects(now time.Time, limit int) {
+	for i := 0; i < limit && len(c.collectQueue) > 0; i++ {
+		obj := c.collectQueue[0]
+		if obj.refGraceTime.After(now) {
+			break
+		}
+		heap.Pop(&c.collectQueue)
+
+		if !obj.ref && obj.refCount < 1 && c.objects[obj.id] == obj {
+			delete(c.objects, obj.id)
+			obj.inactive = true
 		}
 	}
 }
 
+// queueCollect adds obj to collectQueue, or moves it for a new grace period
+func (c *Connection) queueCollect(obj *QObject) {
+	if obj.collectIndex > 0 {
+		heap.Fix(&c.collectQueue, obj.collectIndex-1)
+	} else {
+		heap.Push(&c.collectQueue, obj)
+	}
+}
+
+// collectQueue is a heap of objects by refGraceTime. Each object's
+// collectIndex is its index in the heap plus one, or 0 if it isn't queued.
+type collectQueue []*QObject
+
+func (q collectQueue) Len() int { return len(q) }
+
+func (q collectQueue) Less(i, j int) bool {
+	return q[i].refGraceTime.Before(q[j].refGraceTime)
+}
+
+func (q collectQueue) Swap(i, j int) {
+	q[i], q[j] = q[j], q[i]
+	q[i].collectIndex = i + 1
+	q[j].collectIndex = j + 1
+}
+
+func (q *collectQueue) Push(x interface{}) {
+	obj := x.(*QObject)
+	obj.collectIndex = len(*q) + 1
+	*q = append(*q, obj)
+}
+
+func (q *collectQueue) Pop() interface{} {
+	old := *q
+	obj := old[len(old)-1]
+	old[len(old)-1] = nil
+	obj.collectIndex = 0
+	*q = old[:len(old)-1]
+	return obj
+}
+
 // Object returns a registered QObject by its identifier
 func (c *Connection) Object(name string) AnyQObject {
-	return c.objects[name].object
+	if obj, exists := c.objects[name]; exists {
+		return obj.object
+	}
+	return nil
 }
 
 // InitObject explicitly initializes a QObject, assigning an identifier and
@@ -427,21 +694,31 @@ func (c *Connection) sendUpdate(impl *QObject) error {
 		return nil
 	}
 
-	data, err := impl.marshalObject()
-	if err != nil {
+	if c.batching {
+		c.queueUpdate(impl)
+		return nil
+	}
+
+	buf := getEncodeBuffer()
+	defer putEncodeBuffer(buf)
+	if err := c.encodeUpdate(buf, impl); err != nil {
 		c.warn("marshal of object %s (type %s) failed: %s", impl.id, impl.typeInfo.Name, err)
 		return err
 	}
+	c.writeMessage(buf.Bytes())
+	return nil
+}
 
-	c.sendMessage(struct {
-		messageBase
-		Identifier string                 `json:"identifier"`
-		Data       map[string]interface{} `json:"data"`
-	}{
-		messageBase{"OBJECT_RESET"},
-		impl.Identifier(),
-		data,
-	})
+// encodeUpdate writes the OBJECT_RESET message for impl to buf. The
+// properties are encoded directly into the message.
+func (c *Connection) encodeUpdate(buf *bytes.Buffer, impl *QObject) error {
+	buf.WriteString(`{"command":"OBJECT_RESET","identifier":`)
+	writeString(buf, impl.Identifier())
+	buf.WriteString(`,"data":`)
+	if err := impl.encodeObject(buf); err != nil {
+		return err
+	}
+	buf.WriteString("}\n")
 	return nil
 }
 
@@ -515,6 +792,49 @@ func (c *Connection) RegisterType(name string, template AnyQObject) error {
 	return c.RegisterTypeFactory(name, template, factory)
 }
 
+// TypeDefinitions returns a description of the root object's type and all
+// registered instantiable types, in the format of the client's type cache.
+//
+// When the client has a type cache, it registers types and creates the root object
+// without waiting for the backend, so the UI can start in parallel with the backend.
+// The client maintains this cache itself, but applications can also write it
+// during their build and ship it, so that even the first start doesn't block. The
+// client's cache is set by the -qbackend-type-cache argument or QBACKEND_TYPE_CACHE
+// environment variable.
+//
+// RootObject must be set and all types must be registered before calling
+// TypeDefinitions.
+func (c *Connection) TypeDefinitions() ([]byte, error) {
+	if c.RootObject == nil {
+		return nil, errors.New("connection must have a root object")
+	}
+	rootType, err := parseType(reflect.TypeOf(c.RootObject))
+	if err != nil {
+		return nil, err
+	}
+
+	return json.Marshal(struct {
+		Types []*typeInfo `json:"types"`
+		Root  *typeInfo   `json:"root"`
+	}{c.instantiableTypes(), rootType})
+}
+
+// instantiableTypes returns the registered instantiable types, sorted by name.
+// The client compares the list with its type cache, so the order must be stable.
+func (c *Connection) instantiableTypes() []*typeInfo {
+	names := make([]string, 0, len(c.instantiable))
+	for name := range c.instantiable {
+		names = append(names, name)
+	}
+	sort.Strings(names)
+
+	types := make([]*typeInfo, 0, len(names))
+	for _, name := range names {
+		types = append(types, c.instantiable[name].Type)
+	}
+	return types
+}
+
 func (c *Connection) typeIsAcknowledged(t *typeInfo) bool {
 	_, exists := c.knownTypes[t.Name]
 	return exists
@@ -1,8 +1,14 @@
 package qbackend
 
 import (
+	"bufio"
+	"bytes"
+	"encoding/json"
+	"fmt"
 	"io"
+	"io/ioutil"
 	"testing"
+	"time"
 )
 
 type Child struct {
@@ -29,3 +35,632 @@ func TestConnectionInit(t *testing.T) {
 	}
 	c.RootObject = r
 }
+
+func TestTypeDefinitions(t *testing.T) {
+	r1, _ := io.Pipe()
+	_, w2 := io.Pipe()
+	c := NewConnectionSplit(r1, w2)
+
+	if _, err := c.TypeDefinitions(); err == nil {
+		t.Error("TypeDefinitions without a root object should fail")
+	}
+
+	c.RootObject = &Root{}
+	if err := c.RegisterType("Child", &Child{}); err != nil {
+		t.Fatalf("RegisterType failed: %s", err)
+	}
+
+	data, err := c.TypeDefinitions()
+	if err != nil {
+		t.Fatalf("TypeDefinitions failed: %s", err)
+	}
+
+	var defs struct {
+		Types []map[string]interface{}
+		Root  map[string]interface{}
+	}
+	if err := json.Unmarshal(data, &defs); err != nil {
+		t.Fatalf("TypeDefinitions is not valid JSON: %s", err)
+	}
+	if len(defs.Types) != 1 || defs.Types[0]["name"] != "Child" {
+		t.Errorf("TypeDefinitions has wrong creatable types: %v", defs.Types)
+	}
+	if defs.Root["name"] != "Root" {
+		t.Errorf("TypeDefinitions has wrong root type: %v", defs.Root)
+	}
+}
+
+// Types registered with their own names, because RegisterType names the type
+type OrderAlpha struct{ QObject }
+type OrderBravo struct{ QObject }
+type OrderCharlie struct{ QObject }
+type OrderDelta struct{ QObject }
+
+func TestTypeDefinitionsOrder(t *testing.T) {
+	r1, _ := io.Pipe()
+	_, w2 := io.Pipe()
+	c := NewConnectionSplit(r1, w2)
+	c.RootObject = &Root{}
+
+	// The client compares the types with its cache, so they are always sorted
+	types := []AnyQObject{&OrderDelta{}, &OrderCharlie{}, &OrderBravo{}, &OrderAlpha{}}
+	names := []string{"OrderAlpha", "OrderBravo", "OrderCharlie", "OrderDelta"}
+	for i, obj := range types {
+		if err := c.RegisterType(names[len(names)-1-i], obj); err != nil {
+			t.Fatalf("RegisterType failed: %s", err)
+		}
+	}
+
+	for i := 0; i < 10; i++ {
+		data, err := c.TypeDefinitions()
+		if err != nil {
+			t.Fatalf("TypeDefinitions failed: %s", err)
+		}
+		var defs struct {
+			Types []map[string]interface{}
+		}
+		if err := json.Unmarshal(data, &defs); err != nil {
+			t.Fatalf("TypeDefinitions is not valid JSON: %s", err)
+		}
+		if len(defs.Types) != len(names) {
+			t.Fatalf("TypeDefinitions has wrong creatable types: %v", defs.Types)
+		}
+		for j, def := range defs.Types {
+			if def["name"] != names[j] {
+				t.Fatalf("TypeDefinitions has type %v at %d, expected %s", def["name"], j, names[j])
+			}
+		}
+	}
+}
+
+type ProcessRoot struct {
+	QObject
+	Title string
+	Count int
+}
+
+func (r *ProcessRoot) Add(a, b int) int {
+	r.Count += a + b
+	return r.Count
+}
+
+type nopWriteCloser struct {
+	io.Writer
+}
+
+func (nopWriteCloser) Close() error {
+	return nil
+}
+
+// newProcessConnection returns a connection where messages can be queued
+// directly for Process, instead of read by the handler
+func newProcessConnection(tb testing.TB) (*Connection, *ProcessRoot) {
+	r, _ := io.Pipe()
+	c := NewConnectionSplit(r, nopWriteCloser{ioutil.Discard})
+	root := &ProcessRoot{Title: "I am Root"}
+	c.RootObject = root
+	if _, err := initObjectId(root, c, "root"); err != nil {
+		tb.Fatalf("root object init failed: %s", err)
+	}
+	c.started = true
+	return c, root
+}
+
+func TestConnectionProcess(t *testing.T) {
+	c, root := newProcessConnection(t)
+
+	c.queue <- []byte(`{"command":"OBJECT_REF","identifier":"root"}`)
+	c.queue <- []byte(`{"command":"INVOKE","identifier":"root","method":"add","parameters":[1,2],"return":"1"}`)
+	c.queue <- []byte(`{"command":"INVOKE","identifier":"root","method":"add","parameters":[3,4]}`)
+	c.queue <- []byte(`{"command":"OBJECT_QUERY","identifier":"root"}`)
+	if err := c.Process(); err != nil {
+		t.Fatalf("Process failed: %s", err)
+	}
+	if !root.ref {
+		t.Error("OBJECT_REF did not reference the object")
+	}
+	if root.Count != 10 {
+		t.Errorf("INVOKE of add has count %d, expected 10", root.Count)
+	}
+}
+
+func TestParseMessageSize(t *testing.T) {
+	for input, expected := range map[string]int{"0": 0, "42": 42, "123456789": 123456789} {
+		if n, ok := parseMessageSize([]byte(input)); !ok || n != expected {
+			t.Errorf("size %q parsed as %d, %v", input, n, ok)
+		}
+	}
+	for _, input := range []string{"", "-1", "4x", "1234567890"} {
+		if _, ok := parseMessageSize([]byte(input)); ok && input != "" {
+			t.Errorf("invalid size %q was parsed", input)
+		}
+	}
+}
+
+func benchmarkProcess(b *testing.B, messages ...string) {
+	c, _ := newProcessConnection(b)
+	c.queue <- []byte(`{"command":"OBJECT_REF","identifier":"root"}`)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		// Copied as the handler would, because processed buffers are reused
+		msg := messages[i%len(messages)]
+		c.queue <- append(c.messageBuffer(len(msg))[:0], msg...)
+		if len(c.queue) == cap(c.queue) {
+			if err := c.Process(); err != nil {
+				b.Fatalf("Process failed: %s", err)
+			}
+		}
+	}
+	if err := c.Process(); err != nil {
+		b.Fatalf("Process failed: %s", err)
+	}
+}
+
+const (
+	benchInvoke      = `{"command":"INVOKE","identifier":"root","method":"add","parameters":[1,2],"return":"{d3b07384-d113-4ec6-a1b7-5b6a0bd1e2cf}"}`
+	benchObjectRef   = `{"command":"OBJECT_REF","identifier":"root"}`
+	benchObjectQuery = `{"command":"OBJECT_QUERY","identifier":"root"}`
+)
+
+func BenchmarkProcessInvoke(b *testing.B) {
+	benchmarkProcess(b, benchInvoke)
+}
+
+func BenchmarkProcessObjectRef(b *testing.B) {
+	benchmarkProcess(b, benchObjectRef)
+}
+
+func BenchmarkProcessObjectQuery(b *testing.B) {
+	benchmarkProcess(b, benchObjectQuery)
+}
+
+func BenchmarkProcessMix(b *testing.B) {
+	benchmarkProcess(b, benchInvoke, benchInvoke, benchObjectRef, benchInvoke, benchObjectQuery)
+}
+
+// countingWriter records writes to the connection
+type countingWriter struct {
+	bytes.Buffer
+	writes int
+}
+
+func (w *countingWriter) Write(p []byte) (int, error) {
+	w.writes++
+	return w.Buffer.Write(p)
+}
+
+func (w *countingWriter) Close() error {
+	return nil
+}
+
+func TestConnectionBufferedWrites(t *testing.T) {
+	c, root := newProcessConnection(t)
+	out := &countingWriter{}
+	c.out, c.writer = out, bufio.NewWriterSize(out, writeBufferSize)
+	root.ref = true
+
+	c.queue <- []byte(`{"command":"INVOKE","identifier":"root","method":"add","parameters":[1,2],"return":"1"}`)
+	c.queue <- []byte(`{"command":"INVOKE","identifier":"root","method":"add","parameters":[3,4],"return":"2"}`)
+	if err := c.Process(); err != nil {
+		t.Fatalf("Process failed: %s", err)
+	}
+	if out.writes != 1 {
+		t.Errorf("Process wrote %d times, expected once", out.writes)
+	}
+	expected := `72 {"command":"INVOKE_RETURN","identifier":"root","return":"1","value":[3]}` + "\n" +
+		`73 {"command":"INVOKE_RETURN","identifier":"root","return":"2","value":[10]}` + "\n"
+	if out.String() != expected {
+		t.Errorf("Process wrote %q, expected %q", out.String(), expected)
+	}
+
+	// Outside of Process, messages are written after a delay
+	out.Reset()
+	root.Emit("titleChanged")
+	c.writeLock.Lock()
+	if out.Len() != 0 {
+		t.Error("emit outside of Process was written immediately")
+	}
+	c.writeLock.Unlock()
+	time.Sleep(20 * flushDelay)
+	c.writeLock.Lock()
+	if out.Len() == 0 {
+		t.Error("emit outside of Process was not written after the flush delay")
+	}
+	c.writeLock.Unlock()
+}
+
+func BenchmarkEmit(b *testing.B) {
+	c, root := newProcessConnection(b)
+	root.ref = true
+
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		root.Emit("changed", i, "value")
+		if i%100 == 99 {
+			c.flush()
+		}
+	}
+	c.flush()
+}
+
+type CollectQObject struct {
+	QObject
+	Value int
+}
+
+func newCollectObjects(tb testing.TB, c *Connection, count int) []*CollectQObject {
+	objs := make([]*CollectQObject, count)
+	for i := range objs {
+		objs[i] = &CollectQObject{Value: i}
+		if _, err := initObjectId(objs[i], c, fmt.Sprintf("obj%d", i)); err != nil {
+			tb.Fatalf("object init failed: %s", err)
+		}
+	}
+	return objs
+}
+
+func TestCollectObjects(t *testing.T) {
+	c, root := newProcessConnection(t)
+	root.ref = true
+	objs := newCollectObjects(t, c, 10)
+	for i, obj := range objs {
+		if i%2 == 1 {
+			obj.ref = true
+			obj.refsChanged()
+		}
+	}
+
+	c.collectObjects(time.Now(), 100)
+	if len(c.objects) != 11 {
+		t.Errorf("collected %d objects before the grace period", 11-len(c.objects))
+	}
+
+	expired := time.Now().Add(objectRefGracePeriod + time.Second)
+	// The limit includes queued objects that were referenced again
+	c.collectObjects(expired, 2)
+	if len(c.objects) < 9 || len(c.collectQueue) != 9 {
+		t.Errorf("expected 2 queued objects checked with a limit of 2, have %d objects and %d queued", len(c.objects), len(c.collectQueue))
+	}
+	c.collectObjects(expired, 100)
+	if len(c.objects) != 6 || len(c.collectQueue) != 0 {
+		t.Errorf("expected 6 objects and an empty queue, have %d objects and %d queued", len(c.objects), len(c.collectQueue))
+	}
+	for i, obj := range objs {
+		if _, exists := c.objects[obj.id]; exists != (i%2 == 1) || obj.inactive == exists {
+			t.Errorf("object %d collected: %v, inactive: %v", i, !exists, obj.inactive)
+		}
+	}
+	if c.Object("root") != root {
+		t.Error("root object was collected")
+	}
+
+	// Dropping the last reference queues the object again
+	objs[1].ref = false
+	objs[1].refsChanged()
+	if len(c.collectQueue) != 1 {
+		t.Errorf("unreferenced object was not queued")
+	}
+	c.collectObjects(time.Now(), 100)
+	if _, exists := c.objects[objs[1].id]; !exists {
+		t.Error("object collected before its new grace period")
+	}
+
+	// Reactivated objects are queued and collected again
+	if _, err := initObjectId(objs[0], c, objs[0].id); err != nil || objs[0].inactive {
+		t.Fatalf("object was not reactivated: %v", err)
+	}
+	c.collectObjects(time.Now().Add(2*objectRefGracePeriod+time.Second), 100)
+	if !objs[0].inactive || !objs[1].inactive {
+		t.Error("objects were not collected after their grace period")
+	}
+}
+
+// BenchmarkCollectObjects measures the pause of collection in each Process
+// tick, with registries of referenced objects. Idle has nothing to collect,
+// and Expiring collects 100 objects each tick.
+func BenchmarkCollectObjects(b *testing.B) {
+	for _, size := range []int{1000, 100000, 1000000} {
+		c, _ := newProcessConnection(b)
+		objs := newCollectObjects(b, c, size)
+		for _, obj := range objs {
+			obj.ref = true
+		}
+		// Drop everything queued by init
+		c.collectObjects(time.Now().Add(objectRefGracePeriod+time.Second), size+1)
+
+		b.Run(fmt.Sprintf("Idle/%d", size), func(b *testing.B) {
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				c.collectObjects(time.Now(), maxCollectPerProcess)
+			}
+		})
+
+		b.Run(fmt.Sprintf("Expiring/%d", size), func(b *testing.B) {
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				start := (i * 100) % size
+				expiring := objs[start : start+100]
+				for _, obj := range expiring {
+					obj.ref = false
+					obj.refsChanged()
+				}
+				c.collectObjects(time.Now().Add(objectRefGracePeriod+time.Second), maxCollectPerProcess)
+				for _, obj := range expiring {
+					obj.ref = true
+					obj.inactive = false
+					c.objects[obj.id] = &obj.QObject
+				}
+			}
+		})
+	}
+}
+
+type MarshalQObject struct {
+	QObject
+	Name   string
+	Values []float64
+}
+
+// setWriter flushes c and writes to w instead, holding writeLock in case the
+// flush timer is running
+func setWriter(c *Connection, w io.Writer) {
+	c.flush()
+	c.writeLock.Lock()
+	c.writer = bufio.NewWriter(w)
+	c.writeLock.Unlock()
+}
+
+// marshalUpdates sends updates of objs with signals between them in a batch,
+// and returns what was written
+func marshalUpdates(tb testing.TB, c *Connection, root *ProcessRoot, objs []*MarshalQObject, child *BasicQObject) []byte {
+	var out bytes.Buffer
+	setWriter(c, &out)
+
+	c.beginBatch()
+	for i, obj := range objs {
+		obj.ResetProperties()
+		if i%10 == 0 {
+			root.Emit("changed", i)
+			child.ResetProperties()
+		}
+	}
+	objs[0].ResetProperties()
+	c.endBatch()
+	c.flush()
+	return out.Bytes()
+}
+
+func newMarshalObjects(tb testing.TB, parallel int) (*Connection, *ProcessRoot, []*MarshalQObject, *BasicQObject) {
+	c, root := newProcessConnection(tb)
+	c.ParallelMarshal = parallel
+	root.ref = true
+
+	child := &BasicQObject{StringData: "child", Child: &BasicQObject{}}
+	if _, err := initObjectId(child.Child, c, "grandchild"); err != nil {
+		tb.Fatal(err)
+	}
+	if _, err := initObjectId(child, c, "child"); err != nil {
+		tb.Fatal(err)
+	}
+	child.ref = true
+
+	objs := make([]*MarshalQObject, 100)
+	for i := range objs {
+		objs[i] = &MarshalQObject{Name: fmt.Sprintf("object %d", i), Values: make([]float64, 1000)}
+		for j := range objs[i].Values {
+			objs[i].Values[j] = float64(i*j) / 7
+		}
+		if _, err := initObjectId(objs[i], c, fmt.Sprintf("obj%d", i)); err != nil {
+			tb.Fatal(err)
+		}
+		objs[i].ref = true
+	}
+	return c, root, objs, child
+}
+
+func TestParallelMarshal(t *testing.T) {
+	c, root, objs, child := newMarshalObjects(t, 0)
+	expected := marshalUpdates(t, c, root, objs, child)
+
+	// Repeated updates of an object are merged with the first
+	seen := make(map[string]bool)
+	var merged []byte
+	for _, line := range bytes.SplitAfter(expected, []byte("\n")) {
+		var msg clientMessage
+		json.Unmarshal(line[bytes.IndexByte(line, ' ')+1:], &msg)
+		if msg.Command == "OBJECT_RESET" {
+			if seen[msg.Identifier] {
+				continue
+			}
+			seen[msg.Identifier] = true
+		}
+		merged = append(merged, line...)
+	}
+
+	c, root, objs, child = newMarshalObjects(t, 4)
+	output := marshalUpdates(t, c, root, objs, child)
+	if !bytes.Equal(output, merged) {
+		t.Errorf("parallel marshal wrote different messages than sequential marshal")
+	}
+	if len(c.pending) != 0 || len(c.pendingObjects) != 0 {
+		t.Errorf("messages are still pending after the batch")
+	}
+	if child.Child.refCount != 1 {
+		t.Errorf("child reference counted %d times", child.Child.refCount)
+	}
+
+	// Without a batch, updates are written immediately
+	var out bytes.Buffer
+	setWriter(c, &out)
+	objs[0].ResetProperties()
+	c.flush()
+	c.writeLock.Lock()
+	if out.Len() == 0 {
+		t.Error("update outside of a batch was not written")
+	}
+	c.writeLock.Unlock()
+}
+
+// The handshake is written by the handler while the lock from RunLockable
+// batches updates, and must not use the batch.
+func TestParallelMarshalHandshake(t *testing.T) {
+	inR, _ := io.Pipe()
+	outR, outW := io.Pipe()
+	c := NewConnectionSplit(inR, outW)
+	c.ParallelMarshal = 4
+	root := &ProcessRoot{}
+	c.RootObject = root
+
+	go io.Copy(ioutil.Discard, outR)
+
+	// The root object is read by the handshake, so change another object
+	obj := &MarshalQObject{}
+	if _, err := initObjectId(obj, c, "obj"); err != nil {
+		t.Fatal(err)
+	}
+	obj.ref = true
+
+	lock, _ := c.RunLockable()
+	for i := 0; i < 100; i++ {
+		lock.Lock()
+		obj.Name = fmt.Sprintf("object %d", i)
+		obj.ResetProperties()
+		obj.Emit("changed", i)
+		lock.Unlock()
+	}
+	if len(c.pending) != 0 {
+		t.Errorf("messages are still pending after unlocking")
+	}
+}
+
+func BenchmarkParallelMarshal(b *testing.B) {
+	for _, parallel := range []int{0, 1, 2, 4, 8} {
+		c, root, objs, child := newMarshalObjects(b, parallel)
+		b.Run(fmt.Sprintf("%d", parallel), func(b *testing.B) {
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				marshalUpdates(b, c, root, objs, child)
+			}
+		})
+	}
+}
+
+type SubmitQObject struct {
+	QObject
+	Value   float64
+	Label   string
+	Count   int
+	Reading func(int) `qbackend:"index"`
+}
+
+func TestSubmit(t *testing.T) {
+	c, _ := newProcessConnection(t)
+	obj := &SubmitQObject{}
+	if _, err := initObjectId(obj, c, "submit"); err != nil {
+		t.Fatal(err)
+	}
+	obj.ref = true
+
+	var out bytes.Buffer
+	setWriter(c, &out)
+
+	// Changes before a signal are sent before it, once for each object
+	c.SubmitChange(obj, "value", 1)
+	c.SubmitChange(obj, "Label", "first")
+	c.SubmitChange(obj, "value", 2.5)
+	c.SubmitSignal(obj, "reading", 1)
+	c.SubmitChange(obj, "label", "second")
+	c.SubmitChange(obj, "missing", 1)
+	c.SubmitChange(obj, "label", 3.5)
+	c.SubmitChange(obj, "label", 65)
+	c.SubmitChange(obj, "count", 3.0)
+	c.SubmitChange(obj, "count", 4.5)
+	c.SubmitChange(obj, "count", uint64(1)<<63)
+	c.SubmitChange(obj, "count", 1e300)
+
+	select {
+	case <-c.ProcessSignal():
+	default:
+		t.Error("submission did not signal Process")
+	}
+	if obj.Value != 0 {
+		t.Error("submission was applied before Process")
+	}
+	if err := c.Process(); err != nil {
+		t.Fatalf("Process failed: %s", err)
+	}
+	if obj.Value != 2.5 || obj.Label != "second" || obj.Count != 3 {
+		t.Errorf("submitted changes were not applied: %v, %q, %d", obj.Value, obj.Label, obj.Count)
+	}
+
+	var commands []string
+	for _, line := range bytes.SplitAfter(out.Bytes(), []byte("\n")) {
+		if len(line) == 0 {
+			continue
+		}
+		var msg clientMessage
+		json.Unmarshal(line[bytes.IndexByte(line, ' ')+1:], &msg)
+		commands = append(commands, msg.Command)
+	}
+	if fmt.Sprint(commands) != "[OBJECT_RESET EMIT OBJECT_RESET]" {
+		t.Errorf("submissions sent %v", commands)
+	}
+
+	// Submissions from many goroutines are all applied
+	done := make(chan struct{})
+	for g := 0; g < 8; g++ {
+		go func(g int) {
+			for i := 0; i < 1000; i++ {
+				c.SubmitSignal(obj, "reading", g*1000+i)
+			}
+			done <- struct{}{}
+		}(g)
+	}
+	for g := 0; g < 8; g++ {
+		<-done
+	}
+	out.Reset()
+	c.Process()
+	if count := bytes.Count(out.Bytes(), []byte(`"EMIT"`)); count != 8000 {
+		t.Errorf("%d of 8000 submitted signals were emitted", count)
+	}
+}
+
+// BenchmarkSubmitChange compares changes from concurrent goroutines with
+// SubmitChange and with the lock from RunLockable, while Process runs.
+func BenchmarkSubmitChange(b *testing.B) {
+	b.Run("Submit", func(b *testing.B) {
+		c, _ := newProcessConnection(b)
+		obj := &SubmitQObject{}
+		initObjectId(obj, c, "submit")
+		obj.ref = true
+		c.RunLockable()
+
+		b.ReportAllocs()
+		b.RunParallel(func(pb *testing.PB) {
+			for i := 0.0; pb.Next(); i++ {
+				c.SubmitChange(obj, "value", i)
+			}
+		})
+	})
+
+	b.Run("Lock", func(b *testing.B) {
+		c, _ := newProcessConnection(b)
+		obj := &SubmitQObject{}
+		initObjectId(obj, c, "submit")
+		obj.ref = true
+		lock, _ := c.RunLockable()
+
+		b.ReportAllocs()
+		b.RunParallel(func(pb *testing.PB) {
+			for i := 0.0; pb.Next(); i++ {
+				lock.Lock()
+				obj.Value = i
+				obj.ResetProperties()
+				lock.Unlock()
+			}
+		})
+	})
+}
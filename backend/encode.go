@@ -0,0 +1,155 @@
+package qbackend
+
+import (
+	"bytes"
+	"encoding/json"
+	"math"
+	"reflect"
+	"sort"
+	"strconv"
+)
+
+// propertyEncoder is the plan to encode one property of an object type. The
+// encoders of a type are built once by parseType, in the order of their names
+// to match the output of json.Marshal for a map.
+type propertyEncoder struct {
+	name string
+	// key is the quoted name and colon
+	key   []byte
+	index []int
+	// scan is true if the value could contain a QObject, which must be
+	// initialized and counted as a reference before it is encoded
+	scan   bool
+	encode func(buf *bytes.Buffer, v reflect.Value) error
+}
+
+func buildPropertyEncoders(t reflect.Type, ti *typeInfo) []propertyEncoder {
+	encoders := make([]propertyEncoder, 0, len(ti.propertyFieldIndex))
+	for name, index := range ti.propertyFieldIndex {
+		fieldType := t.FieldByIndex(index).Type
+		key, _ := json.Marshal(name)
+		encoders = append(encoders, propertyEncoder{
+			name:   name,
+			key:    append(key, ':'),
+			index:  index,
+			scan:   typeCouldContainQObject(fieldType),
+			encode: valueEncoder(fieldType),
+		})
+	}
+	sort.Slice(encoders, func(i, j int) bool { return encoders[i].name < encoders[j].name })
+	return encoders
+}
+
+func (e *propertyEncoder) field(v reflect.Value) reflect.Value {
+	if len(e.index) == 1 {
+		return v.Field(e.index[0])
+	}
+	return v.FieldByIndex(e.index)
+}
+
+// valueEncoder returns a function to encode values of t as json.Marshal would.
+// Basic types are written directly; anything else goes through json.Marshal.
+func valueEncoder(t reflect.Type) func(*bytes.Buffer, reflect.Value) error {
+	if t.Implements(jsonMarshalerType) || t.Implements(textMarshalerType) {
+		return encodeMarshal
+	}
+
+	switch t.Kind() {
+	case reflect.Bool:
+		return encodeBool
+	case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
+		return encodeInt
+	case reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64, reflect.Uintptr:
+		return encodeUint
+	case reflect.Float32:
+		return func(buf *bytes.Buffer, v reflect.Value) error {
+			return encodeFloat(buf, v.Float(), 32)
+		}
+	case reflect.Float64:
+		return func(buf *bytes.Buffer, v reflect.Value) error {
+			return encodeFloat(buf, v.Float(), 64)
+		}
+	case reflect.String:
+		return encodeString
+	default:
+		return encodeMarshal
+	}
+}
+
+func encodeMarshal(buf *bytes.Buffer, v reflect.Value) error {
+	data, err := json.Marshal(v.Interface())
+	if err != nil {
+		return err
+	}
+	buf.Write(data)
+	return nil
+}
+
+func encodeBool(buf *bytes.Buffer, v reflect.Value) error {
+	if v.Bool() {
+		buf.WriteString("true")
+	} else {
+		buf.WriteString("false")
+	}
+	return nil
+}
+
+func encodeInt(buf *bytes.Buffer, v reflect.Value) error {
+	var scratch [24]byte
+	buf.Write(strconv.AppendInt(scratch[:0], v.Int(), 10))
+	return nil
+}
+
+func encodeUint(buf *bytes.Buffer, v reflect.Value) error {
+	var scratch [24]byte
+	buf.Write(strconv.AppendUint(scratch[:0], v.Uint(), 10))
+	return nil
+}
+
+// encodeFloat uses the same format as encoding/json
+func encodeFloat(buf *bytes.Buffer, f float64, bits int) error {
+	if math.IsInf(f, 0) || math.IsNaN(f) {
+		return &json.UnsupportedValueError{Str: strconv.FormatFloat(f, 'g', -1, bits)}
+	}
+
+	format := byte('f')
+	if abs := math.Abs(f); abs != 0 {
+		if bits == 64 && (abs < 1e-6 || abs >= 1e21) || bits == 32 && (float32(abs) < 1e-6 || float32(abs) >= 1e21) {
+			format = 'e'
+		}
+	}
+	var scratch [32]byte
+	b := strconv.AppendFloat(scratch[:0], f, format, -1, bits)
+	if format == 'e' {
+		// clean up e-09 to e-9
+		if n := len(b); n >= 4 && b[n-4] == 'e' && b[n-3] == '-' && b[n-2] == '0' {
+			b[n-2] = b[n-1]
+			b = b[:n-1]
+		}
+	}
+	buf.Write(b)
+	return nil
+}
+
+func encodeString(buf *bytes.Buffer, v reflect.Value) error {
+	return writeString(buf, v.String())
+}
+
+// writeString writes strings that need no escaping directly, and leaves the
+// rest to json.Marshal, which also escapes HTML characters.
+func writeString(buf *bytes.Buffer, s string) error {
+	for i := 0; i < len(s); i++ {
+		if c := s[i]; c < 0x20 || c >= 0x7f || c == '"' || c == '\\' || c == '<' || c == '>' || c == '&' {
+			data, err := json.Marshal(s)
+			if err != nil {
+				return err
+			}
+			buf.Write(data)
+			return nil
+		}
+	}
+	buf.WriteByte('"')
+	buf.WriteString(s)
+	buf.WriteByte('"')
+	return nil
+}
@@ -0,0 +1,24 @@
+package qbackend
+
+import (
+	"reflect"
+)
+
+// GeneratedInvoker calls the method of obj named method without reflection.
+// These are generated by the qbackendgen tool (cmd/qbackendgen) for types
+// marked with a "qbackend:generate" comment, and registered with
+// RegisterGeneratedInvoker.
+//
+// handled is false if the invoker doesn't have the method, or can't convert
+// the arguments. Those methods are called with reflection instead, which also
+// reports any errors for the arguments.
+type GeneratedInvoker func(obj AnyQObject, method string, args []interface{}) (ret []interface{}, handled bool, err error)
+
+var generatedInvokers = make(map[reflect.Type]GeneratedInvoker)
+
+// RegisterGeneratedInvoker registers the invoker for the type of obj, which
+// is used for all objects of exactly that type. It is called by generated code
+// from init, and must be called before any object of the type is initialized.
+func RegisterGeneratedInvoker(obj AnyQObject, invoker GeneratedInvoker) {
+	generatedInvokers[reflect.Indirect(reflect.ValueOf(obj)).Type()] = invoker
+}
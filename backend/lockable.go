@@ -5,20 +5,25 @@ import "sync"
 type channelLocker struct {
 	L chan struct{}
 	U chan struct{}
+	c *Connection
 }
 
-func newChannelLocker() *channelLocker {
+func newChannelLocker(c *Connection) *channelLocker {
 	return &channelLocker{
 		L: make(chan struct{}),
 		U: make(chan struct{}),
+		c: c,
 	}
 }
 
 func (cl *channelLocker) Lock() {
 	cl.L <- struct{}{}
+	cl.c.beginBatch()
 }
 
 func (cl *channelLocker) Unlock() {
+	// Pending updates read objects, so they're encoded before unlocking
+	cl.c.endBatch()
 	cl.U <- struct{}{}
 }
 
@@ -32,10 +37,13 @@ func (cl *channelLocker) Unlock() {
 // like all other Go locks, this lock is not recursive. Attempting to lock from within
 // a call to Process will deadlock.
 //
+// Goroutines that only emit signals or change properties can use SubmitSignal and
+// SubmitChange instead, which don't wait for the lock.
+//
 // RunLockable also returns a channel, which will receive one error value and close
 // when the connection is closed.
 func (c *Connection) RunLockable() (sync.Locker, <-chan error) {
-	lock := newChannelLocker()
+	lock := newChannelLocker(c)
 	errChannel := make(chan error, 1)
 
 	c.ensureHandler()
@@ -53,6 +61,8 @@ func (c *Connection) RunLockable() (sync.Locker, <-chan error) {
 				}
 			case <-lock.L:
 				<-lock.U
+				// Send changes made while locked without waiting for the flush timer
+				c.flush()
 			}
 		}
 	}()
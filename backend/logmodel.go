@@ -0,0 +1,130 @@
+package qbackend
+
+// LogModel is embedded in another type instead of Model to create a model
+// of rows that are only appended, like a log of events. It keeps up to a
+// capacity of rows, and the oldest rows are dropped as new rows are appended.
+//
+// LogModel implements Row and RowCount of ModelDataSource; the type embedding
+// it must implement RoleNames. Rows are added with Append, which is the only
+// notification needed. Appends are sent with the rows that were dropped as a
+// single change, and the client applies them at most once per frame.
+//
+// The other methods of Model must not be used on a LogModel.
+type LogModel struct {
+	Model
+
+	capacity int
+	// ring holds the rows from head, and only grows up to capacity
+	ring  []interface{}
+	head  int
+	count int
+}
+
+// The capacity of a LogModel unless SetCapacity is called
+const defaultLogCapacity = 10000
+
+func (m *LogModel) Row(row int) interface{} {
+	return m.ring[(m.head+row)%len(m.ring)]
+}
+
+func (m *LogModel) RowCount() int {
+	return m.count
+}
+
+func (m *LogModel) Capacity() int {
+	if m.capacity < 1 {
+		return defaultLogCapacity
+	}
+	return m.capacity
+}
+
+// SetCapacity changes the maximum number of rows. If there are more rows, the
+// oldest are dropped.
+func (m *LogModel) SetCapacity(capacity int) {
+	if capacity < 1 {
+		capacity = 1
+	}
+	trimmed := 0
+	if m.count > capacity {
+		trimmed = m.count - capacity
+	}
+
+	ring := make([]interface{}, m.count-trimmed)
+	for i := range ring {
+		ring[i] = m.Row(trimmed + i)
+	}
+	m.ring, m.head, m.count = ring, 0, len(ring)
+	m.capacity = capacity
+
+	if trimmed > 0 {
+		m.appended(0, trimmed)
+	}
+}
+
+// Append adds rows after the last row, dropping the oldest rows beyond the
+// capacity of the model. Appending many rows in one call is more efficient.
+func (m *LogModel) Append(rows ...interface{}) {
+	capacity := m.Capacity()
+	if len(rows) > capacity {
+		// These would be dropped right away
+		rows = rows[len(rows)-capacity:]
+	}
+	trimmed := m.count + len(rows) - capacity
+	if trimmed < 0 {
+		trimmed = 0
+	}
+
+	for _, row := range rows {
+		if len(m.ring) < capacity {
+			// Until the ring is full, head is 0
+			m.ring = append(m.ring, row)
+			m.count++
+		} else {
+			// Overwrite the oldest row
+			m.ring[m.head] = row
+			m.head = (m.head + 1) % len(m.ring)
+		}
+	}
+
+	m.appended(len(rows), trimmed)
+}
+
+// Clear removes all rows
+func (m *LogModel) Clear() {
+	m.ring, m.head, m.count = nil, 0, 0
+	if m.ModelAPI != nil {
+		m.Reset()
+	}
+}
+
+// appended notifies the client that count rows were appended after trimmed
+// rows were removed from the start
+func (m *LogModel) appended(count, trimmed int) {
+	api := m.ModelAPI
+	data := m.dataSource()
+	if api == nil || data == nil {
+		// No-op for uninitialized objects
+		return
+	}
+
+	api.invalidateIndexes()
+	if s := api.snapshot; s != nil {
+		s.removed(0, trimmed)
+		s.inserted(data, m.count-count, count)
+	}
+	if v := api.view; v != nil {
+		old := v.rows
+		for i, row := range old {
+			if row < trimmed {
+				old[i] = -1
+			} else {
+				old[i] = row - trimmed
+			}
+		}
+		api.updateView(old, nil, nil)
+		return
+	}
+
+	rows, moreRows := api.getRows(m.count-count, count, api.BatchSize)
+	api.Emit("modelAppend", rows, moreRows, trimmed)
+}
@@ -0,0 +1,76 @@
+package qbackend
+
+import (
+	"reflect"
+	"testing"
+)
+
+type CustomLogModel struct {
+	LogModel
+}
+
+func (m *CustomLogModel) RoleNames() []string {
+	return []string{"message", "level"}
+}
+
+func (m *CustomLogModel) messages() []string {
+	rows, _ := m.ModelAPI.getRows(0, -1, 0)
+	var messages []string
+	for _, row := range rows {
+		messages = append(messages, row.([]interface{})[0].(string))
+	}
+	return messages
+}
+
+var _ ModelDataSource = &CustomLogModel{}
+
+func TestLogModel(t *testing.T) {
+	model := &CustomLogModel{}
+	if err := dummyConnection.InitObject(model); err != nil {
+		t.Fatalf("CustomLogModel object initialization failed: %s", err)
+	}
+
+	check := func(step string, expected ...string) {
+		t.Helper()
+		if messages := model.messages(); !reflect.DeepEqual(messages, expected) {
+			t.Errorf("%s: rows are %v, expected %v", step, messages, expected)
+		}
+	}
+
+	model.SetCapacity(3)
+	model.Append([]interface{}{"a", 0}, []interface{}{"b", 1})
+	check("append", "a", "b")
+	model.Append([]interface{}{"c", 0}, []interface{}{"d", 1})
+	check("append past capacity", "b", "c", "d")
+	model.Append([]interface{}{"e", 1}, []interface{}{"f", 0}, []interface{}{"g", 1}, []interface{}{"h", 0})
+	check("append more than capacity", "f", "g", "h")
+
+	model.SetCapacity(2)
+	check("shrink", "g", "h")
+	model.SetCapacity(4)
+	model.Append([]interface{}{"i", 1}, []interface{}{"j", 0})
+	check("grow", "g", "h", "i", "j")
+
+	model.ModelAPI.SetSortFilter(-1, false, 1, "1")
+	check("filter", "g", "i")
+	model.Append([]interface{}{"k", 1}, []interface{}{"l", 1})
+	check("append through filter", "i", "k", "l")
+	model.ModelAPI.SetSortFilter(-1, false, -1, "")
+
+	model.Clear()
+	check("clear")
+	if model.RowCount() != 0 {
+		t.Errorf("clear left %d rows", model.RowCount())
+	}
+}
+
+func BenchmarkLogModelAppend(b *testing.B) {
+	model := &CustomLogModel{}
+	if err := dummyConnection.InitObject(model); err != nil {
+		b.Fatalf("CustomLogModel object initialization failed: %s", err)
+	}
+	row := []interface{}{"message", 0}
+	for i := 0; i < b.N; i++ {
+		model.Append(row)
+	}
+}
@@ -1,5 +1,11 @@
 package qbackend
 
+import (
+	"reflect"
+	"regexp"
+	"sort"
+)
+
 // Model is embedded in another type instead of QObject to create
 // a data model, represented as a QAbstractItemModel to the client.
 //
@@ -32,20 +38,43 @@ type ModelDataSourceRows interface {
 	Rows() []interface{}
 }
 
+// modelRows is a list of rows for the model API. It has its own type name,
+// so the client can store rows natively instead of as JS values.
+type modelRows []interface{}
+
+// modelIndexes is a list of rows, counts, or roles for the model API. These
+// always fit in a client int, so the type is sent as a list of ints, which
+// other []int values are not.
+type modelIndexes []int
+
 // modelAPI implements the internal qbackend API for model data; see QBackendModel from the plugin
 type modelAPI struct {
 	QObject
 	Model     *Model `json:"-"`
 	RoleNames []string
 	BatchSize int
+	// Projection is the sorted list of role indexes included in row data.
+	// Other roles are sent as null. If empty, all roles are included.
+	Projection modelIndexes
 
 	// Signals
-	ModelReset   func([]interface{}, int)      `qbackend:"rowData,moreRows"`
-	ModelInsert  func(int, []interface{}, int) `qbackend:"start,rowData,moreRows"`
-	ModelRemove  func(int, int)                `qbackend:"start,end"`
-	ModelMove    func(int, int, int)           `qbackend:"start,end,destination"`
-	ModelUpdate  func(int, interface{})        `qbackend:"row,data"`
-	ModelRowData func(int, []interface{})      `qbackend:"start,rowData"`
+	ModelReset   func(modelRows, int)      `qbackend:"rowData,moreRows"`
+	ModelInsert  func(int, modelRows, int) `qbackend:"start,rowData,moreRows"`
+	ModelRemove  func(int, int)            `qbackend:"start,end"`
+	ModelMove    func(int, int, int)       `qbackend:"start,end,destination"`
+	ModelUpdate  func(int, modelRows)      `qbackend:"row,rowData"`
+	ModelRowData func(int, modelRows)      `qbackend:"start,rowData"`
+	// Roles is empty if all roles have changed
+	ModelUpdateRange func(int, modelRows, modelIndexes) `qbackend:"start,rowData,roles"`
+	// Rows are appended after trimmed rows are removed from the start; see LogModel
+	ModelAppend func(modelRows, int, int) `qbackend:"rowData,moreRows,trimmed"`
+
+	// view is set when the client has sorted or filtered the model; see modelsort.go
+	view *modelView
+	// snapshot is set once Refresh has been used; see modelrefresh.go
+	snapshot *rowSnapshot
+	// indexes of values by role for FindRows; see modelfind.go
+	indexes map[int]rowIndex
 }
 
 func (m *modelAPI) Reset() {
@@ -66,6 +95,177 @@ func (m *modelAPI) SetBatchSize(size int) {
 	m.Changed("BatchSize")
 }
 
+// SetProjection is called by the client to only receive data for some roles.
+// The change of the Projection property tells the client which rows use it.
+func (m *modelAPI) SetProjection(roles modelIndexes) {
+	var projection []int
+	seen := make(map[int]bool)
+	for _, role := range roles {
+		if role >= 0 && role < len(m.RoleNames) && !seen[role] {
+			projection = append(projection, role)
+			seen[role] = true
+		}
+	}
+	sort.Ints(projection)
+	if len(projection) == len(m.RoleNames) {
+		projection = nil
+	}
+
+	m.Projection = projection
+	m.Changed("Projection")
+}
+
+// SetSortFilter is called by the client to sort rows by the value of sortRole,
+// and to only include rows where the value of filterRole matches the regular
+// expression filter. A sortRole of -1 is unsorted, an empty filter includes all
+// rows, and a filterRole of -1 matches the filter against every role.
+func (m *modelAPI) SetSortFilter(sortRole int, descending bool, filterRole int, filter string) error {
+	var re *regexp.Regexp
+	if filter != "" {
+		var err error
+		if re, err = regexp.Compile(filter); err != nil {
+			return err
+		}
+	}
+	if sortRole < 0 || sortRole >= len(m.RoleNames) {
+		sortRole, descending = -1, false
+	}
+	if filterRole < 0 {
+		// A role beyond the row reads as empty, but -1 is any role
+		filterRole = -1
+	}
+	m.invalidateIndexes()
+
+	old := m.view
+	var view *modelView
+	if sortRole >= 0 || re != nil {
+		view = &modelView{
+			sortRole:   sortRole,
+			descending: descending,
+			filterRole: filterRole,
+			filter:     re,
+		}
+	}
+	if old == nil && view == nil {
+		return nil
+	}
+
+	var oldRows []int
+	if old != nil {
+		oldRows = old.rows
+	} else {
+		oldRows = identityRows(m.Model.dataSource())
+	}
+	m.view = view
+
+	if (old != nil && old.sorted() && view == nil) || (view != nil && view.sorted() &&
+		(old == nil || old.sortRole != view.sortRole || old.descending != view.descending)) {
+		// The order of rows has changed, which moves most of them
+		m.Model.Reset()
+	} else {
+		m.updateView(oldRows, nil, nil)
+	}
+	return nil
+}
+
+func identityRows(data ModelDataSource) []int {
+	if data == nil {
+		return nil
+	}
+	rows := make([]int, data.RowCount())
+	for i := range rows {
+		rows[i] = i
+	}
+	return rows
+}
+
+// updateView rebuilds the view after a change to the data source and sends
+// the difference from old, which is the previous view in terms of the rows of
+// the data source after the change. Rows for which changed returns true are
+// also updated.
+func (m *modelAPI) updateView(old []int, changed func(int) bool, roles []string) {
+	data := m.Model.dataSource()
+	if data == nil {
+		return
+	}
+
+	var rows []int
+	if m.view != nil {
+		m.view.rows = m.view.build(data)
+		rows = m.view.rows
+	} else {
+		rows = identityRows(data)
+	}
+
+	ops, ok := diffRows(old, rows, changed, maxViewMoves)
+	if !ok {
+		m.emitReset()
+		return
+	}
+	m.emitRowsOps(ops, roles)
+}
+
+// emitRowsOps sends changes from diffRows to the client, with updated values
+// for roles, or all roles if empty
+func (m *modelAPI) emitRowsOps(ops []rowsOp, roles []string) {
+	for _, op := range ops {
+		switch op.kind {
+		case rowsRemoved:
+			m.Emit("modelRemove", op.start, op.start+op.count-1)
+		case rowsMoved:
+			m.Emit("modelMove", op.start, op.start, op.dest)
+		case rowsInserted:
+			m.emitInserted(op.start, op.count)
+		case rowsUpdated:
+			m.updateRows(op.start, op.count, roles)
+		}
+	}
+}
+
+// rowCount and row read the rows of the model through the view
+func (m *modelAPI) rowCount(data ModelDataSource) int {
+	if m.view != nil {
+		return len(m.view.rows)
+	}
+	return data.RowCount()
+}
+
+func (m *modelAPI) row(data ModelDataSource, row int) interface{} {
+	if m.view != nil {
+		return data.Row(m.view.rows[row])
+	}
+	return data.Row(row)
+}
+
+// projectRow replaces the values of roles that aren't in the projection with
+// nil, and drops any after the last projected role.
+func (m *modelAPI) projectRow(row interface{}) interface{} {
+	return projectRow(row, m.Projection)
+}
+
+func projectRow(row interface{}, projection []int) interface{} {
+	if len(projection) == 0 {
+		return row
+	}
+
+	v := reflect.ValueOf(row)
+	if v.Kind() != reflect.Slice && v.Kind() != reflect.Array {
+		return row
+	}
+
+	size := projection[len(projection)-1] + 1
+	if size > v.Len() {
+		size = v.Len()
+	}
+	projected := make([]interface{}, size)
+	for _, role := range projection {
+		if role < size {
+			projected[role] = v.Index(role).Interface()
+		}
+	}
+	return projected
+}
+
 func (m *Model) dataSource() ModelDataSource {
 	// The QObject interface is embedded in Model, so it can be accessed from here,
 	// but Model is embedded in the app's model type as well, and that is the type
@@ -99,13 +299,13 @@ func (m *Model) InitObject() {
 	m.Connection().InitObject(m.ModelAPI)
 }
 
-func (m *modelAPI) getRows(start, count, batchSize int) ([]interface{}, int) {
+func (m *modelAPI) getRows(start, count, batchSize int) (modelRows, int) {
 	data := m.Model.dataSource()
 	if data == nil {
-		return []interface{}{}, 0
+		return modelRows{}, 0
 	}
 
-	rowCount, moreRows := data.RowCount(), 0
+	rowCount, moreRows := m.rowCount(data), 0
 	if start < 0 {
 		start = 0
 	} else if count < 0 {
@@ -127,41 +327,215 @@ func (m *modelAPI) getRows(start, count, batchSize int) ([]interface{}, int) {
 		count = batchSize
 	}
 
-	if s, ok := data.(ModelDataSourceRows); ok {
-		return s.Rows()[start:count], moreRows
+	if s, ok := data.(ModelDataSourceRows); ok && m.view != nil {
+		rows := make(modelRows, count)
+		all := s.Rows()
+		for i := 0; i < len(rows); i++ {
+			rows[i] = m.projectRow(all[m.view.rows[start+i]])
+		}
+		return rows, moreRows
+	} else if ok && len(m.Projection) == 0 {
+		return modelRows(s.Rows()[start : start+count]), moreRows
+	} else if ok {
+		rows := make(modelRows, count)
+		for i, row := range s.Rows()[start : start+count] {
+			rows[i] = m.projectRow(row)
+		}
+		return rows, moreRows
 	} else {
-		rows := make([]interface{}, count)
+		rows := make(modelRows, count)
 		for i := 0; i < len(rows); i++ {
-			rows[i] = data.Row(start + i)
+			rows[i] = m.projectRow(m.row(data, start+i))
 		}
 		return rows, moreRows
 	}
 }
 
 func (m *Model) Reset() {
-	rows, moreRows := m.ModelAPI.getRows(0, -1, m.ModelAPI.BatchSize)
-	m.ModelAPI.Emit("modelReset", rows, moreRows)
+	m.ModelAPI.invalidateIndexes()
+	if data := m.dataSource(); data != nil {
+		if v := m.ModelAPI.view; v != nil {
+			v.rows = v.build(data)
+		}
+		if m.ModelAPI.snapshot != nil {
+			m.ModelAPI.snapshot = newRowSnapshot(data, 0, data.RowCount())
+		}
+	}
+	m.ModelAPI.emitReset()
+}
+
+func (m *modelAPI) emitReset() {
+	rows, moreRows := m.getRows(0, -1, m.BatchSize)
+	m.Emit("modelReset", rows, moreRows)
 }
 
 func (m *Model) Inserted(start, count int) {
-	rows, moreRows := m.ModelAPI.getRows(start, count, m.ModelAPI.BatchSize)
-	m.ModelAPI.Emit("modelInsert", start, rows, moreRows)
+	m.ModelAPI.invalidateIndexes()
+	if s := m.ModelAPI.snapshot; s != nil {
+		s.inserted(m.dataSource(), start, count)
+	}
+	if v := m.ModelAPI.view; v != nil {
+		old := v.rows
+		for i, row := range old {
+			if row >= start {
+				old[i] = row + count
+			}
+		}
+		m.ModelAPI.updateView(old, nil, nil)
+		return
+	}
+	m.ModelAPI.emitInserted(start, count)
+}
+
+func (m *modelAPI) emitInserted(start, count int) {
+	rows, moreRows := m.getRows(start, count, m.BatchSize)
+	m.Emit("modelInsert", start, rows, moreRows)
 }
 
 func (m *Model) Removed(start, count int) {
+	m.ModelAPI.invalidateIndexes()
+	if s := m.ModelAPI.snapshot; s != nil {
+		s.removed(start, count)
+	}
+	if v := m.ModelAPI.view; v != nil {
+		old := v.rows
+		for i, row := range old {
+			if row >= start+count {
+				old[i] = row - count
+			} else if row >= start {
+				// Not a row of the data source, so it will be removed
+				old[i] = -1
+			}
+		}
+		m.ModelAPI.updateView(old, nil, nil)
+		return
+	}
 	m.ModelAPI.Emit("modelRemove", start, start+count-1)
 }
 
 func (m *Model) Moved(start, count, destination int) {
+	m.ModelAPI.invalidateIndexes()
+	if s := m.ModelAPI.snapshot; s != nil {
+		s.moved(start, count, destination)
+	}
+	if v := m.ModelAPI.view; v != nil {
+		old := v.rows
+		for i, row := range old {
+			old[i] = movedRow(row, start, count, destination)
+		}
+		m.ModelAPI.updateView(old, nil, nil)
+		return
+	}
 	m.ModelAPI.Emit("modelMove", start, start+count-1, destination)
 }
 
+// movedRow returns the new index of row after count rows from start are moved
+// to before destination.
+func movedRow(row, start, count, destination int) int {
+	if destination < start {
+		if row >= destination && row < start {
+			return row + count
+		} else if row >= start && row < start+count {
+			return row - (start - destination)
+		}
+	} else if destination > start+count {
+		if row >= start+count && row < destination {
+			return row - count
+		} else if row >= start && row < start+count {
+			return row + destination - start - count
+		}
+	}
+	return row
+}
+
 func (m *Model) Updated(row int) {
 	data := m.dataSource()
 	if data == nil {
 		// No-op for uninitialized objects
 		return
 	}
+	m.ModelAPI.invalidateIndexes()
+	if s := m.ModelAPI.snapshot; s != nil {
+		s.updated(data, row, 1)
+	}
+
+	if v := m.ModelAPI.view; v != nil {
+		m.ModelAPI.updateView(v.rows, func(r int) bool { return r == row }, nil)
+		return
+	}
+	m.ModelAPI.Emit("modelUpdate", row, modelRows{m.ModelAPI.projectRow(data.Row(row))})
+}
+
+// UpdatedRange notifies the client that roles have changed for count rows
+// from start. Only the values of those roles are sent, and the client emits
+// one dataChanged for adjacent ranges with the same roles. If no roles are
+// given, all roles have changed.
+func (m *Model) UpdatedRange(start, count int, roles ...string) {
+	data := m.dataSource()
+	if data == nil || count < 1 {
+		// No-op for uninitialized objects
+		return
+	}
+	m.ModelAPI.invalidateIndexes()
+	if s := m.ModelAPI.snapshot; s != nil {
+		s.updated(data, start, count)
+	}
+
+	if v := m.ModelAPI.view; v != nil {
+		m.ModelAPI.updateView(v.rows, func(r int) bool { return r >= start && r < start+count }, roles)
+		return
+	}
+	m.ModelAPI.updateRows(start, count, roles)
+}
+
+func (m *modelAPI) updateRows(start, count int, roles []string) {
+	data := m.Model.dataSource()
 
-	m.ModelAPI.Emit("modelUpdate", row, data.Row(row))
+	// Changed roles are sent to the client, and an empty list is all roles.
+	// Values are sent for changed roles that are also in the projection.
+	changed := []int{}
+	projection := m.Projection
+	if len(roles) > 0 {
+		for _, name := range roles {
+			for i, roleName := range m.RoleNames {
+				if roleName == name {
+					changed = append(changed, i)
+					break
+				}
+			}
+		}
+		sort.Ints(changed)
+
+		if len(projection) == 0 {
+			projection = changed
+		} else {
+			projection = intersectSorted(changed, projection)
+		}
+		if len(projection) == 0 {
+			// None of the changed roles are fetched by the client
+			return
+		}
+	}
+
+	rows := make(modelRows, count)
+	for i := 0; i < count; i++ {
+		rows[i] = projectRow(m.row(data, start+i), projection)
+	}
+	m.Emit("modelUpdateRange", start, rows, changed)
+}
+
+func intersectSorted(a, b []int) []int {
+	result := []int{}
+	for i, j := 0, 0; i < len(a) && j < len(b); {
+		if a[i] == b[j] {
+			result = append(result, a[i])
+			i++
+			j++
+		} else if a[i] < b[j] {
+			i++
+		} else {
+			j++
+		}
+	}
+	return result
 }
@@ -2,6 +2,8 @@ package qbackend
 
 import (
 	"fmt"
+	"math/rand"
+	"reflect"
 	"testing"
 )
 
@@ -42,3 +44,462 @@ func TestModelType(t *testing.T) {
 		t.Error("RoleNames not initialized during QObject initialization")
 	}
 }
+
+type CustomRowsModel struct {
+	CustomModel
+	rows []interface{}
+}
+
+func (m *CustomRowsModel) RowCount() int {
+	return len(m.rows)
+}
+
+func (m *CustomRowsModel) Rows() []interface{} {
+	return m.rows
+}
+
+var _ ModelDataSourceRows = &CustomRowsModel{}
+
+func TestModelRows(t *testing.T) {
+	model := &CustomRowsModel{rows: []interface{}{"a", "b", "c", "d"}}
+	if err := dummyConnection.InitObject(model); err != nil {
+		t.Fatalf("CustomRowsModel object initialization failed: %s", err)
+	}
+
+	rows, moreRows := model.ModelAPI.getRows(1, 2, 0)
+	if len(rows) != 2 || rows[0] != "b" || rows[1] != "c" || moreRows != 0 {
+		t.Errorf("getRows(1, 2) returned %v, %d", rows, moreRows)
+	}
+
+	rows, moreRows = model.ModelAPI.getRows(2, -1, 1)
+	if len(rows) != 1 || rows[0] != "c" || moreRows != 1 {
+		t.Errorf("getRows(2, -1) with batch size 1 returned %v, %d", rows, moreRows)
+	}
+
+	// Row data uses the native rows type on the client
+	ti, err := parseType(reflect.TypeOf(model.ModelAPI))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if params := ti.Signals["modelRowData"]; len(params) != 2 || params[1] != "rows rowData" {
+		t.Errorf("modelRowData has parameters %v, expected rows", params)
+	}
+}
+
+type CustomRolesModel struct {
+	CustomModel
+}
+
+func (m *CustomRolesModel) Row(row int) interface{} {
+	return []interface{}{row, fmt.Sprintf("row %d", row), row * 2}
+}
+
+func (m *CustomRolesModel) RoleNames() []string {
+	return []string{"number", "text", "double"}
+}
+
+func TestModelProjection(t *testing.T) {
+	model := &CustomRolesModel{}
+	if err := dummyConnection.InitObject(model); err != nil {
+		t.Fatalf("CustomRolesModel object initialization failed: %s", err)
+	}
+
+	model.ModelAPI.SetProjection([]int{1, 1, 7, -1})
+	if !reflect.DeepEqual(model.ModelAPI.Projection, modelIndexes{1}) {
+		t.Errorf("projection is %v, expected [1]", model.ModelAPI.Projection)
+	}
+	// As called by the client
+	if _, err := model.ModelAPI.invoke("setProjection", []interface{}{1.0, 0.0}); err != nil {
+		t.Errorf("invoking setProjection failed: %s", err)
+	}
+	if !reflect.DeepEqual(model.ModelAPI.Projection, modelIndexes{0, 1}) {
+		t.Errorf("projection is %v, expected [0 1]", model.ModelAPI.Projection)
+	}
+	model.ModelAPI.SetProjection([]int{1})
+
+	rows, _ := model.ModelAPI.getRows(1, 1, 0)
+	if expected := (modelRows{[]interface{}{nil, "row 1"}}); !reflect.DeepEqual(rows, expected) {
+		t.Errorf("projected rows are %v, expected %v", rows, expected)
+	}
+
+	// All roles is the same as no projection
+	model.ModelAPI.SetProjection([]int{2, 0, 1})
+	if model.ModelAPI.Projection != nil {
+		t.Errorf("projection of all roles is %v, expected nil", model.ModelAPI.Projection)
+	}
+	rows, _ = model.ModelAPI.getRows(2, 1, 0)
+	if expected := (modelRows{[]interface{}{2, "row 2", 4}}); !reflect.DeepEqual(rows, expected) {
+		t.Errorf("unprojected rows are %v, expected %v", rows, expected)
+	}
+}
+
+func TestModelUpdatedRange(t *testing.T) {
+	model := &CustomRolesModel{}
+	if err := dummyConnection.InitObject(model); err != nil {
+		t.Fatalf("CustomRolesModel object initialization failed: %s", err)
+	}
+
+	if result := intersectSorted([]int{0, 2, 3, 5}, []int{1, 2, 5, 6}); !reflect.DeepEqual(result, []int{2, 5}) {
+		t.Errorf("intersectSorted returned %v", result)
+	}
+
+	rows := make(modelRows, 2)
+	for i := range rows {
+		rows[i] = projectRow(model.Row(i), []int{0, 2})
+	}
+	if expected := (modelRows{[]interface{}{0, nil, 0}, []interface{}{1, nil, 2}}); !reflect.DeepEqual(rows, expected) {
+		t.Errorf("projected rows are %v, expected %v", rows, expected)
+	}
+
+	// Not referenced by a client, so these only check that nothing panics
+	model.UpdatedRange(0, 3, "text", "missing")
+	model.UpdatedRange(0, 3)
+}
+
+type SortFilterModel struct {
+	Model
+	rows [][]interface{}
+}
+
+func (m *SortFilterModel) Row(row int) interface{} {
+	return m.rows[row]
+}
+
+func (m *SortFilterModel) RowCount() int {
+	return len(m.rows)
+}
+
+func (m *SortFilterModel) RoleNames() []string {
+	return []string{"name", "size"}
+}
+
+func (m *SortFilterModel) names() []string {
+	rows, _ := m.ModelAPI.getRows(0, -1, 0)
+	var names []string
+	for _, row := range rows {
+		names = append(names, row.([]interface{})[0].(string))
+	}
+	return names
+}
+
+func TestModelSortFilter(t *testing.T) {
+	model := &SortFilterModel{rows: [][]interface{}{
+		{"carrot", 3},
+		{"apple", 10},
+		{"banana", 2},
+		{"cherry", 2},
+	}}
+	if err := dummyConnection.InitObject(model); err != nil {
+		t.Fatalf("SortFilterModel object initialization failed: %s", err)
+	}
+
+	check := func(step string, expected ...string) {
+		t.Helper()
+		if names := model.names(); !reflect.DeepEqual(names, expected) {
+			t.Errorf("%s: rows are %v, expected %v", step, names, expected)
+		}
+	}
+
+	model.ModelAPI.SetSortFilter(1, false, -1, "")
+	check("sort by size", "banana", "cherry", "carrot", "apple")
+	model.ModelAPI.SetSortFilter(0, true, -1, "")
+	check("sort by name descending", "cherry", "carrot", "banana", "apple")
+	model.ModelAPI.SetSortFilter(0, false, 0, "^c")
+	check("filter by name", "carrot", "cherry")
+	if err := model.ModelAPI.SetSortFilter(0, false, 0, "("); err == nil {
+		t.Error("invalid filter did not return an error")
+	}
+
+	model.rows = append([][]interface{}{{"coconut", 1}}, model.rows...)
+	model.Inserted(0, 1)
+	check("insert", "carrot", "cherry", "coconut")
+
+	model.rows[2] = []interface{}{"cabbage", 10}
+	model.Updated(2)
+	check("update", "cabbage", "carrot", "cherry", "coconut")
+
+	model.rows = append(model.rows[:1], model.rows[2:]...)
+	model.Removed(1, 1)
+	check("remove", "cabbage", "cherry", "coconut")
+
+	model.ModelAPI.SetSortFilter(-1, false, 1, "^2$")
+	check("filter without sort", "banana", "cherry")
+	model.rows[1], model.rows[2], model.rows[3] = model.rows[3], model.rows[1], model.rows[2]
+	model.Moved(3, 1, 1)
+	check("move", "cherry", "banana")
+
+	model.ModelAPI.SetSortFilter(-1, false, -1, "")
+	if model.ModelAPI.view != nil {
+		t.Error("view is still active without sort or filter")
+	}
+	check("no sort or filter", "coconut", "cherry", "cabbage", "banana")
+}
+
+// applyRowsOps returns the rows after ops from diffRows, and the updated rows
+func applyRowsOps(old, new []int, ops []rowsOp) ([]int, map[int]bool) {
+	rows := append([]int{}, old...)
+	updated := make(map[int]bool)
+	for _, op := range ops {
+		switch op.kind {
+		case rowsRemoved:
+			rows = append(rows[:op.start], rows[op.start+op.count:]...)
+		case rowsMoved:
+			id := rows[op.start]
+			rows = append(rows[:op.start], rows[op.start+1:]...)
+			dest := op.dest
+			if dest > op.start {
+				dest--
+			}
+			rows = append(rows[:dest], append([]int{id}, rows[dest:]...)...)
+		case rowsInserted:
+			rows = append(rows[:op.start], append(append([]int{}, new[op.start:op.start+op.count]...), rows[op.start:]...)...)
+		case rowsUpdated:
+			for r := op.start; r < op.start+op.count; r++ {
+				updated[rows[r]] = true
+			}
+		}
+	}
+	return rows, updated
+}
+
+func TestDiffRows(t *testing.T) {
+	rnd := rand.New(rand.NewSource(1))
+	for i := 0; i < 1000; i++ {
+		// Random subsets of the same ids in random orders
+		var old, new []int
+		for _, id := range rnd.Perm(rnd.Intn(30)) {
+			if rnd.Intn(4) > 0 {
+				old = append(old, id)
+			}
+		}
+		for _, id := range rnd.Perm(30) {
+			if rnd.Intn(3) > 0 {
+				new = append(new, id)
+			}
+		}
+		changed := func(id int) bool { return id%3 == 0 }
+
+		ops, ok := diffRows(old, new, changed, len(old))
+		if !ok {
+			t.Fatalf("diff of %v to %v needed too many moves", old, new)
+		}
+		rows, updated := applyRowsOps(old, new, ops)
+		if !reflect.DeepEqual(rows, new) && (len(rows) > 0 || len(new) > 0) {
+			t.Fatalf("diff of %v to %v produced %v with %v", old, new, rows, ops)
+		}
+		for _, id := range old {
+			if changed(id) && indexOfInt(new, id) >= 0 && !updated[id] {
+				t.Fatalf("diff of %v to %v did not update %d", old, new, id)
+			}
+		}
+	}
+
+	if _, ok := diffRows([]int{0, 1, 2, 3}, []int{3, 2, 1, 0}, nil, 2); ok {
+		t.Error("diff with more than maxMoves moves did not fail")
+	}
+	if ops, _ := diffRows([]int{0, 1, 2, 3}, []int{1, 2, 3, 0}, nil, 2); len(ops) != 1 {
+		t.Errorf("moving one row used %v", ops)
+	}
+}
+
+type RefreshModel struct {
+	CustomRowsModel
+}
+
+func (m *RefreshModel) Row(row int) interface{} {
+	return m.rows[row]
+}
+
+func TestModelRefresh(t *testing.T) {
+	model := &RefreshModel{}
+	for i := 0; i < 6; i++ {
+		model.rows = append(model.rows, []interface{}{fmt.Sprintf("key %d", i), i})
+	}
+	if err := dummyConnection.InitObject(model); err != nil {
+		t.Fatalf("RefreshModel object initialization failed: %s", err)
+	}
+
+	model.Refresh()
+	if model.ModelAPI.snapshot == nil {
+		t.Fatal("first refresh did not take a snapshot")
+	}
+
+	model.rows = append(model.rows, []interface{}{"key 6", 6})
+	model.Inserted(6, 1)
+	model.rows[2] = []interface{}{"key 2", 20}
+	model.Updated(2)
+	if expected := newRowSnapshot(model, 0, len(model.rows)); !reflect.DeepEqual(model.ModelAPI.snapshot, expected) {
+		t.Errorf("snapshot %v did not follow changes, expected %v", model.ModelAPI.snapshot, expected)
+	}
+
+	// Remove key 1, insert key 7, update key 3, and move key 5 to the front
+	model.rows = []interface{}{
+		[]interface{}{"key 5", 5},
+		[]interface{}{"key 0", 0},
+		[]interface{}{"key 7", 7},
+		[]interface{}{"key 2", 20},
+		[]interface{}{"key 3", 30},
+		[]interface{}{"key 4", 4},
+		[]interface{}{"key 6", 6},
+	}
+	old := model.ModelAPI.snapshot
+	snapshot := newRowSnapshot(model, 0, len(model.rows))
+	newIds, newIndex := snapshot.match(old)
+	if expected := []int{5, 0, 7, 2, 3, 4, 6}; !reflect.DeepEqual(newIds, expected) {
+		t.Errorf("matched rows %v, expected %v", newIds, expected)
+	}
+
+	oldIds := []int{0, 1, 2, 3, 4, 5, 6}
+	ops, ok := diffRows(oldIds, newIds, func(id int) bool {
+		return old.hashes[id] != snapshot.hashes[newIndex[id]]
+	}, maxRefreshMoves)
+	if !ok {
+		t.Fatal("refresh diff failed")
+	}
+	rows, updated := applyRowsOps(oldIds, newIds, ops)
+	if !reflect.DeepEqual(rows, newIds) {
+		t.Errorf("refresh diff produced %v with %v", rows, ops)
+	}
+	if !reflect.DeepEqual(updated, map[int]bool{3: true}) {
+		t.Errorf("refresh diff updated %v, expected key 3", updated)
+	}
+
+	model.Refresh()
+	if !reflect.DeepEqual(model.ModelAPI.snapshot, snapshot) {
+		t.Error("refresh did not update the snapshot")
+	}
+
+	// Refresh through a sorted view
+	model.ModelAPI.SetSortFilter(0, true, -1, "")
+	model.rows = append(model.rows[1:], []interface{}{"key 8", 8})
+	model.Refresh()
+	rowData, _ := model.ModelAPI.getRows(0, -1, 0)
+	var keys []string
+	for _, row := range rowData {
+		keys = append(keys, row.([]interface{})[0].(string))
+	}
+	if expected := []string{"key 8", "key 7", "key 6", "key 4", "key 3", "key 2", "key 0"}; !reflect.DeepEqual(keys, expected) {
+		t.Errorf("refresh of sorted view has rows %v, expected %v", keys, expected)
+	}
+}
+
+func BenchmarkModelRefresh(b *testing.B) {
+	const size = 100000
+	setup := func(b *testing.B) *RefreshModel {
+		model := &RefreshModel{}
+		for i := 0; i < size; i++ {
+			model.rows = append(model.rows, []interface{}{i, fmt.Sprintf("row %d", i), float64(i)})
+		}
+		if err := dummyConnection.InitObject(model); err != nil {
+			b.Fatalf("RefreshModel object initialization failed: %s", err)
+		}
+		model.Refresh()
+		return model
+	}
+
+	b.Run("Unchanged", func(b *testing.B) {
+		model := setup(b)
+		b.ResetTimer()
+		for i := 0; i < b.N; i++ {
+			model.Refresh()
+		}
+	})
+
+	b.Run("SmallChanges", func(b *testing.B) {
+		model := setup(b)
+		rnd := rand.New(rand.NewSource(1))
+		next := size
+		b.ResetTimer()
+		for i := 0; i < b.N; i++ {
+			// A few updates, inserts, and removes, and one move
+			b.StopTimer()
+			for j := 0; j < 10; j++ {
+				r := rnd.Intn(len(model.rows))
+				row := model.rows[r].([]interface{})
+				model.rows[r] = []interface{}{row[0], row[1], rnd.Float64()}
+			}
+			for j := 0; j < 5; j++ {
+				r := rnd.Intn(len(model.rows))
+				model.rows = append(model.rows[:r], append([]interface{}{[]interface{}{next, "new", 0.0}}, model.rows[r:]...)...)
+				next++
+				r = rnd.Intn(len(model.rows))
+				model.rows = append(model.rows[:r], model.rows[r+1:]...)
+			}
+			from, to := rnd.Intn(len(model.rows)), rnd.Intn(len(model.rows)-1)
+			row := model.rows[from]
+			model.rows = append(model.rows[:from], model.rows[from+1:]...)
+			model.rows = append(model.rows[:to], append([]interface{}{row}, model.rows[to:]...)...)
+			b.StartTimer()
+
+			model.Refresh()
+		}
+	})
+}
+
+func TestModelFindRows(t *testing.T) {
+	model := &SortFilterModel{rows: [][]interface{}{
+		{"carrot", 3},
+		{"apple", 10},
+		{"banana", 2},
+		{"cherry", 2},
+	}}
+	if err := dummyConnection.InitObject(model); err != nil {
+		t.Fatalf("SortFilterModel object initialization failed: %s", err)
+	}
+
+	check := func(step string, role int, value interface{}, expected ...int) {
+		t.Helper()
+		rows, err := model.ModelAPI.FindRows(role, value)
+		if err != nil {
+			t.Errorf("%s: FindRows failed: %s", step, err)
+		} else if expected == nil && len(rows) != 0 || expected != nil && !reflect.DeepEqual(rows, expected) {
+			t.Errorf("%s: found rows %v, expected %v", step, rows, expected)
+		}
+	}
+
+	check("find by name", 0, "banana", 2)
+	// Values from the client are float64
+	check("find by size", 1, float64(2), 2, 3)
+	check("find missing", 1, float64(4))
+	if _, err := model.ModelAPI.FindRows(2, "x"); err == nil {
+		t.Error("FindRows of an invalid role did not fail")
+	}
+
+	model.rows[1][1] = 2
+	model.Updated(1)
+	check("find after update", 1, float64(2), 1, 2, 3)
+
+	model.ModelAPI.SetSortFilter(0, true, -1, "")
+	check("find in sorted view", 1, float64(2), 0, 2, 3)
+	check("find in sorted view", 0, "carrot", 1)
+	model.ModelAPI.SetSortFilter(-1, false, 0, "^c")
+	check("find in filtered view", 0, "cherry", 1)
+}
+
+func BenchmarkModelFindRows(b *testing.B) {
+	const size = 1000000
+	model := &RefreshModel{}
+	for i := 0; i < size; i++ {
+		model.rows = append(model.rows, []interface{}{i})
+	}
+	if err := dummyConnection.InitObject(model); err != nil {
+		b.Fatalf("RefreshModel object initialization failed: %s", err)
+	}
+
+	b.Run("Index", func(b *testing.B) {
+		for i := 0; i < b.N; i++ {
+			model.ModelAPI.invalidateIndexes()
+			model.ModelAPI.FindRows(0, float64(i%size))
+		}
+	})
+
+	b.Run("Find", func(b *testing.B) {
+		model.ModelAPI.FindRows(0, float64(0))
+		b.ResetTimer()
+		for i := 0; i < b.N; i++ {
+			if rows, _ := model.ModelAPI.FindRows(0, float64(i%size)); len(rows) != 1 {
+				b.Fatalf("found rows %v", rows)
+			}
+		}
+	})
+}
@@ -0,0 +1,109 @@
+package qbackend
+
+import (
+	"fmt"
+	"reflect"
+)
+
+// rowIndex maps values of a role to the rows that have them. Rows are positions
+// in the model as seen by the client, i.e. through the view. Most values in a
+// role that is searched are unique, so only the rows after the first of each
+// value are in a list.
+type rowIndex struct {
+	first map[interface{}]int
+	more  map[interface{}][]int
+}
+
+func (index *rowIndex) find(key interface{}) []int {
+	first, exists := index.first[key]
+	if !exists {
+		return []int{}
+	}
+	return append([]int{first}, index.more[key]...)
+}
+
+// FindRows is called by the client to find the rows where the value of role
+// equals value, in order. Numbers are equal if they have the same value, and
+// values of other types that can't be compared are compared as text.
+//
+// The first search of a role builds an index of its values, which is kept
+// until the data changes.
+func (m *modelAPI) FindRows(role int, value interface{}) ([]int, error) {
+	data := m.Model.dataSource()
+	if data == nil {
+		return []int{}, nil
+	}
+	if role < 0 || role >= len(m.RoleNames) {
+		return nil, fmt.Errorf("invalid role %d", role)
+	}
+
+	index, exists := m.indexes[role]
+	if !exists {
+		index = m.buildIndex(data, role)
+		if m.indexes == nil {
+			m.indexes = make(map[int]rowIndex)
+		}
+		m.indexes[role] = index
+	}
+
+	return index.find(indexKey(value)), nil
+}
+
+func (m *modelAPI) buildIndex(data ModelDataSource, role int) rowIndex {
+	var all []interface{}
+	if s, ok := data.(ModelDataSourceRows); ok {
+		all = s.Rows()
+	}
+
+	count := m.rowCount(data)
+	index := rowIndex{
+		first: make(map[interface{}]int, count),
+		more:  make(map[interface{}][]int),
+	}
+	for i := 0; i < count; i++ {
+		var row interface{}
+		if all != nil && m.view != nil {
+			row = all[m.view.rows[i]]
+		} else if all != nil {
+			row = all[i]
+		} else {
+			row = m.row(data, i)
+		}
+
+		key := indexKey(rowValue(row, role))
+		if _, exists := index.first[key]; exists {
+			index.more[key] = append(index.more[key], i)
+		} else {
+			index.first[key] = i
+		}
+	}
+	return index
+}
+
+// invalidateIndexes drops indexes for FindRows after any change to the rows
+// or the view
+func (m *modelAPI) invalidateIndexes() {
+	m.indexes = nil
+}
+
+// indexKey normalizes values, so values from the client are equal to those
+// of rows. Numbers are float64, as they are from JSON.
+func indexKey(value interface{}) interface{} {
+	v := reflect.ValueOf(value)
+	switch v.Kind() {
+	case reflect.Invalid:
+		return nil
+	case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
+		return float64(v.Int())
+	case reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64, reflect.Uintptr:
+		return float64(v.Uint())
+	case reflect.Float32, reflect.Float64:
+		return v.Float()
+	case reflect.String:
+		return v.String()
+	case reflect.Bool:
+		return v.Bool()
+	default:
+		return fmt.Sprint(value)
+	}
+}
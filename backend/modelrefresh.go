@@ -0,0 +1,281 @@
+package qbackend
+
+import (
+	"fmt"
+	"math"
+	"reflect"
+	"time"
+)
+
+// ModelDataSourceKeys can be implemented by models to identify rows for
+// Model.Refresh. Rows with the same key before and after a refresh are the
+// same row, which may have moved or changed. Keys should be unique; if not,
+// rows with the same key are matched in order.
+//
+// Without RowKey, the value of the first role is the key.
+type ModelDataSourceKeys interface {
+	ModelDataSource
+	RowKey(row int) interface{}
+}
+
+// Moving rows one by one is worse than a reset when many rows have moved
+const maxRefreshMoves = 100
+
+// rowSnapshot is the key and a hash of the content of each row, as of the
+// last Reset or Refresh. It's only kept once Refresh has been used, and is
+// updated by the other change notifications.
+type rowSnapshot struct {
+	keys   []interface{}
+	hashes []uint64
+}
+
+// Refresh compares all rows to the last Reset or Refresh and sends the
+// difference to the client as removed, moved, inserted, and updated rows,
+// instead of a reset. Delegates, the scroll position, and cached rows on the
+// client are kept for rows that still exist.
+//
+// This is meant for data sources that change wholesale, where it is hard to
+// know what changed. The first Refresh is a Reset, because there is nothing
+// to compare to. Refresh is faster for ModelDataSourceRows.
+func (m *Model) Refresh() {
+	data := m.dataSource()
+	if data == nil {
+		return
+	}
+
+	api := m.ModelAPI
+	api.invalidateIndexes()
+	old := api.snapshot
+	if old == nil {
+		m.Reset()
+		api.snapshot = newRowSnapshot(data, 0, data.RowCount())
+		return
+	}
+	api.snapshot = newRowSnapshot(data, 0, data.RowCount())
+	newIds, newIndex := api.snapshot.match(old)
+	newHashes := api.snapshot.hashes
+
+	if v := api.view; v != nil {
+		// The view is in terms of source rows, which can be mapped to new rows
+		oldRows := v.rows
+		for i, row := range oldRows {
+			oldRows[i] = newIndex[row]
+		}
+		api.updateView(oldRows, func(row int) bool {
+			id := newIds[row]
+			return id < len(old.keys) && old.hashes[id] != newHashes[row]
+		}, nil)
+		return
+	}
+
+	oldIds := make([]int, len(old.keys))
+	for i := range oldIds {
+		oldIds[i] = i
+	}
+	ops, ok := diffRows(oldIds, newIds, func(id int) bool {
+		return old.hashes[id] != newHashes[newIndex[id]]
+	}, maxRefreshMoves)
+	if !ok {
+		api.emitReset()
+		return
+	}
+	api.emitRowsOps(ops, nil)
+}
+
+// match identifies the rows of s with rows of old by key, and by occurrence of
+// the key if it isn't unique. The rows of old have ids from 0; newIds is the id
+// of each row in s, with new ids for rows not in old, and newIndex is the row
+// in s of each row of old, or -1 if it was removed.
+func (s *rowSnapshot) match(old *rowSnapshot) (newIds, newIndex []int) {
+	// First row of each key, and later rows of keys that aren't unique
+	ids := make(map[interface{}]int, len(old.keys))
+	var duplicates map[interface{}][]int
+	for i, key := range old.keys {
+		if _, exists := ids[key]; !exists {
+			ids[key] = i
+		} else {
+			if duplicates == nil {
+				duplicates = make(map[interface{}][]int)
+			}
+			duplicates[key] = append(duplicates[key], i)
+		}
+	}
+
+	newIndex = make([]int, len(old.keys))
+	for i := range newIndex {
+		newIndex[i] = -1
+	}
+	newIds = make([]int, len(s.keys))
+	nextId := len(old.keys)
+	for i, key := range s.keys {
+		id, exists := ids[key]
+		if exists && newIndex[id] >= 0 {
+			// Match the next row with this key, if there is one
+			if rows := duplicates[key]; len(rows) > 0 {
+				id, duplicates[key] = rows[0], rows[1:]
+			} else {
+				exists = false
+			}
+		}
+		if exists {
+			newIds[i] = id
+			newIndex[id] = i
+		} else {
+			newIds[i] = nextId
+			nextId++
+		}
+	}
+	return
+}
+
+func newRowSnapshot(data ModelDataSource, start, count int) *rowSnapshot {
+	s := &rowSnapshot{
+		keys:   make([]interface{}, count),
+		hashes: make([]uint64, count),
+	}
+	s.read(data, start, 0, count)
+	return s
+}
+
+// read the rows from start into the snapshot at index
+func (s *rowSnapshot) read(data ModelDataSource, start, index, count int) {
+	keyed, _ := data.(ModelDataSourceKeys)
+	var rows []interface{}
+	if r, ok := data.(ModelDataSourceRows); ok {
+		rows = r.Rows()
+	}
+
+	for i := 0; i < count; i++ {
+		var row interface{}
+		if rows != nil {
+			row = rows[start+i]
+		} else {
+			row = data.Row(start + i)
+		}
+
+		var key interface{}
+		if keyed != nil {
+			key = keyed.RowKey(start + i)
+		} else {
+			key = rowValue(row, 0)
+		}
+		if key != nil && !reflect.TypeOf(key).Comparable() {
+			key = fmt.Sprint(key)
+		}
+
+		s.keys[index+i] = key
+		s.hashes[index+i] = hashValue(fnvOffset, reflect.ValueOf(row), 0)
+	}
+}
+
+// The snapshot follows other changes, so Refresh only sends what has changed
+// since the last notification.
+
+func (s *rowSnapshot) inserted(data ModelDataSource, start, count int) {
+	s.keys = append(s.keys[:start], append(make([]interface{}, count), s.keys[start:]...)...)
+	s.hashes = append(s.hashes[:start], append(make([]uint64, count), s.hashes[start:]...)...)
+	s.read(data, start, start, count)
+}
+
+func (s *rowSnapshot) removed(start, count int) {
+	s.keys = append(s.keys[:start], s.keys[start+count:]...)
+	s.hashes = append(s.hashes[:start], s.hashes[start+count:]...)
+}
+
+func (s *rowSnapshot) moved(start, count, destination int) {
+	keys := make([]interface{}, len(s.keys))
+	hashes := make([]uint64, len(s.hashes))
+	for i := range s.keys {
+		j := movedRow(i, start, count, destination)
+		keys[j], hashes[j] = s.keys[i], s.hashes[i]
+	}
+	s.keys, s.hashes = keys, hashes
+}
+
+func (s *rowSnapshot) updated(data ModelDataSource, start, count int) {
+	s.read(data, start, start, count)
+}
+
+// FNV-1a, inline to avoid allocating for each value. Numbers are hashed as one
+// word instead of by byte, which is good enough to notice changes.
+const (
+	fnvOffset uint64 = 14695981039346656037
+	fnvPrime  uint64 = 1099511628211
+)
+
+func hashUint(h, v uint64) uint64 {
+	h ^= v
+	h *= fnvPrime
+	return h
+}
+
+func hashString(h uint64, s string) uint64 {
+	h = hashUint(h, uint64(len(s)))
+	for i := 0; i < len(s); i++ {
+		h ^= uint64(s[i])
+		h *= fnvPrime
+	}
+	return h
+}
+
+// hashValue hashes the content of a row for Refresh. Objects are hashed by
+// identity, because their changes are sent separately.
+func hashValue(h uint64, v reflect.Value, depth int) uint64 {
+	if depth > 32 {
+		return h
+	}
+	h = hashUint(h, uint64(v.Kind()))
+
+	switch v.Kind() {
+	case reflect.Invalid:
+		return h
+	case reflect.Bool:
+		if v.Bool() {
+			return hashUint(h, 1)
+		}
+		return hashUint(h, 0)
+	case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
+		return hashUint(h, uint64(v.Int()))
+	case reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64, reflect.Uintptr:
+		return hashUint(h, v.Uint())
+	case reflect.Float32, reflect.Float64:
+		return hashUint(h, math.Float64bits(v.Float()))
+	case reflect.String:
+		return hashString(h, v.String())
+	case reflect.Slice, reflect.Array:
+		h = hashUint(h, uint64(v.Len()))
+		for i := 0; i < v.Len(); i++ {
+			h = hashValue(h, v.Index(i), depth+1)
+		}
+		return h
+	case reflect.Map:
+		// Independent of iteration order
+		var sum uint64
+		iter := v.MapRange()
+		for iter.Next() {
+			sum += hashValue(hashValue(fnvOffset, iter.Key(), depth+1), iter.Value(), depth+1)
+		}
+		return hashUint(h, sum)
+	case reflect.Ptr, reflect.Interface:
+		if v.IsNil() {
+			return h
+		}
+		if v.Kind() == reflect.Ptr && typeIsQObject(v.Elem().Type()) {
+			return hashUint(h, uint64(v.Pointer()))
+		}
+		return hashValue(h, v.Elem(), depth+1)
+	case reflect.Struct:
+		if t, ok := v.Interface().(time.Time); ok {
+			return hashUint(h, uint64(t.UnixNano()))
+		}
+		t := v.Type()
+		for i := 0; i < v.NumField(); i++ {
+			if t.Field(i).PkgPath == "" {
+				h = hashValue(h, v.Field(i), depth+1)
+			}
+		}
+		return h
+	default:
+		return h
+	}
+}
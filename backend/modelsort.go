@@ -2,7 +2,11 @@ package qbackend
 
 import (
 	"fmt"
+	"reflect"
+	"regexp"
 	"sort"
+	"strings"
+	"time"
 )
 
 // SortableModel can be implemented by models to use the SortModel functions,
@@ -51,3 +55,384 @@ func SortModelInserted(model SortableModel, start, end int) {
 		panic(fmt.Sprintf("emitted moves for %d rows, insert had %d", emitCount, end-start))
 	}
 }
+
+// Sorting and filtering requested by the client
+//
+// The client can ask for a model to be sorted by the value of a role, and
+// filtered by a regular expression on the value of a role. The data source
+// isn't changed; instead, modelAPI keeps a view, which maps rows of the model
+// to rows of the data source. Changes to the data source are rebuilt into a
+// new view, and the difference between the views is sent to the client as
+// removed, moved, inserted, and updated rows. Changing the sort resets the
+// model, because most rows move.
+//
+// Rebuilding the view reads the sort and filter roles of every row, so this
+// is O(n log n) for any change while a view is active.
+
+type modelView struct {
+	sortRole   int
+	descending bool
+	filterRole int
+	filter     *regexp.Regexp
+	// rows maps each row of the model to a row of the data source
+	rows []int
+}
+
+// Moving rows one by one is worse than a reset when many rows have moved
+const maxViewMoves = 100
+
+func (v *modelView) sorted() bool {
+	return v.sortRole >= 0
+}
+
+func (v *modelView) build(data ModelDataSource) []int {
+	count := data.RowCount()
+	rows := make([]int, 0, count)
+	var keys []interface{}
+	if v.sorted() {
+		keys = make([]interface{}, count)
+	}
+
+	for i := 0; i < count; i++ {
+		row := data.Row(i)
+		if v.filter != nil && !v.matches(row) {
+			continue
+		}
+		rows = append(rows, i)
+		if keys != nil {
+			keys[i] = rowValue(row, v.sortRole)
+		}
+	}
+
+	if keys != nil {
+		// Stable, so equal rows stay in the order of the data source
+		sort.SliceStable(rows, func(a, b int) bool {
+			if v.descending {
+				return compareValues(keys[rows[a]], keys[rows[b]]) > 0
+			}
+			return compareValues(keys[rows[a]], keys[rows[b]]) < 0
+		})
+	}
+	return rows
+}
+
+// matches is true if the filter matches the filter role, or any role if the
+// filter role is -1.
+func (v *modelView) matches(row interface{}) bool {
+	if v.filterRole >= 0 {
+		return v.filter.MatchString(valueString(rowValue(row, v.filterRole)))
+	}
+
+	rv := reflect.ValueOf(row)
+	if rv.Kind() != reflect.Slice && rv.Kind() != reflect.Array {
+		return false
+	}
+	for i := 0; i < rv.Len(); i++ {
+		if v.filter.MatchString(valueString(rv.Index(i).Interface())) {
+			return true
+		}
+	}
+	return false
+}
+
+func rowValue(row interface{}, role int) interface{} {
+	rv := reflect.ValueOf(row)
+	if (rv.Kind() != reflect.Slice && rv.Kind() != reflect.Array) || role >= rv.Len() {
+		return nil
+	}
+	return rv.Index(role).Interface()
+}
+
+func valueString(value interface{}) string {
+	switch v := value.(type) {
+	case nil:
+		return ""
+	case string:
+		return v
+	default:
+		return fmt.Sprint(v)
+	}
+}
+
+// compareValues orders numbers numerically, strings and bools by value, and
+// times chronologically. nil is before everything, and other values are
+// compared by their string representation.
+func compareValues(a, b interface{}) int {
+	av, bv := reflect.ValueOf(a), reflect.ValueOf(b)
+	if !av.IsValid() || !bv.IsValid() {
+		return compareBools(av.IsValid(), bv.IsValid())
+	}
+
+	if at, ok := a.(time.Time); ok {
+		if bt, ok := b.(time.Time); ok {
+			if at.Before(bt) {
+				return -1
+			} else if at.After(bt) {
+				return 1
+			}
+			return 0
+		}
+	}
+
+	ak, bk := valueKind(av), valueKind(bv)
+	switch {
+	case ak == reflect.Int && bk == reflect.Int:
+		return compareInts(av.Int(), bv.Int())
+	case ak == reflect.Uint && bk == reflect.Uint:
+		return compareUints(av.Uint(), bv.Uint())
+	case isNumberKind(ak) && isNumberKind(bk):
+		return compareFloats(valueFloat(av), valueFloat(bv))
+	case ak == reflect.String && bk == reflect.String:
+		return strings.Compare(av.String(), bv.String())
+	case ak == reflect.Bool && bk == reflect.Bool:
+		return compareBools(av.Bool(), bv.Bool())
+	}
+	return strings.Compare(valueString(a), valueString(b))
+}
+
+// valueKind groups sized kinds into Int, Uint, and Float
+func valueKind(v reflect.Value) reflect.Kind {
+	switch v.Kind() {
+	case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64:
+		return reflect.Int
+	case reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64, reflect.Uintptr:
+		return reflect.Uint
+	case reflect.Float32, reflect.Float64:
+		return reflect.Float64
+	default:
+		return v.Kind()
+	}
+}
+
+func isNumberKind(k reflect.Kind) bool {
+	return k == reflect.Int || k == reflect.Uint || k == reflect.Float64
+}
+
+func valueFloat(v reflect.Value) float64 {
+	switch valueKind(v) {
+	case reflect.Int:
+		return float64(v.Int())
+	case reflect.Uint:
+		return float64(v.Uint())
+	default:
+		return v.Float()
+	}
+}
+
+func compareInts(a, b int64) int {
+	if a < b {
+		return -1
+	} else if a > b {
+		return 1
+	}
+	return 0
+}
+
+func compareUints(a, b uint64) int {
+	if a < b {
+		return -1
+	} else if a > b {
+		return 1
+	}
+	return 0
+}
+
+func compareFloats(a, b float64) int {
+	if a < b {
+		return -1
+	} else if a > b {
+		return 1
+	}
+	return 0
+}
+
+func compareBools(a, b bool) int {
+	if a == b {
+		return 0
+	} else if b {
+		return -1
+	}
+	return 1
+}
+
+type rowsOpKind int
+
+const (
+	rowsRemoved rowsOpKind = iota
+	rowsMoved
+	rowsInserted
+	rowsUpdated
+)
+
+// rowsOp is one change to a list of rows. For moves, count is always 1 and
+// dest has the same meaning as the destination of the modelMove signal.
+type rowsOp struct {
+	kind  rowsOpKind
+	start int
+	count int
+	dest  int
+}
+
+// diffRows returns the changes that turn the list of row ids old into new, in
+// the order they must be applied. Ids must be unique within each list and not
+// negative, except that ids in old which aren't in new may be negative and may
+// repeat. Ids index slices, so they should be dense. Rows in both lists are
+// updated if changed returns true for their id; changed may be nil.
+//
+// Rows are removed from the end, then reordered rows are moved one at a time,
+// then rows are inserted and updated from the start. Rows in the longest
+// subsequence that kept its order are not moved, as in a patience diff. If
+// more than maxMoves moves are needed, ok is false and the caller should reset
+// instead.
+func diffRows(old, new []int, changed func(int) bool, maxMoves int) (ops []rowsOp, ok bool) {
+	size := 0
+	for _, id := range new {
+		if id >= size {
+			size = id + 1
+		}
+	}
+	// Position of each id in new, and then in the order of kept rows in new
+	pos := make([]int, size)
+	for i := range pos {
+		pos[i] = -1
+	}
+	for i, id := range new {
+		pos[id] = i
+	}
+
+	kept := make([]bool, size)
+	cur := make([]int, 0, len(old))
+	for i := len(old) - 1; i >= 0; i-- {
+		if id := old[i]; id >= 0 && id < size && pos[id] >= 0 {
+			kept[id] = true
+			continue
+		}
+		if n := len(ops); n > 0 && ops[n-1].start == i+1 {
+			ops[n-1].start = i
+			ops[n-1].count++
+		} else {
+			ops = append(ops, rowsOp{kind: rowsRemoved, start: i, count: 1})
+		}
+	}
+	for _, id := range old {
+		if id >= 0 && id < size && kept[id] {
+			cur = append(cur, id)
+		}
+	}
+
+	target := make([]int, 0, len(cur))
+	for _, id := range new {
+		if kept[id] {
+			pos[id] = len(target)
+			target = append(target, id)
+		}
+	}
+
+	seq := make([]int, len(cur))
+	for i, id := range cur {
+		seq[i] = pos[id]
+	}
+	inPlace := longestIncreasing(seq)
+	stays := make([]bool, size)
+	moves := len(cur)
+	for i, id := range cur {
+		if inPlace[i] {
+			stays[id] = true
+			moves--
+		}
+	}
+	if moves > maxMoves {
+		return nil, false
+	}
+
+	// Move each row to after the row before it in the new order. Rows that
+	// are in place never move, so after the last move every row follows the
+	// one before it.
+	if moves > 0 {
+		for t, id := range target {
+			if stays[id] {
+				continue
+			}
+			from, to := indexOfInt(cur, id), 0
+			if t > 0 {
+				to = indexOfInt(cur, target[t-1]) + 1
+			}
+			if to == from {
+				continue
+			}
+			ops = append(ops, rowsOp{kind: rowsMoved, start: from, count: 1, dest: to})
+
+			cur = append(cur[:from], cur[from+1:]...)
+			if to > from {
+				to--
+			}
+			cur = append(cur, 0)
+			copy(cur[to+1:], cur[to:])
+			cur[to] = id
+		}
+	}
+
+	for i, id := range new {
+		if kept[id] {
+			continue
+		}
+		if n := len(ops); n > 0 && ops[n-1].kind == rowsInserted && ops[n-1].start+ops[n-1].count == i {
+			ops[n-1].count++
+		} else {
+			ops = append(ops, rowsOp{kind: rowsInserted, start: i, count: 1})
+		}
+	}
+
+	if changed != nil {
+		for i, id := range new {
+			if !kept[id] || !changed(id) {
+				continue
+			}
+			if n := len(ops); n > 0 && ops[n-1].kind == rowsUpdated && ops[n-1].start+ops[n-1].count == i {
+				ops[n-1].count++
+			} else {
+				ops = append(ops, rowsOp{kind: rowsUpdated, start: i, count: 1})
+			}
+		}
+	}
+
+	return ops, true
+}
+
+// longestIncreasing returns which elements of seq are in its longest strictly
+// increasing subsequence.
+func longestIncreasing(seq []int) []bool {
+	// tails[n] is the index of the smallest last element of a subsequence of length n+1
+	var tails []int
+	prev := make([]int, len(seq))
+	for i, v := range seq {
+		n := sort.Search(len(tails), func(j int) bool { return seq[tails[j]] >= v })
+		if n > 0 {
+			prev[i] = tails[n-1]
+		} else {
+			prev[i] = -1
+		}
+		if n == len(tails) {
+			tails = append(tails, i)
+		} else {
+			tails[n] = i
+		}
+	}
+
+	result := make([]bool, len(seq))
+	if len(tails) > 0 {
+		for i := tails[len(tails)-1]; i >= 0; i = prev[i] {
+			result[i] = true
+		}
+	}
+	return result
+}
+
+func indexOfInt(list []int, value int) int {
+	for i, v := range list {
+		if v == value {
+			return i
+		}
+	}
+	return -1
+}
@@ -1,7 +1,9 @@
 package qbackend
 
 import (
+	"bytes"
 	"encoding"
+	"encoding/base64"
 	"encoding/json"
 	"errors"
 	"fmt"
@@ -115,6 +117,14 @@ const (
 // with non-QObject structs as static JS objects. QObjects are mapped to the same
 // object instance.
 //
+// Some types are stored natively by the client instead of as JS values, which
+// is much cheaper for large or frequently read values. These are int64 (and
+// uint32/uint64), []byte, time.Time, and slices or arrays of strings, floats, or
+// ints of 32 bits or less. For example, a []float64 property is a packed list of
+// numbers in QML, rather than a JS array. Lists of int, uint, and other 64-bit
+// ints are JS arrays, because the client's int lists are 32-bit. Numbers are
+// encoded as JSON, so integers beyond 2^53 lose precision.
+//
 // As an implementation detail, serialization uses MarshalJSON for all types other
 // than QObjects. QObject implements MarshalJSON to return a light reference to
 // the object without any values; serialization is not recursive through QObjects.
@@ -177,6 +187,8 @@ type QObject struct {
 	refChildren map[string]int
 	// Keep object alive until refGraceTime
 	refGraceTime time.Time
+	// Position in the connection's collectQueue plus one, or 0
+	collectIndex int
 }
 
 // AnyQObject is an interface to receive any type usable as a QObject
@@ -219,7 +231,7 @@ func asQObject(obj interface{}) (*QObject, bool) {
 
 func initObject(object AnyQObject, c *Connection) (*QObject, error) {
 	u, _ := uuid.NewV4()
-	return initObjectId(object, c, u.String())
+	return initObjectId(object, c, c.shardIdentifier(u.String()))
 }
 
 // XXX split up registration and conenction a bit so reg can happen from anything?
@@ -300,6 +312,9 @@ func (q *QObject) initSignals() {
 func (o *QObject) refsChanged() {
 	if !o.ref && o.refCount < 1 {
 		o.refGraceTime = time.Now().Add(objectRefGracePeriod)
+		if o.c != nil {
+			o.c.queueCollect(o)
+		}
 	}
 }
 
@@ -334,10 +349,69 @@ func (o *QObject) Referenced() bool {
 // errors to be seen as errors by the client without manually checking
 // return values.
 func (o *QObject) invoke(methodName string, inArgs ...interface{}) ([]interface{}, error) {
-	if _, exists := o.typeInfo.Methods[methodName]; !exists {
+	dispatch, exists := o.typeInfo.dispatch[methodName]
+	if !exists {
 		return nil, errors.New("method does not exist")
 	}
 
+	// Generated code calls methods with simple arguments directly
+	if invoker := o.typeInfo.invoker; invoker != nil {
+		if re, handled, err := invoker(o.object, methodName, inArgs); handled {
+			return re, err
+		}
+	}
+
+	// The dispatch table has methods of the pointer type, which is the type of
+	// objects unless AnyQObject is implemented differently
+	dataValue := reflect.ValueOf(o.object)
+	if dataValue.Type() != dispatch.receiver {
+		return o.invokeByName(methodName, inArgs)
+	}
+
+	if len(inArgs) != len(dispatch.args) {
+		return nil, fmt.Errorf("wrong number of arguments for %s; expected %d, provided %d",
+			methodName, len(dispatch.args), len(inArgs))
+	}
+
+	// Build list of arguments, after the receiver
+	callArgs := make([]reflect.Value, len(inArgs)+1)
+	callArgs[0] = dataValue
+	for i, inArg := range inArgs {
+		callArg, err := dispatch.args[i].convert(o.c, i, methodName, inArg)
+		if err != nil {
+			return nil, err
+		}
+		callArgs[i+1] = callArg
+	}
+
+	// Call the method
+	returnValues := dispatch.fn.Call(callArgs)
+
+	var err error
+	if dispatch.returnsError {
+		last := len(returnValues) - 1
+		err, _ = returnValues[last].Interface().(error)
+		returnValues = returnValues[:last]
+	}
+	if len(returnValues) == 0 {
+		return nil, err
+	}
+
+	re := make([]interface{}, len(returnValues))
+	for i, v := range returnValues {
+		re[i] = v.Interface()
+		// The return value could contain a QObject that hasn't been initialized yet,
+		// so scan for objects on each value
+		if dispatch.scanReturns {
+			o.initObjectsUnder(v)
+		}
+	}
+	return re, err
+}
+
+// invokeByName is invoke for objects that aren't of the pointer type that
+// was parsed, which finds the method by name each time.
+func (o *QObject) invokeByName(methodName string, inArgs []interface{}) ([]interface{}, error) {
 	// Reflect to find a method named methodName on object
 	dataValue := reflect.ValueOf(o.object)
 	method := typeMethodValueByName(dataValue, methodName)
@@ -346,79 +420,20 @@ func (o *QObject) invoke(methodName string, inArgs ...interface{}) ([]interface{
 	}
 	methodType := method.Type()
 
-	// Build list of arguments
-	callArgs := make([]reflect.Value, methodType.NumIn())
-
 	if len(inArgs) != methodType.NumIn() {
 		return nil, fmt.Errorf("wrong number of arguments for %s; expected %d, provided %d",
 			methodName, methodType.NumIn(), len(inArgs))
 	}
 
-	umType := reflect.TypeOf((*encoding.TextUnmarshaler)(nil)).Elem()
+	// Build list of arguments
+	callArgs := make([]reflect.Value, methodType.NumIn())
 	for i, inArg := range inArgs {
-		argType := methodType.In(i)
-		inArgValue := reflect.ValueOf(inArg)
-		var callArg reflect.Value
-
-		// Replace references to QObjects with the objects themselves
-		if inArgValue.Kind() == reflect.Map && inArgValue.Type().Key().Kind() == reflect.String {
-			objV := inArgValue.MapIndex(reflect.ValueOf("_qbackend_"))
-			if objV.Kind() == reflect.Interface {
-				objV = objV.Elem()
-			}
-			if objV.Kind() != reflect.String || objV.String() != "object" {
-				return nil, fmt.Errorf("qobject argument %d is malformed; object tag is incorrect", i)
-			}
-			objV = inArgValue.MapIndex(reflect.ValueOf("identifier"))
-			if objV.Kind() == reflect.Interface {
-				objV = objV.Elem()
-			}
-			if objV.Kind() != reflect.String {
-				return nil, fmt.Errorf("qobject argument %d is malformed; invalid identifier %v", i, objV)
-			}
-
-			// Will be nil if the object does not exist
-			// Replace the inArgValue so the logic below can handle type matching and conversion
-			inArgValue = reflect.ValueOf(o.c.Object(objV.String()))
-		}
-
-		// Match types, converting or unmarshaling if possible
-		if inArgValue.Kind() == reflect.Invalid {
-			// Zero value, argument is nil
-			callArg = reflect.Zero(argType)
-		} else if inArgValue.Type() == argType {
-			// Types match
-			callArg = inArgValue
-		} else if inArgValue.Type().ConvertibleTo(argType) {
-			// Convert type directly
-			callArg = inArgValue.Convert(argType)
-		} else if inArgValue.Kind() == reflect.String {
-			// Attempt to unmarshal via TextUnmarshaler, directly or by pointer
-			var umArg encoding.TextUnmarshaler
-			if argType.Implements(umType) {
-				callArg = reflect.Zero(argType)
-				umArg = callArg.Interface().(encoding.TextUnmarshaler)
-			} else if argTypePtr := reflect.PtrTo(argType); argTypePtr.Implements(umType) {
-				callArg = reflect.New(argType)
-				umArg = callArg.Interface().(encoding.TextUnmarshaler)
-				callArg = callArg.Elem()
-			}
-
-			if umArg != nil {
-				err := umArg.UnmarshalText([]byte(inArg.(string)))
-				if err != nil {
-					return nil, fmt.Errorf("wrong type for argument %d to %s; expected %s, unmarshal failed: %s",
-						i, methodName, argType.String(), err)
-				}
-			}
-		}
-
-		if callArg.IsValid() {
-			callArgs[i] = callArg
-		} else {
-			return nil, fmt.Errorf("wrong type for argument %d to %s; expected %s, provided %s",
-				i, methodName, argType.String(), inArgValue.Type().String())
+		arg := newMethodArg(methodType.In(i))
+		callArg, err := arg.convert(o.c, i, methodName, inArg)
+		if err != nil {
+			return nil, err
 		}
+		callArgs[i] = callArg
 	}
 
 	// Call the method
@@ -436,13 +451,147 @@ func (o *QObject) invoke(methodName string, inArgs ...interface{}) ([]interface{
 	re := make([]interface{}, len(returnValues))
 	for i, v := range returnValues {
 		re[i] = v.Interface()
-		// The return value could contain a QObject that hasn't been initialized yet,
-		// so scan for objects on each value
 		o.initObjectsUnder(v)
 	}
 	return re, err
 }
 
+// convert returns the value of argument i for a call to methodName from
+// inArg, converting or unmarshaling it as necessary.
+func (a *methodArg) convert(c *Connection, i int, methodName string, inArg interface{}) (reflect.Value, error) {
+	argType := a.t
+
+	// Common values from JSON, without reflecting on the argument
+	switch v := inArg.(type) {
+	case nil:
+		// Zero value, argument is nil
+		return a.zero, nil
+	case float64:
+		if a.number {
+			return reflect.ValueOf(v).Convert(argType), nil
+		}
+	case string:
+		if argType == stringType {
+			return reflect.ValueOf(v), nil
+		}
+	case bool:
+		if argType == boolType {
+			return reflect.ValueOf(v), nil
+		}
+	}
+
+	inArgValue := reflect.ValueOf(inArg)
+	var callArg reflect.Value
+
+	// Replace references to QObjects with the objects themselves
+	if inArgValue.Kind() == reflect.Map && inArgValue.Type().Key().Kind() == reflect.String {
+		objV := inArgValue.MapIndex(reflect.ValueOf("_qbackend_"))
+		if objV.Kind() == reflect.Interface {
+			objV = objV.Elem()
+		}
+		if objV.Kind() != reflect.String || objV.String() != "object" {
+			return callArg, fmt.Errorf("qobject argument %d is malformed; object tag is incorrect", i)
+		}
+		objV = inArgValue.MapIndex(reflect.ValueOf("identifier"))
+		if objV.Kind() == reflect.Interface {
+			objV = objV.Elem()
+		}
+		if objV.Kind() != reflect.String {
+			return callArg, fmt.Errorf("qobject argument %d is malformed; invalid identifier %v", i, objV)
+		}
+
+		// Will be nil if the object does not exist, unless it's an object of
+		// another shard. Replace the inArgValue so the logic below can handle
+		// type matching and conversion
+		id := objV.String()
+		if obj := c.Object(id); obj != nil {
+			inArgValue = reflect.ValueOf(obj)
+		} else if ref, ok := c.foreignObject(id, inArgValue.MapIndex(reflect.ValueOf("type")), argType); ok {
+			inArgValue = reflect.ValueOf(ref)
+		} else {
+			inArgValue = reflect.Value{}
+		}
+	}
+
+	// Match types, converting or unmarshaling if possible
+	if inArgValue.Kind() == reflect.Invalid {
+		// Zero value, argument is nil
+		callArg = a.zero
+	} else if inArgValue.Type() == argType {
+		// Types match
+		callArg = inArgValue
+	} else if inArgValue.Kind() == reflect.String && a.bytes {
+		// Byte arrays are base64 encoded, as with encoding/json
+		if b, err := base64.StdEncoding.DecodeString(inArgValue.String()); err != nil {
+			return callArg, fmt.Errorf("wrong type for argument %d to %s; expected base64 bytes, decode failed: %s",
+				i, methodName, err)
+		} else {
+			callArg = reflect.ValueOf(b).Convert(argType)
+		}
+	} else if inArgValue.Type().ConvertibleTo(argType) {
+		// Convert type directly
+		callArg = inArgValue.Convert(argType)
+	} else if inArgValue.Kind() == reflect.String {
+		// Attempt to unmarshal via TextUnmarshaler, directly or by pointer
+		var umArg encoding.TextUnmarshaler
+		if a.unmarshaler {
+			callArg = reflect.Zero(argType)
+			umArg = callArg.Interface().(encoding.TextUnmarshaler)
+		} else if a.ptrUnmarshaler {
+			callArg = reflect.New(argType)
+			umArg = callArg.Interface().(encoding.TextUnmarshaler)
+			callArg = callArg.Elem()
+		}
+
+		if umArg != nil {
+			err := umArg.UnmarshalText([]byte(inArgValue.String()))
+			if err != nil {
+				return reflect.Value{}, fmt.Errorf("wrong type for argument %d to %s; expected %s, unmarshal failed: %s",
+					i, methodName, argType.String(), err)
+			}
+		}
+	} else if inArgValue.Kind() == reflect.Slice && (argType.Kind() == reflect.Slice || argType.Kind() == reflect.Array) {
+		// Lists arrive as []interface{}; convert each element, e.g. for []float64 or []string
+		callArg = convertListArg(inArgValue, argType)
+	}
+
+	if !callArg.IsValid() {
+		return callArg, fmt.Errorf("wrong type for argument %d to %s; expected %s, provided %s",
+			i, methodName, argType.String(), inArgValue.Type().String())
+	}
+	return callArg, nil
+}
+
+// convertListArg converts each element of the slice 'in' to build a slice or
+// array of type 't'. The returned value is invalid if any element can't be
+// converted.
+func convertListArg(in reflect.Value, t reflect.Type) reflect.Value {
+	var out reflect.Value
+	if t.Kind() == reflect.Array {
+		if in.Len() != t.Len() {
+			return reflect.Value{}
+		}
+		out = reflect.New(t).Elem()
+	} else {
+		out = reflect.MakeSlice(t, in.Len(), in.Len())
+	}
+
+	elemType := t.Elem()
+	for i := 0; i < in.Len(); i++ {
+		v := in.Index(i)
+		if v.Kind() == reflect.Interface {
+			v = v.Elem()
+		}
+		if !v.IsValid() {
+			continue
+		} else if !v.Type().ConvertibleTo(elemType) {
+			return reflect.Value{}
+		}
+		out.Index(i).Set(v.Convert(elemType))
+	}
+	return out
+}
+
 // Emit emits the named signal asynchronously. The signal must be
 // defined within the object and parameters must match exactly.
 func (o *QObject) Emit(signal string, args ...interface{}) {
@@ -536,9 +685,9 @@ func (o *QObject) MarshalJSON() ([]byte, error) {
 }
 
 // As noted above, MarshalJSON can't correctly capture and initialize trees containing
-// a QObject. marshalObject scans the struct to initialize QObjects, then returns a
-// map that correctly represents the properties of this object. That map can be passed
-// (in-)directly to json.Marshal. Specific differences from JSON marshal are:
+// a QObject. marshalObject scans the struct to initialize QObjects, then returns the
+// JSON object of the properties of this object. Specific differences from JSON
+// marshal are:
 //
 //   - Fields are filtered and renamed in the same manner as properties in typeinfo
 //   - Other json tag options on fields are ignored, including omitempty
@@ -549,20 +698,32 @@ func (o *QObject) MarshalJSON() ([]byte, error) {
 //     marshal appropriately
 //
 // Non-QObject fields will be marshaled normally with json.Marshal.
-func (o *QObject) marshalObject() (map[string]interface{}, error) {
-	data := make(map[string]interface{})
+func (o *QObject) marshalObject() (json.RawMessage, error) {
+	var buf bytes.Buffer
+	if err := o.encodeObject(&buf); err != nil {
+		return nil, err
+	}
+	return buf.Bytes(), nil
+}
 
+// encodeObject writes the properties for marshalObject to buf, using the
+// encoders of the type. Only fields that could contain a QObject are scanned.
+func (o *QObject) encodeObject(buf *bytes.Buffer) error {
 	// Zero out all child ref counts
 	for k, _ := range o.refChildren {
 		o.refChildren[k] = 0
 	}
 
 	value := reflect.Indirect(reflect.ValueOf(o.object))
-	for name, index := range o.typeInfo.propertyFieldIndex {
-		field := value.FieldByIndex(index)
-		if refs, err := o.initObjectsUnder(field); err != nil {
-			return nil, err
-		} else {
+	buf.WriteByte('{')
+	for i := range o.typeInfo.propertyEncoders {
+		e := &o.typeInfo.propertyEncoders[i]
+		field := e.field(value)
+		if e.scan {
+			refs, err := o.initObjectsUnder(field)
+			if err != nil {
+				return err
+			}
 			// Add references from refs
 			for _, id := range refs {
 				if _, existing := o.refChildren[id]; !existing {
@@ -570,29 +731,37 @@ func (o *QObject) marshalObject() (map[string]interface{}, error) {
 					if obj := o.c.Object(id); obj != nil {
 						impl, _ := asQObject(obj)
 						impl.refCount++
-						o.refsChanged()
+						impl.refsChanged()
 					}
 				}
 				o.refChildren[id]++
 			}
+		}
 
-			// Dereference objects that are no longer referenced here
-			for k, v := range o.refChildren {
-				if v > 0 {
-					continue
-				}
-				delete(o.refChildren, k)
-				if obj := o.c.Object(k); obj != nil {
-					impl, _ := asQObject(obj)
-					impl.refCount--
-					o.refsChanged()
-				}
-			}
+		if i > 0 {
+			buf.WriteByte(',')
+		}
+		buf.Write(e.key)
+		if err := e.encode(buf, field); err != nil {
+			return err
+		}
+	}
+	buf.WriteByte('}')
+
+	// Dereference objects that are no longer referenced here
+	for k, v := range o.refChildren {
+		if v > 0 {
+			continue
+		}
+		delete(o.refChildren, k)
+		if obj := o.c.Object(k); obj != nil {
+			impl, _ := asQObject(obj)
+			impl.refCount--
+			impl.refsChanged()
 		}
-		data[name] = field.Interface()
 	}
 
-	return data, nil
+	return nil
 }
 
 // initObjectsUnder scans a Value for references to any QObject types, and
@@ -642,13 +811,16 @@ func (o *QObject) initObjectsUnder(v reflect.Value) ([]string, error) {
 		}
 
 	case reflect.Struct:
-		if obj, ok := v.Addr().Interface().(AnyQObject); ok {
-			if q, err := initObject(obj, o.c); err == nil {
-				// Valid QObject, possibly just initialized. Stop recursion here
-				refs = append(refs, q.id)
-				return refs, nil
-			} else {
-				return nil, err
+		// Structs in interfaces aren't addressable, and can't be QObjects
+		if v.CanAddr() {
+			if obj, ok := v.Addr().Interface().(AnyQObject); ok {
+				if q, err := initObject(obj, o.c); err == nil {
+					// Valid QObject, possibly just initialized. Stop recursion here
+					refs = append(refs, q.id)
+					return refs, nil
+				} else {
+					return nil, err
+				}
 			}
 		}
 
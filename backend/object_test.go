@@ -1,11 +1,16 @@
 package qbackend
 
 import (
+	"bytes"
 	"encoding/json"
+	"errors"
 	"fmt"
 	"io"
+	"math"
 	"os"
+	"reflect"
 	"testing"
+	"time"
 )
 
 var dummyConnection *Connection
@@ -145,12 +150,12 @@ func TestMethods(t *testing.T) {
 	ti, _ := json.Marshal(q.QObject.typeInfo)
 	t.Logf("Typeinfo: %s", ti)
 
-	err := q.invoke("increment")
+	_, err := q.invoke("increment")
 	if err != nil || q.Count != 1 {
 		t.Errorf("Invoking 'Increment' failed: %v", err)
 	}
 
-	err = q.invoke("add", 4)
+	_, err = q.invoke("add", 4)
 	if err != nil || q.Count != 5 {
 		t.Errorf("Invoking 'Add' failed: %v", err)
 	}
@@ -165,7 +170,7 @@ func TestMethods(t *testing.T) {
 	strObjRef := make(map[string]string)
 	strObjRef["_qbackend_"] = "object"
 	strObjRef["identifier"] = strObj.Identifier()
-	if err := q.invoke("update", strObjRef); err != nil {
+	if _, err := q.invoke("update", strObjRef); err != nil {
 		t.Errorf("Invoking 'Update' failed: %v", err)
 	}
 	if strObj.StringData != "Count is 5" {
@@ -173,6 +178,49 @@ func TestMethods(t *testing.T) {
 	}
 }
 
+type NativeArgsQObject struct {
+	QObject
+
+	Bytes   []byte
+	Doubles []float64
+	Strings []string
+	Time    time.Time
+}
+
+func (n *NativeArgsQObject) SetValues(b []byte, d []float64, s []string, t time.Time) {
+	n.Bytes, n.Doubles, n.Strings, n.Time = b, d, s, t
+}
+
+func TestNativeArgs(t *testing.T) {
+	q := &NativeArgsQObject{}
+	if err := dummyConnection.InitObject(q); err != nil {
+		t.Errorf("QObject initialization failed: %s", err)
+	}
+
+	// Arguments as they would be decoded from the client
+	_, err := q.invoke("setValues", "aGVsbG8=", []interface{}{1.5, 2.0, 3.25}, []interface{}{"a", "b"}, "2019-04-01T12:30:00.250Z")
+	if err != nil {
+		t.Fatalf("Invoking 'SetValues' failed: %v", err)
+	}
+
+	if string(q.Bytes) != "hello" {
+		t.Errorf("Bytes argument was not decoded: %q", q.Bytes)
+	}
+	if len(q.Doubles) != 3 || q.Doubles[2] != 3.25 {
+		t.Errorf("Double list argument was not converted: %v", q.Doubles)
+	}
+	if len(q.Strings) != 2 || q.Strings[1] != "b" {
+		t.Errorf("String list argument was not converted: %v", q.Strings)
+	}
+	if !q.Time.Equal(time.Date(2019, 4, 1, 12, 30, 0, 250000000, time.UTC)) {
+		t.Errorf("Time argument was not converted: %v", q.Time)
+	}
+
+	if _, err := q.invoke("setValues", "not base64!", nil, nil, nil); err == nil {
+		t.Errorf("Invalid bytes argument did not return an error")
+	}
+}
+
 type NestedQObject struct {
 	QObject
 
@@ -240,3 +288,272 @@ func TestQObjectValue(t *testing.T) {
 	checkObject("Object", nestedObject.qObject(), 0, 0)
 	checkObject("Double1", obj.Double1.qObject(), 1, 1)
 }
+
+type EncodeTextValue int
+
+func (v EncodeTextValue) MarshalText() ([]byte, error) {
+	return []byte(fmt.Sprintf("value %d", int(v))), nil
+}
+
+type EncodeEmbedded struct {
+	Embedded string
+}
+
+type EncodeQObject struct {
+	QObject
+	*EncodeEmbedded
+
+	Bool    bool
+	Int     int
+	Int8    int8
+	Uint64  uint64
+	Float32 float32
+	Float64 float64
+	Small   float64
+	Large   float64
+	String  string
+	Escaped string
+	Text    EncodeTextValue
+	Time    time.Time
+	Bytes   []byte
+	List    []BasicStruct
+	Map     map[string]int
+	Child   *BasicQObject
+	Ignored int `json:"-"`
+	Renamed int `json:"other"`
+	Signal  func()
+}
+
+func newEncodeQObject() *EncodeQObject {
+	return &EncodeQObject{
+		EncodeEmbedded: &EncodeEmbedded{"embedded"},
+		Bool:           true,
+		Int:            -42,
+		Int8:           8,
+		Uint64:         1 << 63,
+		Float32:        3.14,
+		Float64:        2.5,
+		Small:          1e-9,
+		Large:          1e21,
+		String:         "plain text",
+		Escaped:        "<quote \" tab \t unicode é  >",
+		Text:           7,
+		Time:           time.Date(2020, 1, 2, 3, 4, 5, 0, time.UTC),
+		Bytes:          []byte("bytes"),
+		List:           []BasicStruct{{"one"}, {"two"}},
+		Map:            map[string]int{"b": 2, "a": 1},
+	}
+}
+
+// marshalObjectMap encodes the properties of an object through a map with
+// json.Marshal, as a reference for the encoders in marshalObject
+func marshalObjectMap(o *QObject) ([]byte, error) {
+	data := make(map[string]interface{})
+	value := reflect.Indirect(reflect.ValueOf(o.object))
+	for name, index := range o.typeInfo.propertyFieldIndex {
+		field := value.FieldByIndex(index)
+		if _, err := o.initObjectsUnder(field); err != nil {
+			return nil, err
+		}
+		data[name] = field.Interface()
+	}
+	return json.Marshal(data)
+}
+
+func TestMarshalObjectEncoders(t *testing.T) {
+	obj := newEncodeQObject()
+	if err := dummyConnection.InitObject(obj); err != nil {
+		t.Fatalf("QObject initialization failed: %s", err)
+	}
+
+	expected, err := marshalObjectMap(&obj.QObject)
+	if err != nil {
+		t.Fatalf("JSON marshal failed: %s", err)
+	}
+	data, err := obj.marshalObject()
+	if err != nil {
+		t.Fatalf("QObject marshal failed: %s", err)
+	}
+	if string(data) != string(expected) {
+		t.Errorf("marshaled object is different from json.Marshal:\n%s\n%s", data, expected)
+	}
+
+	obj.Float64 = math.NaN()
+	if _, err := obj.marshalObject(); err == nil {
+		t.Error("marshaling NaN did not fail")
+	}
+}
+
+func BenchmarkMarshalObject(b *testing.B) {
+	obj := newEncodeQObject()
+	obj.Child = &BasicQObject{}
+	if err := dummyConnection.InitObject(obj); err != nil {
+		b.Fatalf("QObject initialization failed: %s", err)
+	}
+
+	b.Run("Map", func(b *testing.B) {
+		b.ReportAllocs()
+		for i := 0; i < b.N; i++ {
+			if _, err := marshalObjectMap(&obj.QObject); err != nil {
+				b.Fatal(err)
+			}
+		}
+	})
+
+	b.Run("Encoders", func(b *testing.B) {
+		var buf bytes.Buffer
+		b.ReportAllocs()
+		for i := 0; i < b.N; i++ {
+			buf.Reset()
+			if err := obj.encodeObject(&buf); err != nil {
+				b.Fatal(err)
+			}
+		}
+	})
+}
+
+type InvokeQObject struct {
+	QObject
+	Total int
+}
+
+func (o *InvokeQObject) Add(a, b int) int {
+	o.Total += a + b
+	return o.Total
+}
+
+func (o *InvokeQObject) Check(name string) error {
+	if name == "" {
+		return errors.New("empty name")
+	}
+	return nil
+}
+
+func (o *InvokeQObject) Ping() {
+}
+
+func (o *InvokeQObject) Add3(a int, b float64, label string) string {
+	return label
+}
+
+func (o *InvokeQObject) Add10(a, b, c, d int, e, f float64, g, h string, i, j bool) int {
+	return a + b + c + d
+}
+
+// GeneratedQObject has the same methods as InvokeQObject, called by an
+// invoker like those from qbackendgen
+type GeneratedQObject struct {
+	InvokeQObject
+	generatedCalls int
+}
+
+func init() {
+	RegisterGeneratedInvoker(&GeneratedQObject{}, func(obj AnyQObject, method string, args []interface{}) ([]interface{}, bool, error) {
+		o := obj.(*GeneratedQObject)
+		switch method {
+		case "add":
+			if len(args) != 2 {
+				break
+			}
+			var a0 int
+			switch v := args[0].(type) {
+			case int:
+				a0 = v
+			case float64:
+				a0 = int(v)
+			case nil:
+			default:
+				return nil, false, nil
+			}
+			var a1 int
+			switch v := args[1].(type) {
+			case int:
+				a1 = v
+			case float64:
+				a1 = int(v)
+			case nil:
+			default:
+				return nil, false, nil
+			}
+			o.generatedCalls++
+			r0 := o.Add(a0, a1)
+			return []interface{}{r0}, true, nil
+		}
+		return nil, false, nil
+	})
+}
+
+func TestGeneratedInvoker(t *testing.T) {
+	obj := &GeneratedQObject{}
+	if err := dummyConnection.InitObject(obj); err != nil {
+		t.Fatalf("QObject initialization failed: %s", err)
+	}
+
+	if re, err := obj.invoke("add", 1.0, 2.0); err != nil || len(re) != 1 || re[0] != 3 {
+		t.Errorf("generated invoke returned %v, %v", re, err)
+	}
+	if obj.generatedCalls != 1 {
+		t.Errorf("generated invoker was called %d times", obj.generatedCalls)
+	}
+
+	// Methods and arguments the invoker doesn't handle use reflection
+	if _, err := obj.invoke("add", "one", 2.0); err == nil {
+		t.Error("invoke with invalid arguments did not fail")
+	}
+	if _, err := obj.invoke("check", ""); err == nil || err.Error() != "empty name" {
+		t.Errorf("reflected invoke returned error %v", err)
+	}
+	if obj.generatedCalls != 1 || obj.Total != 3 {
+		t.Errorf("generated invoker handled unknown arguments")
+	}
+}
+
+func BenchmarkInvoke(b *testing.B) {
+	for _, obj := range []AnyQObject{&InvokeQObject{}, &GeneratedQObject{}} {
+		if err := dummyConnection.InitObject(obj); err != nil {
+			b.Fatalf("QObject initialization failed: %s", err)
+		}
+		name := "Reflection"
+		if _, ok := obj.(*GeneratedQObject); ok {
+			name = "Generated"
+		}
+		q := obj.qObject()
+		b.Run(name, func(b *testing.B) {
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				if _, err := q.invoke("add", 1.0, 2.0); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
+
+// BenchmarkInvokeArgs calls methods with 0, 3, and 10 arguments, as they are
+// decoded from JSON
+func BenchmarkInvokeArgs(b *testing.B) {
+	obj := &InvokeQObject{}
+	if err := dummyConnection.InitObject(obj); err != nil {
+		b.Fatalf("QObject initialization failed: %s", err)
+	}
+
+	calls := []struct {
+		name   string
+		method string
+		args   []interface{}
+	}{
+		{"0", "ping", []interface{}{}},
+		{"3", "add3", []interface{}{1.0, 2.5, "label"}},
+		{"10", "add10", []interface{}{1.0, 2.0, 3.0, 4.0, 5.5, 6.5, "g", "h", true, false}},
+	}
+	for _, call := range calls {
+		b.Run(call.name, func(b *testing.B) {
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				if _, err := obj.invoke(call.method, call.args...); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
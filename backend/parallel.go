@@ -0,0 +1,99 @@
+package qbackend
+
+import (
+	"bytes"
+	"sync"
+	"sync/atomic"
+)
+
+// pendingMessage is an object update to encode, or an encoded message that
+// was sent after a pending update
+type pendingMessage struct {
+	obj  *QObject
+	data []byte
+}
+
+// beginBatch starts deferring object updates until endBatch, if
+// ParallelMarshal is set. Application data can't be read after endBatch, so
+// batches are only used within Process and the lock from RunLockable.
+func (c *Connection) beginBatch() {
+	if c.ParallelMarshal > 0 {
+		c.batching = true
+	}
+}
+
+func (c *Connection) queueUpdate(impl *QObject) {
+	// Updates are encoded from the current data, so one is enough
+	if _, exists := c.pendingObjects[impl]; exists {
+		return
+	}
+	c.pendingObjects[impl] = struct{}{}
+	c.pending = append(c.pending, pendingMessage{obj: impl})
+}
+
+// endBatch encodes the pending updates and writes them and the messages sent
+// after them in order. Updates of objects of independent types are encoded
+// on up to ParallelMarshal goroutines, after the others; those may initialize
+// objects and change references, so they are encoded here, in order.
+//
+// Messages sent while encoding are written immediately.
+func (c *Connection) endBatch() {
+	if !c.batching {
+		return
+	}
+	c.batching = false
+	pending := c.pending
+
+	results := make([]*bytes.Buffer, len(pending))
+	errs := make([]error, len(pending))
+	var independent []int
+	for i, p := range pending {
+		if p.obj == nil || !p.obj.Referenced() {
+			continue
+		} else if p.obj.typeInfo.independent {
+			independent = append(independent, i)
+			continue
+		}
+		results[i] = getEncodeBuffer()
+		errs[i] = c.encodeUpdate(results[i], p.obj)
+	}
+
+	workers := c.ParallelMarshal
+	if workers > len(independent) {
+		workers = len(independent)
+	}
+	var next int32
+	var wg sync.WaitGroup
+	wg.Add(workers)
+	for w := 0; w < workers; w++ {
+		go func() {
+			defer wg.Done()
+			for {
+				n := int(atomic.AddInt32(&next, 1)) - 1
+				if n >= len(independent) {
+					return
+				}
+				i := independent[n]
+				results[i] = getEncodeBuffer()
+				errs[i] = c.encodeUpdate(results[i], pending[i].obj)
+			}
+		}()
+	}
+	wg.Wait()
+
+	for i, p := range pending {
+		if p.obj == nil {
+			c.writeMessage(p.data)
+		} else if errs[i] != nil {
+			c.warn("marshal of object %s (type %s) failed: %s", p.obj.id, p.obj.typeInfo.Name, errs[i])
+		} else if results[i] != nil {
+			c.writeMessage(results[i].Bytes())
+		}
+		if results[i] != nil {
+			putEncodeBuffer(results[i])
+		}
+		delete(c.pendingObjects, p.obj)
+		pending[i] = pendingMessage{}
+	}
+	c.pending = pending[:0]
+}
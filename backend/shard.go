@@ -0,0 +1,75 @@
+package qbackend
+
+import (
+	"encoding/json"
+	"reflect"
+	"strings"
+)
+
+// ObjectRef is a reference to an object of another backend, when the client
+// multiplexes several backends as shards (see Connection.Shard). Objects from
+// the client that belong to another shard are passed to methods as ObjectRef
+// arguments, and an ObjectRef can be used in properties, signals, and return
+// values to send the reference back to the client, which resolves it to the
+// object of the other shard.
+//
+// An ObjectRef does not keep the object alive; the backend that owns it may
+// remove the object once it is no longer referenced by the client.
+type ObjectRef struct {
+	Identifier string
+	// Type is the description of the object's type, if it was provided by the
+	// client. The client only needs it if it no longer has the object.
+	Type json.RawMessage
+}
+
+var objectRefType = reflect.TypeOf(ObjectRef{})
+var emptyInterfaceType = reflect.TypeOf((*interface{})(nil)).Elem()
+
+// Shard returns the name of the shard that owns the object identifier, or an
+// empty string if it has no shard prefix.
+func (r ObjectRef) Shard() string {
+	return identifierShard(r.Identifier)
+}
+
+func (r ObjectRef) MarshalJSON() ([]byte, error) {
+	obj := struct {
+		Tag        string          `json:"_qbackend_"`
+		Identifier string          `json:"identifier"`
+		Type       json.RawMessage `json:"type,omitempty"`
+	}{"object", r.Identifier, r.Type}
+	return json.Marshal(obj)
+}
+
+func identifierShard(id string) string {
+	if i := strings.IndexByte(id, '/'); i > 0 {
+		return id[:i]
+	}
+	return ""
+}
+
+// shardIdentifier returns id with the prefix for this connection's shard
+func (c *Connection) shardIdentifier(id string) string {
+	if c.Shard == "" {
+		return id
+	}
+	return c.Shard + "/" + id
+}
+
+// foreignObject returns an ObjectRef for the object identifier of another
+// shard, which can be passed as an argument of type t.
+func (c *Connection) foreignObject(id string, objV reflect.Value, t reflect.Type) (ObjectRef, bool) {
+	if t != objectRefType && t != emptyInterfaceType {
+		return ObjectRef{}, false
+	}
+	shard := identifierShard(id)
+	if shard == "" || shard == c.Shard {
+		return ObjectRef{}, false
+	}
+	ref := ObjectRef{Identifier: id}
+	if objV.IsValid() {
+		if typ, err := json.Marshal(objV.Interface()); err == nil && string(typ) != "null" {
+			ref.Type = typ
+		}
+	}
+	return ref, true
+}
@@ -0,0 +1,95 @@
+package qbackend
+
+import (
+	"encoding/json"
+	"io"
+	"strings"
+	"testing"
+)
+
+type ShardQObject struct {
+	QObject
+
+	Local   *BasicQObject
+	Foreign ObjectRef
+	Any     interface{}
+}
+
+func (o *ShardQObject) SetLocal(obj *BasicQObject) {
+	o.Local = obj
+}
+
+func (o *ShardQObject) SetForeign(ref ObjectRef) {
+	o.Foreign = ref
+}
+
+func (o *ShardQObject) SetAny(v interface{}) {
+	o.Any = v
+}
+
+func objectArg(id string) map[string]interface{} {
+	return map[string]interface{}{"_qbackend_": "object", "identifier": id}
+}
+
+func TestShardObjects(t *testing.T) {
+	r, _ := io.Pipe()
+	_, w := io.Pipe()
+	c := NewConnectionSplit(r, w)
+	c.Shard = "worker"
+
+	q := &ShardQObject{}
+	if err := c.InitObject(q); err != nil {
+		t.Fatalf("QObject initialization failed: %s", err)
+	}
+	if !strings.HasPrefix(q.Identifier(), "worker/") {
+		t.Errorf("Identifier %q does not have the shard prefix", q.Identifier())
+	}
+	if c.Object("missing") != nil {
+		t.Error("Object of missing identifier is not nil")
+	}
+
+	local := &BasicQObject{}
+	if err := c.InitObject(local); err != nil {
+		t.Fatalf("QObject initialization failed: %s", err)
+	}
+	if _, err := q.invoke("setLocal", objectArg(local.Identifier())); err != nil || q.Local != local {
+		t.Errorf("Invoking with an object of the same shard failed: %v", err)
+	}
+
+	// Objects of other shards are references, if the argument can hold one
+	foreign := objectArg("main/1234")
+	foreign["type"] = map[string]interface{}{"name": "Other", "omitted": true}
+	if _, err := q.invoke("setForeign", foreign); err != nil {
+		t.Fatalf("Invoking with an object of another shard failed: %v", err)
+	}
+	if q.Foreign.Identifier != "main/1234" || q.Foreign.Shard() != "main" {
+		t.Errorf("Wrong reference to object of another shard: %+v", q.Foreign)
+	}
+	if _, err := q.invoke("setAny", objectArg("main/5678")); err != nil {
+		t.Fatalf("Invoking with an object of another shard failed: %v", err)
+	}
+	if ref, ok := q.Any.(ObjectRef); !ok || ref.Identifier != "main/5678" || ref.Type != nil {
+		t.Errorf("Wrong reference to object of another shard: %#v", q.Any)
+	}
+	if _, err := q.invoke("setLocal", foreign); err != nil || q.Local != nil {
+		t.Errorf("Object of another shard is not nil for a QObject argument: %v", err)
+	}
+
+	// References are sent back to the client as objects, with their type
+	data, err := q.marshalObject()
+	if err != nil {
+		t.Fatalf("Marshal failed: %s", err)
+	}
+	var props map[string]json.RawMessage
+	if err := json.Unmarshal(data, &props); err != nil {
+		t.Fatalf("Unmarshal failed: %s", err)
+	}
+	expected := `{"_qbackend_":"object","identifier":"main/1234","type":{"name":"Other","omitted":true}}`
+	if string(props["foreign"]) != expected {
+		t.Errorf("Reference marshaled as %s, expected %s", props["foreign"], expected)
+	}
+	expected = `{"_qbackend_":"object","identifier":"main/5678"}`
+	if string(props["any"]) != expected {
+		t.Errorf("Reference marshaled as %s, expected %s", props["any"], expected)
+	}
+}
@@ -0,0 +1,170 @@
+package qbackend
+
+import (
+	"reflect"
+	"strings"
+	"sync/atomic"
+	"unsafe"
+)
+
+// submission is a signal or property change from SubmitSignal or
+// SubmitChange, in a lock-free stack of submissions.
+type submission struct {
+	next   *submission
+	obj    AnyQObject
+	name   string
+	args   []interface{}
+	value  interface{}
+	change bool
+}
+
+// SubmitSignal queues the named signal of obj to be emitted by the next call
+// to Process. Unlike Emit, it is safe to call from any goroutine at any time,
+// and never waits for Process or the lock from RunLockable.
+//
+// Submitted signals and changes are applied in order. The arguments are used
+// from within Process, so they should not be changed after submitting.
+func (c *Connection) SubmitSignal(obj AnyQObject, signal string, args ...interface{}) {
+	c.submit(&submission{obj: obj, name: signal, args: args})
+}
+
+// SubmitChange queues a change of the named property of obj to value, and an
+// update of the object, to be applied by the next call to Process. Like
+// SubmitSignal, it is safe to call from any goroutine at any time.
+//
+// Changes to the same object are coalesced into one update, which is sent
+// before the next submitted signal. The value must be assignable to the type
+// of the property, or of the same kind. Numbers are converted to other number
+// types if the value is the same, and floats to either size. Other values are
+// ignored with a warning.
+func (c *Connection) SubmitChange(obj AnyQObject, property string, value interface{}) {
+	c.submit(&submission{obj: obj, name: property, value: value, change: true})
+}
+
+func (c *Connection) submit(s *submission) {
+	for {
+		head := atomic.LoadPointer(&c.submitted)
+		s.next = (*submission)(head)
+		if atomic.CompareAndSwapPointer(&c.submitted, head, unsafe.Pointer(s)) {
+			// Process drains all submissions, so it only needs to be woken
+			// for the first one
+			if head == nil {
+				c.wakeProcess()
+			}
+			return
+		}
+	}
+}
+
+// wakeProcess signals ProcessSignal without blocking. If the signal is full,
+// Process will already run again.
+func (c *Connection) wakeProcess() {
+	c.signalLock.Lock()
+	defer c.signalLock.Unlock()
+	if c.signalClosed {
+		return
+	}
+	select {
+	case c.processSignal <- struct{}{}:
+	default:
+	}
+}
+
+// applySubmissions applies everything submitted since the last call, in the
+// order it was submitted.
+func (c *Connection) applySubmissions() {
+	head := (*submission)(atomic.SwapPointer(&c.submitted, nil))
+	if head == nil {
+		return
+	}
+
+	// The stack is newest first
+	var s *submission
+	for head != nil {
+		next := head.next
+		head.next = s
+		s, head = head, next
+	}
+
+	// Objects with changes, in order, to update before the next signal
+	var changed []*QObject
+	isChanged := make(map[*QObject]bool)
+	sendChanged := func() {
+		for _, obj := range changed {
+			obj.ResetProperties()
+			delete(isChanged, obj)
+		}
+		changed = changed[:0]
+	}
+
+	for ; s != nil; s = s.next {
+		q := s.obj.qObject()
+		if !s.change {
+			sendChanged()
+			q.Emit(s.name, s.args...)
+		} else if c.setProperty(s.obj, s.name, s.value) && !isChanged[q] {
+			isChanged[q] = true
+			changed = append(changed, q)
+		}
+	}
+	sendChanged()
+}
+
+// setProperty sets the property of obj by its name for the client or of its
+// field, converting value if necessary.
+func (c *Connection) setProperty(obj AnyQObject, property string, value interface{}) bool {
+	ti, err := parseType(reflect.TypeOf(obj))
+	if err != nil {
+		c.warn("change of property %s failed: %s", property, err)
+		return false
+	}
+	index, exists := ti.propertyFieldIndex[property]
+	if !exists && len(property) > 0 {
+		index, exists = ti.propertyFieldIndex[strings.ToLower(property[:1])+property[1:]]
+	}
+	if !exists {
+		c.warn("change of unknown property %s of type %s", property, ti.Name)
+		return false
+	}
+
+	field := reflect.Indirect(reflect.ValueOf(obj)).FieldByIndex(index)
+	v := reflect.ValueOf(value)
+	switch {
+	case !v.IsValid():
+		field.Set(reflect.Zero(field.Type()))
+	case v.Type().AssignableTo(field.Type()):
+		field.Set(v)
+	case convertibleValue(v, field.Type()):
+		field.Set(v.Convert(field.Type()))
+	default:
+		c.warn("change of property %s of type %s to wrong type %s", property, ti.Name, v.Type())
+		return false
+	}
+	return true
+}
+
+// convertibleValue is true if v can be converted to t without changing what
+// it means: between types of the same kind, or between numbers if the value
+// is the same after converting.
+func convertibleValue(v reflect.Value, t reflect.Type) bool {
+	if !v.Type().ConvertibleTo(t) {
+		return false
+	}
+	if v.Kind() == t.Kind() {
+		return true
+	}
+	from, to := valueKind(v), valueKind(reflect.Zero(t))
+	if !isNumberKind(from) || !isNumberKind(to) {
+		return false
+	}
+	converted := v.Convert(t)
+	if from == reflect.Float64 && to == reflect.Float64 {
+		// Rounding to float32 is expected
+		return true
+	}
+	if from == reflect.Int && to == reflect.Uint && v.Int() < 0 ||
+		from == reflect.Uint && to == reflect.Int && converted.Int() < 0 {
+		return false
+	}
+	return converted.Convert(v.Type()).Interface() == v.Interface()
+}
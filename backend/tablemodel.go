@@ -0,0 +1,168 @@
+package qbackend
+
+// TableModel is embedded in another type instead of QObject to create a
+// two-dimensional data model, represented as a QAbstractTableModel to the
+// client.
+//
+// To be a table model, a type must embed TableModel and must implement the
+// TableDataSource interface. The client fetches rectangular tiles of cells
+// as they are viewed, so only the visible rows and columns of a wide table
+// are sent.
+//
+// When data changes, you must call TableModel's methods to notify the
+// client of the change.
+type TableModel struct {
+	QObject
+	// ModelAPI is an internal object for the table model data API
+	ModelAPI *tableModelAPI `json:"_qb_table"`
+}
+
+// Types embedding TableModel must implement TableDataSource to provide data
+type TableDataSource interface {
+	Cell(row, column int) interface{}
+	RowCount() int
+	ColumnCount() int
+}
+
+// Types embedding TableModel _may_ implement TableDataSourceColumnNames to
+// provide horizontal header data. It is read when the model is reset.
+type TableDataSourceColumnNames interface {
+	TableDataSource
+	ColumnNames() []string
+}
+
+// Updates larger than this are sent without data, and the client fetches
+// the cells it needs again
+const maxTableUpdateCells = 4096
+
+// tableModelAPI implements the internal qbackend API for table model data;
+// see QBackendTableModel from the plugin. Tiles are lists of rows, and each
+// row is a list of values by column.
+type tableModelAPI struct {
+	QObject
+	Model       *TableModel `json:"-"`
+	ColumnNames []string
+
+	// Signals
+	ModelReset         func(int, int)            `qbackend:"rows,columns"`
+	ModelInsertRows    func(int, int)            `qbackend:"start,count"`
+	ModelRemoveRows    func(int, int)            `qbackend:"start,end"`
+	ModelInsertColumns func(int, int)            `qbackend:"start,count"`
+	ModelRemoveColumns func(int, int)            `qbackend:"start,end"`
+	ModelTile          func(int, int, modelRows) `qbackend:"row,column,tile"`
+	// tile is empty if the client should fetch the changed cells again
+	ModelUpdate func(int, int, int, int, modelRows) `qbackend:"row,column,rows,columns,tile"`
+}
+
+func (m *tableModelAPI) Reset() {
+	m.Model.Reset()
+}
+
+// RequestTile is called by the client to fetch the cells in a range of rows
+// and columns.
+func (m *tableModelAPI) RequestTile(row, column, rows, columns int) {
+	m.Emit("modelTile", row, column, m.getTile(row, column, rows, columns))
+}
+
+func (m *TableModel) dataSource() TableDataSource {
+	// See Model.dataSource
+	impl, _ := asQObject(m)
+	if impl == nil {
+		return nil
+	}
+
+	if ds, ok := impl.object.(TableDataSource); ok {
+		return ds
+	} else {
+		return nil
+	}
+}
+
+func (m *TableModel) InitObject() {
+	m.ModelAPI = &tableModelAPI{Model: m}
+	if ds, ok := m.dataSource().(TableDataSourceColumnNames); ok {
+		m.ModelAPI.ColumnNames = ds.ColumnNames()
+	}
+
+	m.Connection().InitObject(m.ModelAPI)
+}
+
+// getTile returns the cells in the range, clamped to the size of the table
+func (m *tableModelAPI) getTile(row, column, rows, columns int) modelRows {
+	data := m.Model.dataSource()
+	if data == nil {
+		return modelRows{}
+	}
+
+	clamp := func(start, count, size int) (int, int) {
+		if start < 0 {
+			count += start
+			start = 0
+		}
+		if start+count > size {
+			count = size - start
+		}
+		if count < 0 {
+			count = 0
+		}
+		return start, count
+	}
+	row, rows = clamp(row, rows, data.RowCount())
+	column, columns = clamp(column, columns, data.ColumnCount())
+
+	tile := make(modelRows, rows)
+	for r := range tile {
+		cells := make([]interface{}, columns)
+		for c := range cells {
+			cells[c] = data.Cell(row+r, column+c)
+		}
+		tile[r] = cells
+	}
+	return tile
+}
+
+// Reset notifies the client that everything has changed, including the
+// number of rows and columns and the column names.
+func (m *TableModel) Reset() {
+	data := m.dataSource()
+	if data == nil {
+		return
+	}
+
+	if ds, ok := data.(TableDataSourceColumnNames); ok {
+		m.ModelAPI.ColumnNames = ds.ColumnNames()
+		m.ModelAPI.Changed("ColumnNames")
+	}
+	m.ModelAPI.Emit("modelReset", data.RowCount(), data.ColumnCount())
+}
+
+func (m *TableModel) InsertedRows(start, count int) {
+	m.ModelAPI.Emit("modelInsertRows", start, count)
+}
+
+func (m *TableModel) RemovedRows(start, count int) {
+	m.ModelAPI.Emit("modelRemoveRows", start, start+count-1)
+}
+
+func (m *TableModel) InsertedColumns(start, count int) {
+	m.ModelAPI.Emit("modelInsertColumns", start, count)
+}
+
+func (m *TableModel) RemovedColumns(start, count int) {
+	m.ModelAPI.Emit("modelRemoveColumns", start, start+count-1)
+}
+
+// Updated notifies the client that cells have changed in a range of rows and
+// columns. Small ranges are sent with their values; the client fetches cells
+// of larger ranges again if it has them.
+func (m *TableModel) Updated(row, column, rows, columns int) {
+	if rows < 1 || columns < 1 {
+		return
+	}
+
+	tile := modelRows{}
+	if rows*columns <= maxTableUpdateCells {
+		tile = m.ModelAPI.getTile(row, column, rows, columns)
+	}
+	m.ModelAPI.Emit("modelUpdate", row, column, rows, columns, tile)
+}
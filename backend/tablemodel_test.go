@@ -0,0 +1,55 @@
+package qbackend
+
+import (
+	"fmt"
+	"reflect"
+	"testing"
+)
+
+type CustomTableModel struct {
+	TableModel
+}
+
+func (m *CustomTableModel) Cell(row, column int) interface{} {
+	return fmt.Sprintf("%d,%d", row, column)
+}
+
+func (m *CustomTableModel) RowCount() int {
+	return 1000
+}
+
+func (m *CustomTableModel) ColumnCount() int {
+	return 300
+}
+
+func (m *CustomTableModel) ColumnNames() []string {
+	return []string{"first", "second"}
+}
+
+var _ TableDataSourceColumnNames = &CustomTableModel{}
+
+func TestTableModel(t *testing.T) {
+	model := &CustomTableModel{}
+	if err := dummyConnection.InitObject(model); err != nil {
+		t.Fatalf("CustomTableModel object initialization failed: %s", err)
+	}
+
+	if !reflect.DeepEqual(model.ModelAPI.ColumnNames, []string{"first", "second"}) {
+		t.Errorf("column names are %v", model.ModelAPI.ColumnNames)
+	}
+
+	tile := model.ModelAPI.getTile(998, 100, 4, 2)
+	expected := modelRows{[]interface{}{"998,100", "998,101"}, []interface{}{"999,100", "999,101"}}
+	if !reflect.DeepEqual(tile, expected) {
+		t.Errorf("tile at the last rows is %v, expected %v", tile, expected)
+	}
+
+	if tile := model.ModelAPI.getTile(-1, 299, 2, 5); len(tile) != 1 || len(tile[0].([]interface{})) != 1 {
+		t.Errorf("tile outside of the table is %v", tile)
+	}
+
+	// Not referenced by a client, so these only check that nothing panics
+	model.Updated(0, 0, 2, 2)
+	model.Updated(0, 0, 1000, 300)
+	model.Reset()
+}
@@ -0,0 +1,272 @@
+package qbackend
+
+// TreeModel is embedded in another type instead of QObject to create a
+// hierarchical data model, represented as a QAbstractItemModel with one
+// column to the client.
+//
+// To be a tree model, a type must embed TreeModel and must implement the
+// TreeDataSource interface. Rows are identified by their path, which is the
+// row index at each level from the top. The client fetches the children of a
+// row when it is expanded, and changes are only sent for rows whose parent
+// has been fetched.
+//
+// When data changes, you must call TreeModel's methods to notify the
+// client of the change.
+type TreeModel struct {
+	QObject
+	// ModelAPI is an internal object for the tree model data API
+	ModelAPI *treeModelAPI `json:"_qb_tree"`
+}
+
+// Types embedding TreeModel must implement TreeDataSource to provide data.
+//
+// Row returns the data for the row at path, and ChildCount returns the number
+// of children of the row at path, or of top level rows for an empty path.
+// ChildCount is called for each row sent to the client, to know if it can be
+// expanded; until a row is expanded, only whether the count is zero matters.
+// Paths are reused between calls and must not be retained.
+type TreeDataSource interface {
+	Row(path []int) interface{}
+	ChildCount(path []int) int
+	RoleNames() []string
+}
+
+// treeNode is a row whose children have been fetched by the client. Only
+// rows with fetched children have a node.
+type treeNode struct {
+	children map[int]*treeNode
+}
+
+func (n *treeNode) find(path []int) *treeNode {
+	for _, row := range path {
+		if n == nil {
+			break
+		}
+		n = n.children[row]
+	}
+	return n
+}
+
+// treeModelAPI implements the internal qbackend API for tree model data; see
+// QBackendTreeModel from the plugin. Parents are paths, and are empty for
+// top level rows. childCounts has the number of children for each row in
+// rowData.
+type treeModelAPI struct {
+	QObject
+	Model     *TreeModel `json:"-"`
+	RoleNames []string
+	BatchSize int
+
+	// Signals
+	ModelReset    func(modelRows, modelIndexes, int)                    `qbackend:"rowData,childCounts,moreRows"`
+	ModelChildren func(modelIndexes, modelRows, modelIndexes, int)      `qbackend:"parent,rowData,childCounts,moreRows"`
+	ModelInsert   func(modelIndexes, int, modelRows, modelIndexes, int) `qbackend:"parent,start,rowData,childCounts,moreRows"`
+	ModelRemove   func(modelIndexes, int, int)                          `qbackend:"parent,start,end"`
+	ModelMove     func(modelIndexes, int, int, int)                     `qbackend:"parent,start,end,destination"`
+	ModelUpdate   func(modelIndexes, int, modelRows, modelIndexes)      `qbackend:"parent,start,rowData,childCounts"`
+	ModelRowData  func(modelIndexes, int, modelRows, modelIndexes)      `qbackend:"parent,start,rowData,childCounts"`
+
+	root *treeNode
+}
+
+func (m *treeModelAPI) Reset() {
+	m.Model.Reset()
+}
+
+func (m *treeModelAPI) SetBatchSize(size int) {
+	if size < 0 {
+		size = 0
+	}
+	m.BatchSize = size
+	m.Changed("BatchSize")
+}
+
+// FetchChildren is called by the client when a row is expanded. The first
+// batch of children is sent, and the rest are requested as needed.
+func (m *treeModelAPI) FetchChildren(parent modelIndexes) {
+	if len(parent) == 0 {
+		m.Model.Reset()
+		return
+	}
+	node := m.root.find(parent[:len(parent)-1])
+	if node == nil {
+		// The row's parent isn't fetched, so the client can't see it
+		return
+	}
+
+	row := parent[len(parent)-1]
+	if node.children[row] == nil {
+		node.children[row] = &treeNode{children: make(map[int]*treeNode)}
+	}
+	rows, childCounts, moreRows := m.getRows(parent, 0, -1, m.BatchSize)
+	m.Emit("modelChildren", parent, rows, childCounts, moreRows)
+}
+
+func (m *treeModelAPI) RequestRows(parent modelIndexes, start, count int) {
+	if m.root.find(parent) == nil {
+		return
+	}
+	// BatchSize does not apply to RequestRows; the client asked for it
+	rows, childCounts, _ := m.getRows(parent, start, count, 0)
+	m.Emit("modelRowData", nonNilPath(parent), start, rows, childCounts)
+}
+
+func nonNilPath(path []int) []int {
+	if path == nil {
+		return []int{}
+	}
+	return path
+}
+
+func (m *TreeModel) dataSource() TreeDataSource {
+	// See Model.dataSource
+	impl, _ := asQObject(m)
+	if impl == nil {
+		return nil
+	}
+
+	if ds, ok := impl.object.(TreeDataSource); ok {
+		return ds
+	} else {
+		return nil
+	}
+}
+
+func (m *TreeModel) InitObject() {
+	data := m.dataSource()
+
+	m.ModelAPI = &treeModelAPI{
+		Model:     m,
+		RoleNames: data.RoleNames(),
+		root:      &treeNode{children: make(map[int]*treeNode)},
+	}
+
+	m.Connection().InitObject(m.ModelAPI)
+}
+
+func (m *treeModelAPI) getRows(parent []int, start, count, batchSize int) (modelRows, []int, int) {
+	data := m.Model.dataSource()
+	if data == nil {
+		return modelRows{}, []int{}, 0
+	}
+
+	rowCount, moreRows := data.ChildCount(parent), 0
+	if start < 0 {
+		start = 0
+	} else if count < 0 {
+		count = rowCount - start
+	}
+	if start+count > rowCount {
+		if start >= rowCount {
+			start = rowCount
+		}
+		count = rowCount - start
+		if count < 0 {
+			count = 0
+		}
+	}
+
+	if batchSize > 0 && count > batchSize {
+		moreRows = count - batchSize
+		count = batchSize
+	}
+
+	rows := make(modelRows, count)
+	childCounts := make([]int, count)
+	path := append(append(make([]int, 0, len(parent)+1), parent...), 0)
+	for i := 0; i < count; i++ {
+		path[len(parent)] = start + i
+		rows[i] = data.Row(path)
+		childCounts[i] = data.ChildCount(path)
+	}
+	return rows, childCounts, moreRows
+}
+
+// Reset replaces all rows, and collapses all rows on the client.
+func (m *TreeModel) Reset() {
+	m.ModelAPI.root = &treeNode{children: make(map[int]*treeNode)}
+	rows, childCounts, moreRows := m.ModelAPI.getRows(nil, 0, -1, m.ModelAPI.BatchSize)
+	m.ModelAPI.Emit("modelReset", rows, childCounts, moreRows)
+}
+
+// Inserted notifies the client that count rows were inserted at start in the
+// children of parent.
+func (m *TreeModel) Inserted(parent []int, start, count int) {
+	node := m.ModelAPI.root.find(parent)
+	if node == nil {
+		m.childCountChanged(parent)
+		return
+	}
+
+	children := make(map[int]*treeNode, len(node.children))
+	for row, child := range node.children {
+		if row >= start {
+			row += count
+		}
+		children[row] = child
+	}
+	node.children = children
+
+	rows, childCounts, moreRows := m.ModelAPI.getRows(parent, start, count, m.ModelAPI.BatchSize)
+	m.ModelAPI.Emit("modelInsert", nonNilPath(parent), start, rows, childCounts, moreRows)
+}
+
+// Removed notifies the client that count rows were removed from start in the
+// children of parent.
+func (m *TreeModel) Removed(parent []int, start, count int) {
+	node := m.ModelAPI.root.find(parent)
+	if node == nil {
+		m.childCountChanged(parent)
+		return
+	}
+
+	children := make(map[int]*treeNode, len(node.children))
+	for row, child := range node.children {
+		if row >= start+count {
+			children[row-count] = child
+		} else if row < start {
+			children[row] = child
+		}
+	}
+	node.children = children
+
+	m.ModelAPI.Emit("modelRemove", nonNilPath(parent), start, start+count-1)
+}
+
+// Moved notifies the client that count rows from start in the children of
+// parent were moved to before destination, as in Model.Moved. Rows can only
+// move within the same parent; otherwise, they are removed and inserted.
+func (m *TreeModel) Moved(parent []int, start, count, destination int) {
+	node := m.ModelAPI.root.find(parent)
+	if node == nil {
+		return
+	}
+
+	children := make(map[int]*treeNode, len(node.children))
+	for row, child := range node.children {
+		children[movedRow(row, start, count, destination)] = child
+	}
+	node.children = children
+
+	m.ModelAPI.Emit("modelMove", nonNilPath(parent), start, start+count-1, destination)
+}
+
+// Updated notifies the client that the row at path has changed.
+func (m *TreeModel) Updated(path []int) {
+	if len(path) == 0 {
+		return
+	}
+	parent := path[:len(path)-1]
+	if m.ModelAPI.root.find(parent) == nil {
+		return
+	}
+
+	rows, childCounts, _ := m.ModelAPI.getRows(parent, path[len(path)-1], 1, 0)
+	m.ModelAPI.Emit("modelUpdate", nonNilPath(parent), path[len(path)-1], rows, childCounts)
+}
+
+// The children of a row that isn't expanded have changed, which changes
+// whether it can be expanded
+func (m *TreeModel) childCountChanged(path []int) {
+	m.Updated(path)
+}
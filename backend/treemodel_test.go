@@ -0,0 +1,90 @@
+package qbackend
+
+import (
+	"fmt"
+	"reflect"
+	"testing"
+)
+
+// CustomTreeModel has three levels of rows, with as many children as the
+// sum of their path
+type CustomTreeModel struct {
+	TreeModel
+}
+
+func (m *CustomTreeModel) Row(path []int) interface{} {
+	return []interface{}{fmt.Sprint(path)}
+}
+
+func (m *CustomTreeModel) ChildCount(path []int) int {
+	if len(path) == 0 {
+		return 3
+	} else if len(path) > 2 {
+		return 0
+	}
+	sum := 0
+	for _, row := range path {
+		sum += row
+	}
+	return sum
+}
+
+func (m *CustomTreeModel) RoleNames() []string {
+	return []string{"path"}
+}
+
+var _ TreeDataSource = &CustomTreeModel{}
+
+func TestTreeModel(t *testing.T) {
+	model := &CustomTreeModel{}
+	if err := dummyConnection.InitObject(model); err != nil {
+		t.Fatalf("CustomTreeModel object initialization failed: %s", err)
+	}
+	api := model.ModelAPI
+
+	ti, err := parseType(reflect.TypeOf(model))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if ti.Properties["_qb_tree"] != "object" {
+		t.Errorf("tree model type has _qb_tree of type %q", ti.Properties["_qb_tree"])
+	}
+
+	rows, childCounts, moreRows := api.getRows([]int{2}, 0, -1, 1)
+	if !reflect.DeepEqual(rows, modelRows{[]interface{}{"[2 0]"}}) || !reflect.DeepEqual(childCounts, []int{2}) || moreRows != 1 {
+		t.Errorf("getRows([2]) returned %v, %v, %d", rows, childCounts, moreRows)
+	}
+
+	model.Reset()
+	api.FetchChildren([]int{1, 1})
+	if api.root.find([]int{1, 1}) != nil {
+		t.Error("fetched children of a row whose parent isn't fetched")
+	}
+	api.FetchChildren([]int{1})
+	api.FetchChildren([]int{2})
+	api.FetchChildren([]int{1, 0})
+	if api.root.find([]int{1, 0}) == nil || api.root.find([]int{2}) == nil {
+		t.Fatal("fetched rows have no node")
+	}
+
+	model.Inserted(nil, 0, 1)
+	if api.root.find([]int{2, 0}) == nil || api.root.find([]int{3}) == nil || api.root.find([]int{1}) != nil {
+		t.Error("fetched rows did not move with an insert before them")
+	}
+	model.Moved(nil, 3, 1, 0)
+	if api.root.find([]int{0}) == nil || api.root.find([]int{3, 0}) == nil {
+		t.Error("fetched rows did not move with a move")
+	}
+	model.Removed(nil, 2, 2)
+	if api.root.find([]int{3}) != nil || api.root.find([]int{0}) == nil || len(api.root.children) != 1 {
+		t.Error("fetched rows were not removed")
+	}
+
+	// Rows that aren't fetched only update their parent
+	model.Inserted([]int{1, 2}, 0, 1)
+	model.Updated([]int{0, 1})
+	model.Reset()
+	if len(api.root.children) != 0 {
+		t.Error("reset did not collapse rows")
+	}
+}
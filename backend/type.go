@@ -1,10 +1,12 @@
 package qbackend
 
 import (
+	"encoding"
 	"encoding/json"
 	"fmt"
 	"reflect"
 	"strings"
+	"time"
 )
 
 // I cannot find any better way to filter the methods of the QObject interface
@@ -30,6 +32,15 @@ type typeInfo struct {
 	Signals    map[string][]string   `json:"signals"`
 
 	propertyFieldIndex map[string][]int
+	// propertyEncoders encode the properties for marshalObject
+	propertyEncoders []propertyEncoder
+	// independent is true if no property could contain a QObject, so
+	// encoding only reads the fields of the object
+	independent bool
+	// invoker is generated code to call methods, if any
+	invoker GeneratedInvoker
+	// dispatch has the methods to call for invoke, by name
+	dispatch map[string]*methodDispatch
 }
 
 type typeMethod struct {
@@ -39,9 +50,81 @@ type typeMethod struct {
 	Return []string `json:"return"`
 }
 
+// methodDispatch is a method of the pointer type, and what invoke needs to
+// call it, found once by parseType.
+type methodDispatch struct {
+	receiver reflect.Type
+	fn       reflect.Value
+	args     []methodArg
+	// returnsError is true if the last return value is an error
+	returnsError bool
+	// scanReturns is true if return values could contain a QObject
+	scanReturns bool
+}
+
+// methodArg is the type of an argument, and how values can be converted to it
+type methodArg struct {
+	t    reflect.Type
+	zero reflect.Value
+	// number is true for numeric types, which JSON numbers convert to
+	number         bool
+	bytes          bool
+	unmarshaler    bool
+	ptrUnmarshaler bool
+}
+
+func newMethodDispatch(receiver reflect.Type, method reflect.Method) *methodDispatch {
+	methodType := method.Type
+	d := &methodDispatch{
+		receiver: receiver,
+		fn:       method.Func,
+		args:     make([]methodArg, methodType.NumIn()-1),
+	}
+	for p := 1; p < methodType.NumIn(); p++ {
+		d.args[p-1] = newMethodArg(methodType.In(p))
+	}
+	for p := 0; p < methodType.NumOut(); p++ {
+		outType := methodType.Out(p)
+		if p == methodType.NumOut()-1 && outType == errorType {
+			d.returnsError = true
+		} else if typeCouldContainQObject(outType) {
+			d.scanReturns = true
+		}
+	}
+	return d
+}
+
+func newMethodArg(t reflect.Type) methodArg {
+	a := methodArg{
+		t:     t,
+		zero:  reflect.Zero(t),
+		bytes: typeInfoTypeName(t) == "bytes",
+	}
+	switch t.Kind() {
+	case reflect.Int, reflect.Int8, reflect.Int16, reflect.Int32, reflect.Int64,
+		reflect.Uint, reflect.Uint8, reflect.Uint16, reflect.Uint32, reflect.Uint64, reflect.Uintptr,
+		reflect.Float32, reflect.Float64:
+		a.number = true
+	}
+	if t.Implements(textUnmarshalerType) {
+		a.unmarshaler = true
+	} else if reflect.PtrTo(t).Implements(textUnmarshalerType) {
+		a.ptrUnmarshaler = true
+	}
+	return a
+}
+
 var knownTypeInfo = make(map[reflect.Type]*typeInfo)
 var qobjInterfaceType = reflect.TypeOf((*AnyQObject)(nil)).Elem()
 var errorType = reflect.TypeOf((*error)(nil)).Elem()
+var timeType = reflect.TypeOf(time.Time{})
+var jsonMarshalerType = reflect.TypeOf((*json.Marshaler)(nil)).Elem()
+var textMarshalerType = reflect.TypeOf((*encoding.TextMarshaler)(nil)).Elem()
+var textUnmarshalerType = reflect.TypeOf((*encoding.TextUnmarshaler)(nil)).Elem()
+var stringType = reflect.TypeOf("")
+var boolType = reflect.TypeOf(false)
+var modelRowsType = reflect.TypeOf(modelRows(nil))
+var modelIndexesType = reflect.TypeOf(modelIndexes(nil))
 
 func typeIsQObject(t reflect.Type) bool {
 	return reflect.PtrTo(t).Implements(qobjInterfaceType)
@@ -116,6 +199,23 @@ func typeFieldChangedName(fieldName string) string {
 	return fieldName + "Changed"
 }
 
+// typeHasCustomMarshal is true for types that don't use the default JSON
+// encoding for their kind, and so can't be mapped to a native client type.
+func typeHasCustomMarshal(t reflect.Type) bool {
+	pt := reflect.PtrTo(t)
+	return pt.Implements(jsonMarshalerType) || pt.Implements(textMarshalerType)
+}
+
+// typeIsInt32 is true for int types that always fit in 32 bits
+func typeIsInt32(t reflect.Type) bool {
+	switch t.Kind() {
+	case reflect.Int8, reflect.Int16, reflect.Int32, reflect.Uint8, reflect.Uint16:
+		return true
+	default:
+		return false
+	}
+}
+
 func typeInfoTypeName(t reflect.Type) string {
 	switch t.Kind() {
 	case reflect.Ptr:
@@ -132,18 +232,19 @@ func typeInfoTypeName(t reflect.Type) string {
 		fallthrough
 	case reflect.Int32:
 		fallthrough
-	case reflect.Int64:
-		fallthrough
 	case reflect.Uint:
 		fallthrough
 	case reflect.Uint8:
 		fallthrough
 	case reflect.Uint16:
+		return "int"
+
+	case reflect.Int64:
 		fallthrough
 	case reflect.Uint32:
 		fallthrough
 	case reflect.Uint64:
-		return "int"
+		return "int64"
 
 	case reflect.Float32:
 		fallthrough
@@ -151,19 +252,47 @@ func typeInfoTypeName(t reflect.Type) string {
 		return "double"
 
 	case reflect.String:
-		// TODO also []byte?
 		return "string"
 
-	case reflect.Array:
-		fallthrough
 	case reflect.Slice:
-		return "array"
+		if t == modelRowsType {
+			return "rows"
+		} else if t == modelIndexesType {
+			return "intList"
+		}
+		// []byte is encoded as a base64 string by encoding/json
+		if t.Elem().Kind() == reflect.Uint8 && !typeHasCustomMarshal(t) {
+			return "bytes"
+		}
+		fallthrough
+	case reflect.Array:
+		if typeHasCustomMarshal(t) || typeHasCustomMarshal(t.Elem()) {
+			return "array"
+		}
+		// Lists of scalars are stored in packed native lists by the client
+		switch typeInfoTypeName(t.Elem()) {
+		case "string":
+			return "stringList"
+		case "int":
+			// Go int and uint are 64 bits, and a client int would lose
+			// larger values; those lists are arrays of JS numbers
+			if typeIsInt32(t.Elem()) {
+				return "intList"
+			}
+			return "array"
+		case "double":
+			return "doubleList"
+		default:
+			return "array"
+		}
 
 	case reflect.Map:
 		return "map"
 
 	case reflect.Struct:
-		if typeIsQObject(t) {
+		if t == timeType {
+			return "time"
+		} else if typeIsQObject(t) {
 			return "object"
 		} else {
 			return "map"
@@ -191,6 +320,7 @@ func parseType(t reflect.Type) (*typeInfo, error) {
 		Methods:            make(map[string]typeMethod),
 		Signals:            make(map[string][]string),
 		propertyFieldIndex: make(map[string][]int),
+		dispatch:           make(map[string]*methodDispatch),
 	}
 	typeInfo.Name = t.Name()
 
@@ -200,6 +330,15 @@ func parseType(t reflect.Type) (*typeInfo, error) {
 		return nil, err
 	}
 
+	typeInfo.propertyEncoders = buildPropertyEncoders(t, typeInfo)
+	typeInfo.independent = true
+	for _, e := range typeInfo.propertyEncoders {
+		if e.scan {
+			typeInfo.independent = false
+		}
+	}
+	typeInfo.invoker = generatedInvokers[t]
+
 	// Create change signals for all properties, adopting explicit ones if they exist
 	for name, _ := range typeInfo.Properties {
 		signalName := typeFieldChangedName(name)
@@ -239,6 +378,7 @@ func parseType(t reflect.Type) (*typeInfo, error) {
 		}
 
 		typeInfo.Methods[name] = tm
+		typeInfo.dispatch[name] = newMethodDispatch(ptrType, method)
 	}
 
 	knownTypeInfo[t] = typeInfo
@@ -3,6 +3,7 @@ package qbackend
 import (
 	"reflect"
 	"testing"
+	"time"
 )
 
 type Simple struct {
@@ -73,8 +74,9 @@ func TestParseTypes(t *testing.T) {
 		if len(m.Args) != 2 {
 			t.Errorf("Method expected %d args but has %d: %v", 2, len(m.Args), m.Args)
 		}
-		if len(m.Return) != 2 {
-			t.Errorf("Method expected %d return values but has %d: %v", 2, len(m.Return), m.Return)
+		// The trailing error is omitted; invoke returns it separately
+		if len(m.Return) != 1 {
+			t.Errorf("Method expected %d return values but has %d: %v", 1, len(m.Return), m.Return)
 		}
 	} else {
 		t.Errorf("Missing method 'realMethod'")
@@ -89,3 +91,51 @@ func TestParseTypes(t *testing.T) {
 		t.Errorf("Expected %d signals but type info has %d", len(expectSignal), len(info.Signals))
 	}
 }
+
+type NativeTypes struct {
+	QObject
+
+	Int      int
+	Int64    int64
+	Uint64   uint64
+	Bytes    []byte
+	Time     time.Time
+	TimePtr  *time.Time
+	Strings  []string
+	Ints     []int
+	Int32s   []int32
+	Floats   []float32
+	Doubles  [4]float64
+	Int64s   []int64
+	Objects  []*NativeTypes
+	Duration time.Duration
+}
+
+func TestParseTypeNames(t *testing.T) {
+	info, err := parseType(reflect.TypeOf(NativeTypes{}))
+	if err != nil {
+		t.Fatalf("parseType failed: %v", err)
+	}
+
+	expect := map[string]string{
+		"int":      "int",
+		"int64":    "int64",
+		"uint64":   "int64",
+		"bytes":    "bytes",
+		"time":     "time",
+		"timePtr":  "time",
+		"strings":  "stringList",
+		"ints":     "array",
+		"int32s":   "intList",
+		"floats":   "doubleList",
+		"doubles":  "doubleList",
+		"int64s":   "array",
+		"objects":  "array",
+		"duration": "int64",
+	}
+	for name, typeName := range expect {
+		if info.Properties[name] != typeName {
+			t.Errorf("Expected property '%s' to have type '%s', got '%s'", name, typeName, info.Properties[name])
+		}
+	}
+}
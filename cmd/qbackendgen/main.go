@@ -0,0 +1,319 @@
+// qbackendgen generates code to invoke methods of QObject types without
+// reflection. It is meant to be run by go generate, from a directive in the
+// package that has the types:
+//
+//	//go:generate go run github.com/CrimsonAS/qbackend/cmd/qbackendgen
+//
+// Types are marked for generation with a "qbackend:generate" line in their
+// comment:
+//
+//	// Person is ...
+//	//
+//	// qbackend:generate
+//	type Person struct {
+//	    qbackend.QObject
+//	    ...
+//	}
+//
+// For each marked type, a function is generated to call its methods that have
+// arguments and return values of basic types (bools, numbers, and strings),
+// optionally returning an error last. It's registered with
+// qbackend.RegisterGeneratedInvoker. Other methods are called with reflection
+// as usual.
+//
+// The code is written to qbackend_gen.go in the package directory, or to the
+// file given by -output.
+package main
+
+import (
+	"bytes"
+	"flag"
+	"fmt"
+	"go/ast"
+	"go/format"
+	"go/parser"
+	"go/token"
+	"io/ioutil"
+	"log"
+	"os"
+	"path/filepath"
+	"sort"
+	"strings"
+)
+
+const generateMarker = "qbackend:generate"
+
+// Methods of QObject, which are never invoked; see methodBlacklist in the
+// qbackend package
+var ignoredMethods = map[string]bool{
+	"MarshalJSON":     true,
+	"Connection":      true,
+	"Identifier":      true,
+	"Referenced":      true,
+	"Emit":            true,
+	"ResetProperties": true,
+	"Changed":         true,
+	"InitObject":      true,
+}
+
+var numberTypes = map[string]bool{
+	"int": true, "int8": true, "int16": true, "int32": true, "int64": true,
+	"uint": true, "uint8": true, "uint16": true, "uint32": true, "uint64": true, "uintptr": true,
+	"float32": true, "float64": true, "byte": true, "rune": true,
+}
+
+func isBasicType(name string) bool {
+	return name == "bool" || name == "string" || numberTypes[name]
+}
+
+type method struct {
+	Name    string
+	Args    []string
+	Returns []string
+	// HasError is true if the method also returns an error, which isn't in Returns
+	HasError bool
+}
+
+type objectType struct {
+	Name    string
+	Methods []method
+}
+
+func main() {
+	log.SetFlags(0)
+	log.SetPrefix("qbackendgen: ")
+	output := flag.String("output", "qbackend_gen.go", "output file name, in the package directory")
+	flag.Usage = func() {
+		fmt.Fprintf(os.Stderr, "usage: qbackendgen [-output file] [directory]\n")
+		flag.PrintDefaults()
+	}
+	flag.Parse()
+
+	dir := "."
+	if flag.NArg() > 1 {
+		flag.Usage()
+		os.Exit(2)
+	} else if flag.NArg() == 1 {
+		dir = flag.Arg(0)
+	}
+	outputPath := filepath.Join(dir, *output)
+
+	fset := token.NewFileSet()
+	pkgs, err := parser.ParseDir(fset, dir, func(info os.FileInfo) bool {
+		return !strings.HasSuffix(info.Name(), "_test.go") && info.Name() != filepath.Base(outputPath)
+	}, parser.ParseComments)
+	if err != nil {
+		log.Fatal(err)
+	}
+	if len(pkgs) != 1 {
+		log.Fatalf("expected one package in %s, found %d", dir, len(pkgs))
+	}
+
+	for name, pkg := range pkgs {
+		var files []*ast.File
+		for _, file := range pkg.Files {
+			files = append(files, file)
+		}
+		src, err := generate(name, files)
+		if err != nil {
+			log.Fatal(err)
+		}
+		if err := ioutil.WriteFile(outputPath, src, 0644); err != nil {
+			log.Fatal(err)
+		}
+	}
+}
+
+// generate returns the source for the marked types in files of package pkg
+func generate(pkg string, files []*ast.File) ([]byte, error) {
+	types := findTypes(files)
+	if len(types) == 0 {
+		return nil, fmt.Errorf("no types in package %s are marked with %q", pkg, generateMarker)
+	}
+
+	var buf bytes.Buffer
+	fmt.Fprintf(&buf, "// Code generated by qbackendgen. DO NOT EDIT.\n\n")
+	fmt.Fprintf(&buf, "package %s\n\n", pkg)
+	fmt.Fprintf(&buf, "import qbackend \"github.com/CrimsonAS/qbackend/backend\"\n\n")
+	fmt.Fprintf(&buf, "func init() {\n")
+	for _, t := range types {
+		writeInvoker(&buf, t)
+	}
+	fmt.Fprintf(&buf, "}\n")
+
+	src, err := format.Source(buf.Bytes())
+	if err != nil {
+		return nil, fmt.Errorf("formatting generated code failed: %s", err)
+	}
+	return src, nil
+}
+
+// findTypes returns the marked types and their methods, sorted by name
+func findTypes(files []*ast.File) []*objectType {
+	types := make(map[string]*objectType)
+	for _, file := range files {
+		for _, decl := range file.Decls {
+			gen, ok := decl.(*ast.GenDecl)
+			if !ok || gen.Tok != token.TYPE {
+				continue
+			}
+			for _, spec := range gen.Specs {
+				ts := spec.(*ast.TypeSpec)
+				if _, isStruct := ts.Type.(*ast.StructType); !isStruct {
+					continue
+				}
+				if hasMarker(ts.Doc) || (len(gen.Specs) == 1 && hasMarker(gen.Doc)) {
+					types[ts.Name.Name] = &objectType{Name: ts.Name.Name}
+				}
+			}
+		}
+	}
+
+	for _, file := range files {
+		for _, decl := range file.Decls {
+			fn, ok := decl.(*ast.FuncDecl)
+			if !ok || fn.Recv == nil || len(fn.Recv.List) != 1 {
+				continue
+			}
+			recv := fn.Recv.List[0].Type
+			if star, ok := recv.(*ast.StarExpr); ok {
+				recv = star.X
+			}
+			ident, ok := recv.(*ast.Ident)
+			if !ok || types[ident.Name] == nil {
+				continue
+			}
+			if m, ok := parseMethod(fn); ok {
+				t := types[ident.Name]
+				t.Methods = append(t.Methods, m)
+			}
+		}
+	}
+
+	var sorted []*objectType
+	for _, t := range types {
+		sort.Slice(t.Methods, func(i, j int) bool { return t.Methods[i].Name < t.Methods[j].Name })
+		sorted = append(sorted, t)
+	}
+	sort.Slice(sorted, func(i, j int) bool { return sorted[i].Name < sorted[j].Name })
+	return sorted
+}
+
+func hasMarker(doc *ast.CommentGroup) bool {
+	if doc == nil {
+		return false
+	}
+	for _, line := range strings.Split(doc.Text(), "\n") {
+		if strings.TrimSpace(line) == generateMarker {
+			return true
+		}
+	}
+	return false
+}
+
+// parseMethod returns the method if it can be invoked by generated code
+func parseMethod(fn *ast.FuncDecl) (method, bool) {
+	m := method{Name: fn.Name.Name}
+	if !fn.Name.IsExported() || ignoredMethods[m.Name] {
+		return m, false
+	}
+
+	var ok bool
+	if m.Args, ok = fieldTypes(fn.Type.Params); !ok {
+		return m, false
+	}
+	results := fn.Type.Results
+	if results != nil && len(results.List) > 0 {
+		last := results.List[len(results.List)-1]
+		if ident, isIdent := last.Type.(*ast.Ident); isIdent && ident.Name == "error" && len(last.Names) < 2 {
+			m.HasError = true
+			results = &ast.FieldList{List: results.List[:len(results.List)-1]}
+		}
+	}
+	if m.Returns, ok = fieldTypes(results); !ok {
+		return m, false
+	}
+	return m, true
+}
+
+// fieldTypes returns the type of each field, if they are all basic types
+func fieldTypes(fields *ast.FieldList) ([]string, bool) {
+	if fields == nil {
+		return nil, true
+	}
+	var types []string
+	for _, field := range fields.List {
+		ident, ok := field.Type.(*ast.Ident)
+		if !ok || !isBasicType(ident.Name) {
+			return nil, false
+		}
+		count := len(field.Names)
+		if count == 0 {
+			count = 1
+		}
+		for i := 0; i < count; i++ {
+			types = append(types, ident.Name)
+		}
+	}
+	return types, true
+}
+
+// methodName is the name of the method for the client, as in typeMethodName
+func methodName(name string) string {
+	return strings.ToLower(name[:1]) + name[1:]
+}
+
+// writeInvoker writes the registration of the invoker for t. Arguments are
+// converted the same way as by reflection for the values that come from JSON;
+// anything else returns handled as false, for reflection to deal with.
+func writeInvoker(buf *bytes.Buffer, t *objectType) {
+	fmt.Fprintf(buf, "qbackend.RegisterGeneratedInvoker(&%s{}, func(obj qbackend.AnyQObject, method string, args []interface{}) ([]interface{}, bool, error) {\n", t.Name)
+	if len(t.Methods) == 0 {
+		fmt.Fprintf(buf, "return nil, false, nil\n})\n")
+		return
+	}
+	fmt.Fprintf(buf, "o := obj.(*%s)\n", t.Name)
+	fmt.Fprintf(buf, "switch method {\n")
+	for _, m := range t.Methods {
+		fmt.Fprintf(buf, "case %q:\n", methodName(m.Name))
+		fmt.Fprintf(buf, "if len(args) != %d {\nbreak\n}\n", len(m.Args))
+
+		var args []string
+		for i, argType := range m.Args {
+			arg := fmt.Sprintf("a%d", i)
+			args = append(args, arg)
+			fmt.Fprintf(buf, "var %s %s\n", arg, argType)
+			fmt.Fprintf(buf, "switch v := args[%d].(type) {\n", i)
+			fmt.Fprintf(buf, "case %s:\n%s = v\n", argType, arg)
+			if numberTypes[argType] && argType != "float64" {
+				fmt.Fprintf(buf, "case float64:\n%s = %s(v)\n", arg, argType)
+			}
+			fmt.Fprintf(buf, "case nil:\n")
+			fmt.Fprintf(buf, "default:\nreturn nil, false, nil\n}\n")
+		}
+
+		var results []string
+		for i := range m.Returns {
+			results = append(results, fmt.Sprintf("r%d", i))
+		}
+		errResult := "nil"
+		if m.HasError {
+			errResult = "err"
+		}
+		call := fmt.Sprintf("o.%s(%s)", m.Name, strings.Join(args, ", "))
+		if lhs := results; len(lhs) > 0 || m.HasError {
+			if m.HasError {
+				lhs = append(lhs, "err")
+			}
+			fmt.Fprintf(buf, "%s := %s\n", strings.Join(lhs, ", "), call)
+		} else {
+			fmt.Fprintf(buf, "%s\n", call)
+		}
+		if len(results) > 0 {
+			fmt.Fprintf(buf, "return []interface{}{%s}, true, %s\n", strings.Join(results, ", "), errResult)
+		} else {
+			fmt.Fprintf(buf, "return nil, true, %s\n", errResult)
+		}
+	}
+	fmt.Fprintf(buf, "}\nreturn nil, false, nil\n})\n")
+}
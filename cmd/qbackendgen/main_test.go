@@ -0,0 +1,96 @@
+package main
+
+import (
+	"go/ast"
+	"go/parser"
+	"go/token"
+	"strings"
+	"testing"
+)
+
+const testSource = `package example
+
+import "github.com/CrimsonAS/qbackend/backend"
+
+// Counter counts
+//
+// qbackend:generate
+type Counter struct {
+	qbackend.QObject
+	Count int
+}
+
+func (c *Counter) Add(a, b int) int {
+	return a + b
+}
+
+func (c Counter) Describe(name string, verbose bool) (string, error) {
+	return name, nil
+}
+
+func (c *Counter) Reset() {
+	c.Count = 0
+}
+
+func (c *Counter) Child() *Counter {
+	return nil
+}
+
+func (c *Counter) Sum(values ...int) int {
+	return 0
+}
+
+func (c *Counter) InitObject() {
+}
+
+func (c *Counter) helper() {
+}
+
+type Unmarked struct {
+	qbackend.QObject
+}
+
+func (u *Unmarked) Add(a int) {
+}
+`
+
+func TestGenerate(t *testing.T) {
+	fset := token.NewFileSet()
+	file, err := parser.ParseFile(fset, "example.go", testSource, parser.ParseComments)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	src, err := generate("example", []*ast.File{file})
+	if err != nil {
+		t.Fatalf("generate failed: %s", err)
+	}
+	if _, err := parser.ParseFile(fset, "qbackend_gen.go", src, 0); err != nil {
+		t.Fatalf("generated code is invalid: %s\n%s", err, src)
+	}
+
+	code := string(src)
+	for _, expected := range []string{
+		"RegisterGeneratedInvoker(&Counter{}",
+		`case "add":`,
+		"a1 = int(v)",
+		"r0 := o.Add(a0, a1)",
+		`case "describe":`,
+		"r0, err := o.Describe(a0, a1)",
+		`case "reset":`,
+		"o.Reset()",
+	} {
+		if !strings.Contains(code, expected) {
+			t.Errorf("generated code does not contain %q:\n%s", expected, code)
+		}
+	}
+	for _, unexpected := range []string{"Unmarked", `"child"`, `"sum"`, `"initObject"`, `"helper"`} {
+		if strings.Contains(code, unexpected) {
+			t.Errorf("generated code contains %q:\n%s", unexpected, code)
+		}
+	}
+
+	if _, err := generate("example", nil); err == nil {
+		t.Error("generate without marked types did not fail")
+	}
+}
@@ -1,5 +1,7 @@
 package main
 
+//go:generate go run github.com/CrimsonAS/qbackend/cmd/qbackendgen
+
 import (
 	"errors"
 
@@ -18,6 +20,7 @@ type Person struct {
 	Age       int
 }
 
+// qbackend:generate
 type PersonModel struct {
 	qbackend.Model
 	people []*Person
@@ -0,0 +1,78 @@
+// Code generated by qbackendgen. DO NOT EDIT.
+
+package main
+
+import qbackend "github.com/CrimsonAS/qbackend/backend"
+
+func init() {
+	qbackend.RegisterGeneratedInvoker(&PersonModel{}, func(obj qbackend.AnyQObject, method string, args []interface{}) ([]interface{}, bool, error) {
+		o := obj.(*PersonModel)
+		switch method {
+		case "removePerson":
+			if len(args) != 1 {
+				break
+			}
+			var a0 int
+			switch v := args[0].(type) {
+			case int:
+				a0 = v
+			case float64:
+				a0 = int(v)
+			case nil:
+			default:
+				return nil, false, nil
+			}
+			o.RemovePerson(a0)
+			return nil, true, nil
+		case "rowCount":
+			if len(args) != 0 {
+				break
+			}
+			r0 := o.RowCount()
+			return []interface{}{r0}, true, nil
+		case "updatePerson":
+			if len(args) != 4 {
+				break
+			}
+			var a0 int
+			switch v := args[0].(type) {
+			case int:
+				a0 = v
+			case float64:
+				a0 = int(v)
+			case nil:
+			default:
+				return nil, false, nil
+			}
+			var a1 string
+			switch v := args[1].(type) {
+			case string:
+				a1 = v
+			case nil:
+			default:
+				return nil, false, nil
+			}
+			var a2 string
+			switch v := args[2].(type) {
+			case string:
+				a2 = v
+			case nil:
+			default:
+				return nil, false, nil
+			}
+			var a3 int
+			switch v := args[3].(type) {
+			case int:
+				a3 = v
+			case float64:
+				a3 = int(v)
+			case nil:
+			default:
+				return nil, false, nil
+			}
+			o.UpdatePerson(a0, a1, a2, a3)
+			return nil, true, nil
+		}
+		return nil, false, nil
+	})
+}
@@ -10,7 +10,7 @@ Q_DECLARE_LOGGING_CATEGORY(lcConnection)
 
 class QBackendConnection;
 
-/* InstantiableBackendType is a wrapper around T (QBackendObject or QBackendModel)
+/* InstantiableBackendType is a wrapper around T (QBackendObject or one of the model types)
  * to allow registering dynamic types as instantiable QML types.
  *
  * qmlRegisterType expects a unique actual type for each registered type. It's
@@ -1,11 +1,15 @@
 #include "plugin.h"
 #include <QQmlEngine>
 #include <QCoreApplication>
+#include <QVector>
 
 #include "qbackendconnection.h"
 #include "qbackendprocess.h"
+#include "qbackendmultiplexer.h"
 #include "qbackendobject.h"
 #include "qbackendmodel.h"
+#include "qbackendtreemodel.h"
+#include "qbackendtablemodel.h"
 
 static QBackendConnection *singleConnection = nullptr;
 
@@ -13,6 +17,12 @@ void QBackendPlugin::registerTypes(const char *uri)
 {
     qRegisterMetaType<QBackendObject*>();
     qRegisterMetaType<QBackendModel*>();
+    qRegisterMetaType<QBackendTreeModel*>();
+    qRegisterMetaType<QBackendTableModel*>();
+    // Native list types for properties; these must be registered by name
+    // before building any backend types.
+    qRegisterMetaType<QVector<int>>();
+    qRegisterMetaType<QVector<double>>();
 
     if (QByteArray(uri) == "Crimson.QBackend") {
         // Make the connection immediately, so it will have an opportunity to register
@@ -28,7 +38,8 @@ void QBackendPlugin::registerTypes(const char *uri)
         //
         // To do this, the connection will (synchronously) block until type
         // registration is complete, and we then move the connection along with
-        // its children to the main thread.
+        // its children to the main thread. If there is a type cache, registration
+        // doesn't wait for the backend, and the root object starts as a placeholder.
         singleConnection->registerTypes(uri);
         singleConnection->moveToThread(QCoreApplication::instance()->thread());
 
@@ -54,6 +65,7 @@ void QBackendPlugin::registerTypes(const char *uri)
         // type to execute a new process for the backend.
         qmlRegisterType<QBackendConnection>(uri, 1, 0, "BackendConnection");
         qmlRegisterType<QBackendProcess>(uri, 1, 0, "BackendProcess");
+        qmlRegisterType<QBackendMultiplexer>(uri, 1, 0, "BackendMultiplexer");
     } else {
         Q_ASSERT_X(false, "QBackendPlugin", "unexpected plugin URI");
     }
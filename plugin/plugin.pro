@@ -13,19 +13,28 @@ SOURCES += \
     plugin.cpp \
     qbackendconnection.cpp \
     qbackendprocess.cpp \
+    qbackendmultiplexer.cpp \
     qbackendobject.cpp \
     qbackendmodel.cpp \
+    qbackendtreemodel.cpp \
+    qbackendtablemodel.cpp \
     promise.cpp
 
 HEADERS += \
     plugin.h \
     qbackendconnection.h \
     qbackendprocess.h \
+    qbackendmultiplexer.h \
     qbackendobject.h \
     qbackendobject_p.h \
     qbackendmodel.h \
     qbackendmodel_p.h \
+    qbackendtreemodel.h \
+    qbackendtreemodel_p.h \
+    qbackendtablemodel.h \
+    qbackendtablemodel_p.h \
     instantiable.h \
+    rowcache.h \
     promise.h
 
 load(qml_plugin)
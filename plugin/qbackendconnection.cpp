@@ -9,10 +9,14 @@
 #include <QCoreApplication>
 #include <QElapsedTimer>
 #include <QUuid>
+#include <QFile>
+#include <QSaveFile>
 
 #include "qbackendconnection.h"
 #include "qbackendobject.h"
 #include "qbackendmodel.h"
+#include "qbackendtreemodel.h"
+#include "qbackendtablemodel.h"
 #include "instantiable.h"
 
 // #define PROTO_DEBUG
@@ -20,16 +24,19 @@
 Q_LOGGING_CATEGORY(lcConnection, "backend.connection")
 Q_LOGGING_CATEGORY(lcProto, "backend.proto")
 Q_LOGGING_CATEGORY(lcProtoExtreme, "backend.proto.extreme", QtWarningMsg)
+Q_LOGGING_CATEGORY(lcStartup, "backend.startup")
 
 QBackendConnection::QBackendConnection(QObject *parent)
     : QObject(parent)
 {
+    m_startupTimer.start();
 }
 
 QBackendConnection::QBackendConnection(QQmlEngine *engine)
     : QObject()
     , m_qmlEngine(engine)
 {
+    m_startupTimer.start();
 }
 
 // When QBackendConnection is a singleton, qmlEngine/qmlContext may not always work.
@@ -51,7 +58,11 @@ void QBackendConnection::setQmlEngine(QQmlEngine *engine)
     }
 
     m_qmlEngine = engine;
-    setState(ConnectionState::Ready);
+    startupPhase("engine");
+    // With asynchronous startup, the engine can arrive before VERSION and CREATABLE_TYPES.
+    // WantEngine will transition immediately once those are done.
+    if (m_state == ConnectionState::WantEngine)
+        setState(ConnectionState::Ready);
 }
 
 QUrl QBackendConnection::url() const
@@ -119,6 +130,56 @@ QObject *QBackendConnection::rootObject()
     return m_rootObject;
 }
 
+// startupTimes has the time in milliseconds from creation of the connection to each
+// phase of startup, which is useful to find what is delaying the first frame.
+QVariantMap QBackendConnection::startupTimes() const
+{
+    return m_startupTimes;
+}
+
+// multiplexer is shared with the connections of other backends, which handle objects
+// of their shard; see QBackendMultiplexer.
+QBackendMultiplexer *QBackendConnection::multiplexer() const
+{
+    return m_multiplexer;
+}
+
+void QBackendConnection::setMultiplexer(QBackendMultiplexer *multiplexer)
+{
+    if (m_multiplexer == multiplexer)
+        return;
+    if (m_multiplexer)
+        m_multiplexer->removeConnection(this);
+    m_multiplexer = multiplexer;
+    if (m_multiplexer && !m_shard.isEmpty())
+        m_multiplexer->addShard(m_shard, this);
+    emit multiplexerChanged();
+}
+
+// shard is the name of the backend's shard, which is known from the ROOT message.
+QString QBackendConnection::shard() const
+{
+    return m_shard;
+}
+
+QBackendConnection *QBackendConnection::shardConnection(const QByteArray &identifier) const
+{
+    if (!m_multiplexer)
+        return nullptr;
+    QBackendConnection *c = m_multiplexer->connection(identifier);
+    return c != this ? c : nullptr;
+}
+
+void QBackendConnection::startupPhase(const QString &phase)
+{
+    if (m_startupTimes.contains(phase))
+        return;
+    qint64 ms = m_startupTimer.elapsed();
+    m_startupTimes.insert(phase, ms);
+    qCDebug(lcStartup) << "Startup phase" << phase << "at" << ms << "ms";
+    emit startupTimesChanged();
+}
+
 void QBackendConnection::setBackendIo(QIODevice *rd, QIODevice *wr)
 {
     if (m_readIo || m_writeIo) {
@@ -214,6 +275,30 @@ bool QBackendConnection::ensureConnectionInit()
 
 bool QBackendConnection::ensureRootObject()
 {
+    if (m_rootObject)
+        return true;
+
+    if (loadTypeCache()) {
+        // Asynchronous startup; use the cached type to create a placeholder root object
+        // without waiting for the backend. Properties have default values until ROOT
+        // arrives, which will signal changes for each of them.
+        if (!ensureConnectionConfig())
+            return false;
+        if (!qmlEngine()) {
+            qCCritical(lcConnection) << "Connection cannot build root object without a QML engine";
+            return false;
+        }
+
+        m_rootObject = ensureObject("root", m_rootType);
+        QQmlEngine::setObjectOwnership(m_rootObject, QQmlEngine::CppOwnership);
+        if (!m_snapshotRoot.isEmpty())
+            m_objects.value("root")->objectFound(m_snapshotRoot);
+        else
+            static_cast<BackendObjectPrivate*>(m_objects.value("root"))->m_dataPending = true;
+        startupPhase("root placeholder");
+        return true;
+    }
+
     if (!ensureConnectionInit())
         return false;
     if (m_rootObject)
@@ -238,14 +323,15 @@ bool QBackendConnection::ensureRootObject()
 // Register instantiable types with the QML engine, blocking if necessary
 void QBackendConnection::registerTypes(const char *uri)
 {
-    if (!ensureConnectionInit()) {
+    if (loadTypeCache()) {
+        // Types are registered from the cache, and the connection continues in the
+        // background. It doesn't need to be ready until objects are used.
+        ensureConnectionConfig();
+    } else if (!ensureConnectionInit()) {
         qCCritical(lcConnection) << "Connection initialization failed, cannot register types";
         return;
-    }
-    Q_ASSERT(m_state != ConnectionState::WantVersion);
-
-    // Don't block if we already have types
-    if (m_state == ConnectionState::WantTypes) {
+    } else if (m_state == ConnectionState::WantTypes) {
+        // Don't block if we already have types
         QElapsedTimer tm;
         qCDebug(lcConnection) << "Blocking to initialize creatable types";
         tm.restart();
@@ -260,9 +346,319 @@ void QBackendConnection::registerTypes(const char *uri)
         // See instantiable.h for an explanation of how this magic works
         if (!type.value("properties").toObject().value("_qb_model").isUndefined())
             addInstantiableBackendType<QBackendModel>(uri, this, type);
+        else if (!type.value("properties").toObject().value("_qb_tree").isUndefined())
+            addInstantiableBackendType<QBackendTreeModel>(uri, this, type);
+        else if (!type.value("properties").toObject().value("_qb_table").isUndefined())
+            addInstantiableBackendType<QBackendTableModel>(uri, this, type);
         else
             addInstantiableBackendType<QBackendObject>(uri, this, type);
     }
+    startupPhase("types registered");
+}
+
+// Find a path from the context property, commandline, and environment, in the same order
+// as ensureConnectionConfig. There is usually no context yet when this is used.
+QString QBackendConnection::configPath(const char *property, const char *arg, const char *env) const
+{
+    QQmlContext *context = qmlContext(this);
+    if (!context && m_qmlEngine) {
+        context = m_qmlEngine->rootContext();
+    }
+    if (context) {
+        QString path = context->contextProperty(property).toString();
+        if (!path.isEmpty())
+            return path;
+    }
+
+    QStringList args = QCoreApplication::arguments();
+    int argp = args.indexOf(arg);
+    if (argp >= 0 && argp+1 < args.size()) {
+        return args[argp+1];
+    }
+
+    return qEnvironmentVariable(env);
+}
+
+/* The type cache allows startup without blocking for the backend. It's a JSON file:
+ *
+ * {
+ *   "types": [ ... ], // as in CREATABLE_TYPES
+ *   "root": { ... } // type of the root object
+ * }
+ *
+ * When a cache is configured and valid, types are registered from the cache, and the
+ * root object is a placeholder until its data arrives. If there was no cache, or the
+ * backend's types have changed, the cache is written once ROOT has been received.
+ * The file can also be generated by the backend with Connection.TypeDefinitions()
+ * and shipped with the application.
+ *
+ * Types can't be changed after registration, so a stale cache may leave some types
+ * incomplete until the next start.
+ */
+QString QBackendConnection::typeCachePath() const
+{
+    return configPath("qbackendTypeCache", "-qbackend-type-cache", "QBACKEND_TYPE_CACHE");
+}
+
+// loadTypeCache returns true if a type cache was loaded and startup is asynchronous
+bool QBackendConnection::loadTypeCache()
+{
+    if (m_typeCacheChecked)
+        return m_asyncStartup;
+    m_typeCacheChecked = true;
+
+    QString path = typeCachePath();
+    if (path.isEmpty())
+        return false;
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCDebug(lcConnection) << "No type cache at" << path << "; startup will block for the backend";
+        m_typeCacheStale = true;
+        return false;
+    }
+
+    QJsonParseError pe;
+    QJsonObject cache = QJsonDocument::fromJson(file.readAll(), &pe).object();
+    if (pe.error != QJsonParseError::NoError || !cache.value("root").isObject()) {
+        qCWarning(lcConnection) << "Ignoring invalid type cache" << path << pe.errorString();
+        m_typeCacheStale = true;
+        return false;
+    }
+
+    m_creatableTypes = cache.value("types").toArray();
+    m_rootType = cache.value("root").toObject();
+    m_asyncStartup = true;
+    startupPhase("type cache");
+    qCDebug(lcConnection) << "Loaded type cache from" << path << "for asynchronous startup";
+
+    loadSnapshot();
+    return true;
+}
+
+void QBackendConnection::saveTypeCache()
+{
+    QString path = typeCachePath();
+    if (!m_typeCacheStale || path.isEmpty())
+        return;
+    m_typeCacheStale = false;
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(lcConnection) << "Cannot write type cache" << path << file.errorString();
+        return;
+    }
+    file.write(QJsonDocument(QJsonObject{{"types", m_creatableTypes}, {"root", m_rootType}}).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+        qCWarning(lcConnection) << "Cannot write type cache" << path << file.errorString();
+        return;
+    }
+    qCDebug(lcConnection) << "Saved type cache to" << path;
+}
+
+// Add the identifiers of all objects referenced in value to ids
+static void collectObjectRefs(const QJsonValue &value, QSet<QByteArray> &ids)
+{
+    if (value.isArray()) {
+        for (const QJsonValue &v : value.toArray())
+            collectObjectRefs(v, ids);
+    } else if (value.isObject()) {
+        QJsonObject object = value.toObject();
+        if (object.value("_qbackend_").toString() == "object") {
+            ids.insert(object.value("identifier").toString().toUtf8());
+            return;
+        }
+        for (const QJsonValue &v : object)
+            collectObjectRefs(v, ids);
+    }
+}
+
+// Replace references to objects that are not in keep with null
+static QJsonValue withoutObjectRefs(const QJsonValue &value, const QJsonObject &keep)
+{
+    if (value.isArray()) {
+        QJsonArray array = value.toArray();
+        for (int i = 0; i < array.size(); i++)
+            array[i] = withoutObjectRefs(array.at(i), keep);
+        return array;
+    } else if (value.isObject()) {
+        QJsonObject object = value.toObject();
+        if (object.value("_qbackend_").toString() == "object")
+            return keep.contains(object.value("identifier").toString()) ? value : QJsonValue();
+        for (auto it = object.begin(); it != object.end(); it++)
+            *it = withoutObjectRefs(*it, keep);
+        return object;
+    }
+    return value;
+}
+
+/* The snapshot is an optional addition to the type cache. It saves the data of the root
+ * object and the objects it references directly when the application quits:
+ *
+ * {
+ *   "root": { ... }, // data
+ *   "objects": {
+ *     "identifier": { "type": { ... }, "data": { ... } }
+ *   }
+ * }
+ *
+ * During asynchronous startup, the placeholder root object and those objects start with
+ * the snapshot data, so the first frame can show real content. When ROOT arrives, only
+ * the properties that changed are signalled. Referenced objects that still exist with
+ * the same identifier are refreshed. Others are never referenced on the backend and
+ * will be replaced by the new values of properties.
+ *
+ * Objects are matched by identifier, so only objects with stable identifiers (from
+ * Connection.InitObjectId) can still exist after the backend restarts. Objects with
+ * the random identifiers of other backend objects are not saved; for those, only the
+ * root data is useful. References to objects that aren't saved are null in the snapshot,
+ * because the backend can't know those identifiers. Until ROOT arrives, method calls and queries on snapshot
+ * objects wait to find out if the backend has them, and are dropped if it doesn't.
+ *
+ * The snapshot is set with -qbackend-snapshot, QBACKEND_SNAPSHOT, or the qbackendSnapshot
+ * context property. It's only used with a type cache.
+ */
+QString QBackendConnection::snapshotPath() const
+{
+    return configPath("qbackendSnapshot", "-qbackend-snapshot", "QBACKEND_SNAPSHOT");
+}
+
+void QBackendConnection::loadSnapshot()
+{
+    QString path = snapshotPath();
+    if (path.isEmpty())
+        return;
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCDebug(lcConnection) << "No snapshot at" << path;
+        return;
+    }
+
+    QJsonParseError pe;
+    QJsonObject snapshot = QJsonDocument::fromJson(file.readAll(), &pe).object();
+    if (pe.error != QJsonParseError::NoError) {
+        qCWarning(lcConnection) << "Ignoring invalid snapshot" << path << pe.errorString();
+        return;
+    }
+
+    m_snapshotRoot = snapshot.value("root").toObject();
+    QJsonObject objects = snapshot.value("objects").toObject();
+    for (auto it = objects.constBegin(); it != objects.constEnd(); it++) {
+        QByteArray identifier = it.key().toUtf8();
+        m_snapshotObjects.insert(identifier, it.value().toObject());
+        m_snapshotUnconfirmed.insert(identifier);
+    }
+    // Every object the root refers to is unconfirmed, including any without saved data
+    collectObjectRefs(m_snapshotRoot, m_snapshotUnconfirmed);
+    startupPhase("snapshot");
+    qCDebug(lcConnection) << "Loaded snapshot from" << path << "with" << m_snapshotObjects.size() << "objects";
+}
+
+void QBackendConnection::saveSnapshot()
+{
+    QString path = snapshotPath();
+    auto root = static_cast<BackendObjectPrivate*>(m_objects.value("root"));
+    if (path.isEmpty() || !root || !root->m_dataReady)
+        return;
+
+    QSet<QByteArray> ids;
+    collectObjectRefs(root->m_dataObject, ids);
+
+    QJsonObject objects;
+    for (const QByteArray &identifier : qAsConst(ids)) {
+        auto obj = static_cast<BackendObjectPrivate*>(m_objects.value(identifier));
+        if (!obj || !obj->m_dataReady)
+            continue;
+        // Random identifiers will never exist again, after a shard prefix if any
+        if (!QUuid::fromString(QString::fromUtf8(identifier.mid(identifier.indexOf('/') + 1))).isNull())
+            continue;
+        QJsonObject type = m_typeDefinitions.value(QString::fromUtf8(obj->object()->metaObject()->className()));
+        if (type.isEmpty())
+            continue;
+        objects.insert(QString::fromUtf8(identifier), QJsonObject{{"type", type}, {"data", obj->m_dataObject}});
+    }
+
+    // Objects that weren't saved can't be referenced before ROOT, and must not be
+    // referenced from the data of saved objects either
+    QJsonObject rootData = withoutObjectRefs(root->m_dataObject, objects).toObject();
+    for (auto it = objects.begin(); it != objects.end(); it++) {
+        QJsonObject object = it->toObject();
+        object["data"] = withoutObjectRefs(object.value("data"), objects);
+        *it = object;
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(lcConnection) << "Cannot write snapshot" << path << file.errorString();
+        return;
+    }
+    file.write(QJsonDocument(QJsonObject{{"root", rootData}, {"objects", objects}}).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+        qCWarning(lcConnection) << "Cannot write snapshot" << path << file.errorString();
+        return;
+    }
+    qCDebug(lcConnection) << "Saved snapshot to" << path << "with" << objects.size() << "objects";
+}
+
+// Reference and refresh snapshot objects that still exist in the backend
+void QBackendConnection::reconcileSnapshot(const QJsonObject &rootData)
+{
+    QSet<QByteArray> ids;
+    collectObjectRefs(rootData, ids);
+
+    for (auto it = m_snapshotUnconfirmed.begin(); it != m_snapshotUnconfirmed.end(); ) {
+        if (!ids.contains(*it)) {
+            it++;
+            continue;
+        }
+
+        QByteArray identifier = *it;
+        it = m_snapshotUnconfirmed.erase(it);
+        if (m_objects.contains(identifier)) {
+            write(QJsonObject{
+                  {"command", "OBJECT_REF"},
+                  {"identifier", QString::fromUtf8(identifier)},
+            });
+            resetObjectData(identifier);
+        }
+    }
+
+    qCDebug(lcConnection) << "Reconciled snapshot," << m_snapshotUnconfirmed.size() << "objects are stale";
+    m_snapshotRoot = QJsonObject();
+    m_snapshotObjects.clear();
+    m_snapshotReconciled = true;
+
+    const auto pending = m_snapshotPendingMessages;
+    m_snapshotPendingMessages.clear();
+    for (const QJsonObject &message : pending)
+        writeObjectMessage(message.value("identifier").toString().toUtf8(), message);
+}
+
+// writeObjectMessage writes a message for an object, unless it is from the snapshot
+// and hasn't been confirmed by the backend, which would be fatal for the backend.
+// Those wait until the snapshot is reconciled, and are dropped if the object is stale.
+void QBackendConnection::writeObjectMessage(const QByteArray &identifier, const QJsonObject &message)
+{
+    if (!m_snapshotUnconfirmed.contains(identifier)) {
+        write(message);
+        return;
+    } else if (!m_snapshotReconciled) {
+        qCDebug(lcConnection) << "Queueing" << message.value("command").toString() << "for snapshot object" << identifier << "until ROOT";
+        m_snapshotPendingMessages.append(message);
+        return;
+    }
+
+    qCWarning(lcConnection) << "Dropping" << message.value("command").toString() << "for object" << identifier
+        << "from the snapshot, which no longer exists in the backend";
+    QByteArray returnId = message.value("return").toString().toUtf8();
+    if (!returnId.isEmpty()) {
+        // The caller may not have a promise for the return yet
+        QMetaObject::invokeMethod(this, [=]() {
+            if (auto obj = m_objects.value(identifier))
+                obj->methodReturned(returnId, QJsonValue("object no longer exists in the backend"), true);
+        }, Qt::QueuedConnection);
+    }
 }
 
 void QBackendConnection::classBegin()
@@ -420,22 +816,23 @@ void QBackendConnection::handleMessage(const QJsonObject &cmd)
     QString command = cmd.value("command").toString();
     bool doDeliver = true;
 
+    // VERSION and CREATABLE_TYPES must happen before anything else, and nothing
+    // else could be handled until there is a QML engine. Queue all other messages.
+    bool isStartup = (m_state == ConnectionState::WantVersion && command == "VERSION") ||
+                     (m_state == ConnectionState::WantTypes && command == "CREATABLE_TYPES");
+
     if (!m_syncResult.isEmpty()) {
         qCDebug(lcConnection) << "Queueing handling of " << command << " due to syncResult";
         doDeliver = false;
     } else if (m_state != ConnectionState::Ready) {
-        // VERSION and CREATABLE_TYPES must happen before anything else, and nothing
-        // else could be handled until there is a QML engine. Queue all other messages.
-        if (m_state == ConnectionState::WantVersion && command == "VERSION")
-            doDeliver = true;
-        else if (m_state == ConnectionState::WantTypes && command == "CREATABLE_TYPES")
-            doDeliver = true;
-        else
-            doDeliver = false;
+        doDeliver = isStartup;
     }
 
-    if (doDeliver && m_syncCallback && !m_syncCallback(cmd)) {
-        // If we're blocking for a message and it's not this message, queue it
+    bool isSyncResult = doDeliver && m_syncCallback && m_syncCallback(cmd);
+    if (doDeliver && m_syncCallback && !isSyncResult && !isStartup) {
+        // If we're blocking for a message and it's not this message, queue it. Startup
+        // messages are always handled, because anything that blocks before the connection
+        // is ready (during asynchronous startup) can't finish without them.
         doDeliver = false;
     }
 
@@ -445,17 +842,25 @@ void QBackendConnection::handleMessage(const QJsonObject &cmd)
         return;
     }
 
-    if (m_syncCallback)
+    if (isSyncResult)
         m_syncResult = cmd;
 
     if (command == "VERSION") {
         Q_ASSERT(m_state == ConnectionState::WantVersion);
         m_version = cmd.value("version").toInt();
         qCInfo(lcConnection) << "Connected to backend version" << m_version;
+        startupPhase("version");
         setState(ConnectionState::WantTypes);
     } else if (command == "CREATABLE_TYPES") {
         Q_ASSERT(m_state == ConnectionState::WantTypes);
-        m_creatableTypes = cmd.value("types").toArray();
+        QJsonArray types = cmd.value("types").toArray();
+        if (m_asyncStartup && types != m_creatableTypes) {
+            qCWarning(lcConnection) << "Creatable types from the backend don't match the type cache."
+                << "The cache will be updated, but types may be incomplete until restarted.";
+            m_typeCacheStale = true;
+        }
+        m_creatableTypes = types;
+        startupPhase("types");
         setState(ConnectionState::WantEngine);
     } else if (command == "ROOT") {
         Q_ASSERT(m_state == ConnectionState::Ready);
@@ -466,15 +871,49 @@ void QBackendConnection::handleMessage(const QJsonObject &cmd)
             return;
         }
 
+        QString shard = cmd.value("shard").toString();
+        if (shard != m_shard) {
+            if (m_multiplexer)
+                m_multiplexer->removeConnection(this);
+            m_shard = shard;
+            if (m_multiplexer && !m_shard.isEmpty())
+                m_multiplexer->addShard(m_shard, this);
+            emit shardChanged();
+        }
+
+        QJsonObject rootType = cmd.value("type").toObject();
+        if (rootType != m_rootType) {
+            if (m_asyncStartup) {
+                qCWarning(lcConnection) << "Root object type from the backend doesn't match the type cache."
+                    << "The cache will be updated, but the root object may be incomplete until restarted.";
+            }
+            m_rootType = rootType;
+            m_typeCacheStale = true;
+        }
+
+        bool firstRoot = !m_rootReceived;
+        m_rootReceived = true;
         if (!m_rootObject) {
-            m_rootObject = ensureObject("root", cmd.value("type").toObject());
+            m_rootObject = ensureObject("root", rootType);
             QQmlEngine::setObjectOwnership(m_rootObject, QQmlEngine::CppOwnership);
             m_objects.value("root")->objectFound(cmd.value("data").toObject());
+            startupPhase("root");
+            emit ready();
+        } else if (m_asyncStartup && firstRoot) {
+            // Filling in the placeholder root object; if it had snapshot data, only
+            // changed properties are signalled.
+            QJsonObject data = cmd.value("data").toObject();
+            m_objects.value("root")->objectFound(data);
+            reconcileSnapshot(data);
+            startupPhase("root");
             emit ready();
         } else {
-            // XXX assert that type has not changed
             m_objects.value("root")->objectFound(cmd.value("data").toObject());
         }
+
+        saveTypeCache();
+        if (firstRoot && !snapshotPath().isEmpty())
+            connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &QBackendConnection::saveSnapshot, Qt::UniqueConnection);
     } else if (command == "OBJECT_RESET") {
         QByteArray identifier = cmd.value("identifier").toString().toUtf8();
         auto obj = m_objects.value(identifier);
@@ -598,7 +1037,7 @@ QJsonObject QBackendConnection::waitForMessage(const char *waitType, std::functi
 void QBackendConnection::invokeMethod(const QByteArray& objectIdentifier, const QString& method, const QJsonArray& params)
 {
     qCDebug(lcConnection) << "Invoking " << objectIdentifier << method << params;
-    write(QJsonObject{
+    writeObjectMessage(objectIdentifier, QJsonObject{
           {"command", "INVOKE"},
           {"identifier", QString::fromUtf8(objectIdentifier)},
           {"method", method},
@@ -610,7 +1049,7 @@ QByteArray QBackendConnection::invokeMethodWithReturn(const QByteArray& objectId
 {
     auto returnId = QUuid::createUuid().toString();
     qCDebug(lcConnection) << "Invoking returnable call" << returnId << "on object" << objectIdentifier << method << params;
-    write(QJsonObject{
+    writeObjectMessage(objectIdentifier, QJsonObject{
           {"command", "INVOKE"},
           {"identifier", QString::fromUtf8(objectIdentifier)},
           {"return", returnId},
@@ -630,6 +1069,11 @@ void QBackendConnection::addObjectProxy(const QByteArray& identifier, QBackendRe
     qCDebug(lcConnection) << "Creating remote object handler " << identifier << " on connection " << this << " for " << proxy;
     m_objects.insert(identifier, proxy);
 
+    if (m_snapshotUnconfirmed.contains(identifier)) {
+        // Objects from the snapshot are referenced once the backend confirms they exist
+        return;
+    }
+
     write(QJsonObject{
           {"command", "OBJECT_REF"},
           {"identifier", QString::fromUtf8(identifier)},
@@ -648,7 +1092,16 @@ void QBackendConnection::addObjectInstantiated(const QString &typeName, const QB
 
 void QBackendConnection::resetObjectData(const QByteArray& identifier, bool synchronous)
 {
-    write(QJsonObject{{"command", "OBJECT_QUERY"}, {"identifier", QString::fromUtf8(identifier)}});
+    if (synchronous && m_snapshotUnconfirmed.contains(identifier) && !m_snapshotReconciled) {
+        // The query can't be sent until ROOT confirms that the object exists
+        waitForMessage("root", [](const QJsonObject &msg) { return msg.value("command").toString() == "ROOT"; });
+    }
+    if (m_snapshotUnconfirmed.contains(identifier) && m_snapshotReconciled) {
+        qCWarning(lcConnection) << "Not querying object" << identifier << "from the snapshot, which no longer exists in the backend";
+        return;
+    }
+
+    writeObjectMessage(identifier, QJsonObject{{"command", "OBJECT_QUERY"}, {"identifier", QString::fromUtf8(identifier)}});
 
     if (synchronous) {
         waitForMessage("object_reset", [identifier](const QJsonObject &message) -> bool {
@@ -674,6 +1127,11 @@ void QBackendConnection::removeObject(const QByteArray& identifier, QBackendRemo
     qCDebug(lcConnection) << "Removing remote object handler " << identifier << " on connection " << this << " for ";
     m_objects.remove(identifier);
 
+    if (m_snapshotUnconfirmed.remove(identifier)) {
+        // Never referenced
+        return;
+    }
+
     write(QJsonObject{
           {"command", "OBJECT_DEREF"},
           {"identifier", QString::fromUtf8(identifier)}
@@ -682,6 +1140,9 @@ void QBackendConnection::removeObject(const QByteArray& identifier, QBackendRemo
 
 QObject *QBackendConnection::object(const QByteArray &identifier) const
 {
+    if (QBackendConnection *c = shardConnection(identifier))
+        return c->object(identifier);
+
     auto obj = m_objects.value(identifier);
     if (obj)
         return obj->object();
@@ -699,14 +1160,22 @@ QObject *QBackendConnection::ensureObject(const QByteArray &identifier, const QJ
 {
     if (identifier.isEmpty())
         return nullptr;
+    if (QBackendConnection *c = shardConnection(identifier))
+        return c->ensureObject(identifier, type);
 
     auto proxyObject = m_objects.value(identifier);
     if (!proxyObject) {
-        QMetaObject *metaObject = newTypeMetaObject(type);
+        // Type descriptions in snapshot data may have been omitted
+        QJsonObject snapshot = m_snapshotObjects.value(identifier);
+        QMetaObject *metaObject = newTypeMetaObject(snapshot.isEmpty() ? type : snapshot.value("type").toObject());
         QObject *object;
 
         if (metaObject->inherits(&QAbstractListModel::staticMetaObject))
             object = new QBackendModel(this, identifier, metaObject);
+        else if (metaObject->inherits(&QAbstractTableModel::staticMetaObject))
+            object = new QBackendTableModel(this, identifier, metaObject);
+        else if (metaObject->inherits(&QAbstractItemModel::staticMetaObject))
+            object = new QBackendTreeModel(this, identifier, metaObject);
         else
             object = new QBackendObject(this, identifier, metaObject);
         QQmlEngine::setContextForObject(object, qmlContext(this));
@@ -716,6 +1185,9 @@ QObject *QBackendConnection::ensureObject(const QByteArray &identifier, const QJ
         // Object constructor should have registered its proxy
         proxyObject = m_objects.value(identifier);
         Q_ASSERT(proxyObject);
+
+        if (!snapshot.isEmpty())
+            proxyObject->objectFound(snapshot.value("data").toObject());
     }
 
     return proxyObject->object();
@@ -730,6 +1202,9 @@ QJSValue QBackendConnection::ensureJSObject(const QJsonObject &data)
 // This should be used instead of calling newQObject directly, because it covers corner cases.
 QJSValue QBackendConnection::ensureJSObject(const QByteArray &identifier, const QJsonObject &type)
 {
+    if (QBackendConnection *c = shardConnection(identifier))
+        return c->ensureJSObject(identifier, type);
+
     QObject *obj = ensureObject(identifier, type);
     if (!obj)
         return QJSValue(QJSValue::NullValue);
@@ -769,11 +1244,17 @@ QMetaObject *QBackendConnection::newTypeMetaObject(const QJsonObject &type)
         // If type is a model type, set a superclass as well
         if (!type.value("properties").toObject().value("_qb_model").isUndefined()) {
             mo = metaObjectFromType(type, &QAbstractListModel::staticMetaObject);
+        } else if (!type.value("properties").toObject().value("_qb_tree").isUndefined()) {
+            mo = metaObjectFromType(type, &QAbstractItemModel::staticMetaObject);
+        } else if (!type.value("properties").toObject().value("_qb_table").isUndefined()) {
+            mo = metaObjectFromType(type, &QAbstractTableModel::staticMetaObject);
         } else {
             mo = metaObjectFromType(type, nullptr);
         }
 
         m_typeCache.insert(type.value("name").toString(), mo);
+        if (!type.value("omitted").toBool())
+            m_typeDefinitions.insert(type.value("name").toString(), type);
         qDebug(lcConnection) << "Cached metaobject for type" << type.value("name").toString();
     }
 
@@ -8,8 +8,13 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QJSValue>
+#include <QElapsedTimer>
+#include <QVariantMap>
+#include <QSet>
 #include <functional>
 
+#include "qbackendmultiplexer.h"
+
 class QBackendObject;
 class QQmlEngine;
 
@@ -36,6 +41,9 @@ class QBackendConnection : public QObject, public QQmlParserStatus
     Q_INTERFACES(QQmlParserStatus)
     Q_PROPERTY(QUrl url READ url WRITE setUrl NOTIFY urlChanged)
     Q_PROPERTY(QObject* root READ rootObject NOTIFY ready)
+    Q_PROPERTY(QVariantMap startupTimes READ startupTimes NOTIFY startupTimesChanged)
+    Q_PROPERTY(QBackendMultiplexer* multiplexer READ multiplexer WRITE setMultiplexer NOTIFY multiplexerChanged)
+    Q_PROPERTY(QString shard READ shard NOTIFY shardChanged)
 
 public:
     QBackendConnection(QObject *parent = nullptr);
@@ -48,6 +56,11 @@ public:
     void setUrl(const QUrl& url);
 
     QObject *rootObject();
+    QVariantMap startupTimes() const;
+
+    QBackendMultiplexer *multiplexer() const;
+    void setMultiplexer(QBackendMultiplexer *multiplexer);
+    QString shard() const;
 
     Q_INVOKABLE QObject *object(const QByteArray &identifier) const;
     QObject *ensureObject(const QJsonObject &object);
@@ -74,9 +87,13 @@ public:
 signals:
     void urlChanged();
     void ready();
+    void startupTimesChanged();
+    void multiplexerChanged();
+    void shardChanged();
 
 protected:
     void setBackendIo(QIODevice *read, QIODevice *write);
+    void startupPhase(const QString &phase);
     void classBegin() override;
     void componentComplete() override;
 
@@ -98,6 +115,39 @@ private:
     bool ensureConnectionInit();
     bool ensureRootObject();
 
+    QString configPath(const char *property, const char *arg, const char *env) const;
+
+    // Type cache for non-blocking startup; see loadTypeCache()
+    QString typeCachePath() const;
+    bool loadTypeCache();
+    void saveTypeCache();
+    bool m_typeCacheChecked = false;
+    bool m_asyncStartup = false;
+    // ROOT has been received from the backend, possibly after a placeholder root object
+    bool m_rootReceived = false;
+    bool m_typeCacheStale = false;
+    QJsonObject m_rootType;
+    // Full type definitions by name, for the snapshot
+    QHash<QString,QJsonObject> m_typeDefinitions;
+
+    // Snapshot of root data for asynchronous startup; see loadSnapshot()
+    QString snapshotPath() const;
+    void loadSnapshot();
+    void saveSnapshot();
+    void reconcileSnapshot(const QJsonObject &rootData);
+    QJsonObject m_snapshotRoot;
+    QHash<QByteArray,QJsonObject> m_snapshotObjects;
+    // Snapshot identifiers that have not been seen from the backend, which are not referenced
+    QSet<QByteArray> m_snapshotUnconfirmed;
+    // After reconciling, identifiers left in m_snapshotUnconfirmed are stale
+    bool m_snapshotReconciled = false;
+    // Messages for unconfirmed objects, which are sent or dropped after reconciling
+    QList<QJsonObject> m_snapshotPendingMessages;
+    void writeObjectMessage(const QByteArray &identifier, const QJsonObject &message);
+
+    QElapsedTimer m_startupTimer;
+    QVariantMap m_startupTimes;
+
     void handleMessage(const QByteArray &message);
     void handleMessage(const QJsonObject &message);
     void handlePendingMessages();
@@ -128,5 +178,10 @@ private:
     QJsonArray m_creatableTypes;
 
     QHash<QString,QMetaObject*> m_typeCache;
+
+    // Objects of other shards are handled by their own connection
+    QPointer<QBackendMultiplexer> m_multiplexer;
+    QString m_shard;
+    QBackendConnection *shardConnection(const QByteArray &identifier) const;
 };
 
@@ -6,6 +6,11 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QLoggingCategory>
+#include <QMetaProperty>
+#include <QTimer>
+#include <cmath>
+#include <climits>
+#include <algorithm>
 
 Q_LOGGING_CATEGORY(lcModel, "backend.model")
 
@@ -59,6 +64,229 @@ void QBackendModel::componentComplete()
     d->componentComplete();
 }
 
+/* Model types have some properties that are implemented by the client, to control
+ * the behavior of the model from QML:
+ *
+ *   asynchronous: bool
+ *     If true, data() never blocks. Rows that aren't cached read as undefined, and
+ *     dataChanged is emitted once they arrive. Rows are prefetched in the direction
+ *     of scrolling.
+ *   cacheBudget: int
+ *     Approximate size in bytes for cached rows. The default is 4MB. Rows furthest from
+ *     any recently viewed range are evicted first, so several views on one model, or
+ *     a view that jumps between positions, can keep their rows.
+ *   fetchRoles: list of role names
+ *     Only these roles are included in row data sent by the backend. Reading any other
+ *     role adds it to the list and fetches it on demand, which refetches cached rows.
+ *     If empty, all roles are fetched, unless trackRoles is set.
+ *   trackRoles: bool
+ *     If true, fetchRoles starts empty and roles are added as they are read, so the
+ *     backend only sends the roles that delegates use.
+ *   sortRole: string
+ *   sortOrder: Qt.AscendingOrder or Qt.DescendingOrder
+ *     Rows are sorted by the value of this role. Sorting is done by the backend, so it
+ *     doesn't require fetching all rows. Changing the sort resets the model.
+ *   filterRole: string
+ *   filter: string
+ *     Only rows where the value of filterRole matches the regular expression filter
+ *     are included, or where any role matches if filterRole is empty. Rows that start
+ *     or stop matching are removed and inserted.
+ *   statistics: object (read-only)
+ *     Counters for tuning: blockingFetches, asyncFetches, prefetches, discardedFetches
+ *     (rows that had moved before they arrived), cacheHits, cacheMisses, cacheEvictions,
+ *     and the current cachedRows and cacheBytes.
+ *
+ * These are not sent to the backend. If the backend type has a property with the
+ * same name, the client property is not added.
+ *
+ * There is also one method, which is not added if the backend type has a method with
+ * the same name:
+ *
+ *   findRows(role, value): Promise
+ *     Resolves with the indexes of all rows where the value of role equals value,
+ *     without fetching any rows. The backend indexes values of a role when it is first
+ *     searched, so finding a row of a large model takes one round trip.
+ */
+const QVector<BackendModelPrivate::ClientProperty> &BackendModelPrivate::clientProperties()
+{
+    static const QVector<ClientProperty> properties{
+        { "asynchronous", "bool", true },
+        { "cacheBudget", "int", true },
+        { "fetchRoles", "QStringList", true },
+        { "trackRoles", "bool", true },
+        { "sortRole", "QString", true },
+        { "sortOrder", "int", true },
+        { "filterRole", "QString", true },
+        { "filter", "QString", true },
+        { "statistics", "QVariantMap", false },
+    };
+    return properties;
+}
+
+int BackendModelPrivate::metacall(QMetaObject::Call c, int id, void **argv)
+{
+    if (c == QMetaObject::ReadProperty || c == QMetaObject::WriteProperty) {
+        const QMetaObject *metaObject = m_object->metaObject();
+        QMetaProperty property = metaObject->property(id + metaObject->propertyOffset());
+        QByteArray name(property.name());
+
+        bool handled;
+        if (c == QMetaObject::ReadProperty)
+            handled = readClientProperty(name, argv[0]);
+        else
+            handled = writeClientProperty(name, argv[0]);
+        if (handled)
+            return id - (metaObject->propertyCount() - metaObject->propertyOffset());
+    } else if (c == QMetaObject::InvokeMetaMethod) {
+        const QMetaObject *metaObject = m_object->metaObject();
+        QMetaMethod method = metaObject->method(id + metaObject->methodOffset());
+        if (method.methodSignature() == "findRows(QString,QJSValue)") {
+            QJSValue promise = findRows(*reinterpret_cast<QString*>(argv[1]), *reinterpret_cast<QJSValue*>(argv[2]));
+            if (argv[0])
+                *reinterpret_cast<QJSValue*>(argv[0]) = promise;
+            return id - (metaObject->methodCount() - metaObject->methodOffset());
+        }
+    }
+
+    return BackendObjectPrivate::metacall(c, id, argv);
+}
+
+bool BackendModelPrivate::readClientProperty(const QByteArray &name, void *value)
+{
+    if (name == "asynchronous") {
+        *reinterpret_cast<bool*>(value) = m_asynchronous;
+    } else if (name == "cacheBudget") {
+        *reinterpret_cast<int*>(value) = int(qMin<qint64>(m_cacheBudget, INT_MAX));
+    } else if (name == "fetchRoles") {
+        QStringList names = m_fetchRoleNames;
+        if (m_modelData) {
+            names.clear();
+            for (int role : qAsConst(m_fetchRoles))
+                names.append(m_roleNames.value(role));
+        }
+        *reinterpret_cast<QStringList*>(value) = names;
+    } else if (name == "trackRoles") {
+        *reinterpret_cast<bool*>(value) = m_trackRoles;
+    } else if (name == "sortRole") {
+        *reinterpret_cast<QString*>(value) = m_sortRole;
+    } else if (name == "sortOrder") {
+        *reinterpret_cast<int*>(value) = m_sortOrder;
+    } else if (name == "filterRole") {
+        *reinterpret_cast<QString*>(value) = m_filterRole;
+    } else if (name == "filter") {
+        *reinterpret_cast<QString*>(value) = m_filter;
+    } else if (name == "statistics") {
+        *reinterpret_cast<QVariantMap*>(value) = statistics();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool BackendModelPrivate::writeClientProperty(const QByteArray &name, const void *value)
+{
+    if (name == "asynchronous") {
+        bool v = *reinterpret_cast<const bool*>(value);
+        if (m_asynchronous != v) {
+            m_asynchronous = v;
+            clientPropertyChanged("asynchronous");
+        }
+    } else if (name == "cacheBudget") {
+        int v = *reinterpret_cast<const int*>(value);
+        if (m_cacheBudget != v) {
+            m_cacheBudget = v;
+            clientPropertyChanged("cacheBudget");
+            cleanRowCache();
+        }
+    } else if (name == "fetchRoles") {
+        setFetchRoles(*reinterpret_cast<const QStringList*>(value));
+    } else if (name == "trackRoles") {
+        bool v = *reinterpret_cast<const bool*>(value);
+        if (m_trackRoles != v) {
+            m_trackRoles = v;
+            clientPropertyChanged("trackRoles");
+            if (m_modelData)
+                sendProjection();
+        }
+    } else if (name == "sortRole" || name == "filterRole" || name == "filter") {
+        const QString &v = *reinterpret_cast<const QString*>(value);
+        QString &member = name == "sortRole" ? m_sortRole : (name == "filterRole" ? m_filterRole : m_filter);
+        if (member != v) {
+            member = v;
+            clientPropertyChanged(name.constData());
+            sendSortFilter();
+        }
+    } else if (name == "sortOrder") {
+        Qt::SortOrder v = *reinterpret_cast<const int*>(value) == Qt::DescendingOrder ? Qt::DescendingOrder : Qt::AscendingOrder;
+        if (m_sortOrder != v) {
+            m_sortOrder = v;
+            clientPropertyChanged("sortOrder");
+            sendSortFilter();
+        }
+    } else if (name == "statistics") {
+        // Read-only
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Rows are found by the backend; see the _qb_model findRows method
+QJSValue BackendModelPrivate::findRows(const QString &role, const QJSValue &value)
+{
+    ensureModel();
+    if (!m_modelData)
+        return QJSValue();
+    // Rows from the backend include pending appends, so they must be applied first
+    flushAppends();
+
+    // An unknown role is rejected by the backend
+    QJSValue promise;
+    QMetaObject::invokeMethod(m_modelData, "findRows", Q_RETURN_ARG(QJSValue, promise),
+                              Q_ARG(int, m_roleNames.indexOf(role)), Q_ARG(QJSValue, value));
+    return promise;
+}
+
+void BackendModelPrivate::clientPropertyChanged(const char *name)
+{
+    int index = m_object->metaObject()->indexOfSignal(QByteArray(name) + "Changed()");
+    if (index >= 0)
+        QMetaObject::activate(m_object, index, nullptr);
+}
+
+// Counters are updated often, so the change signal is emitted at most once per event loop
+void BackendModelPrivate::countStatistic(Statistic statistic, int count)
+{
+    m_statistics[statistic] += count;
+    if (!m_statisticsPending) {
+        m_statisticsPending = true;
+        QTimer::singleShot(0, this, [this]() {
+            m_statisticsPending = false;
+            clientPropertyChanged("statistics");
+        });
+    }
+}
+
+QVariantMap BackendModelPrivate::statistics() const
+{
+    static const char *names[StatisticCount] = {
+        "blockingFetches",
+        "asyncFetches",
+        "prefetches",
+        "discardedFetches",
+        "cacheHits",
+        "cacheMisses",
+        "cacheEvictions",
+    };
+
+    QVariantMap map;
+    for (int i = 0; i < StatisticCount; i++)
+        map.insert(QString::fromLatin1(names[i]), m_statistics[i]);
+    map.insert("cachedRows", m_rowData.size());
+    map.insert("cacheBytes", m_cacheBytes);
+    return map;
+}
+
 /* The _qb_model object must implement:
  *
  * {
@@ -67,18 +295,31 @@ void QBackendModel::componentComplete()
  *     "batchSize": "int" // writable, max number of rows with data in a change/reset signal
  *   },
  *   "methods": {
- *     "reset": []
+ *     "reset": [],
+ *     "setSortFilter": [ "int sortRole", "bool descending", "int filterRole", "string filter" ],
+ *     "findRows": [ "int role", "var value" ] // returns a list of rows
  *   },
  *   "signals": {
- *     "modelReset": [ "array rowData", "int moreRows" ],
- *     "modelInsert": [ "int start", "array rowData", "int moreRows" ],
+ *     "modelReset": [ "rows rowData", "int moreRows" ],
+ *     "modelInsert": [ "int start", "rows rowData", "int moreRows" ],
  *     "modelRemove": [ "int start", "int end" ],
  *     "modelMove": [ "int start", "int end", "int destination" ],
- *     "modelUpdate": [ "int row", "var rowData" ],
- *     "modelRowData": [ "int start", "var rowData" ]
+ *     "modelUpdate": [ "int row", "rows rowData" ],
+ *     "modelRowData": [ "int start", "rows rowData" ],
+ *     "modelUpdateRange": [ "int start", "rows rowData", "intList roles" ],
+ *     "modelAppend": [ "rows rowData", "int moreRows", "int trimmed" ]
  *   }
  * }
  *
+ * rowData is an array of rows, and each row is an array of values by role. Rows are
+ * converted from JSON to a vector of QVariant once, when they arrive, so data() is
+ * only an index into the cache. modelUpdate has a single row in rowData.
+ *
+ * modelUpdateRange replaces only the values of roles in cached rows, or all values if
+ * roles is empty. Roles which aren't changed may be null or missing in rowData.
+ *
+ * modelAppend removes trimmed rows from the start and then appends rows at the end.
+ * Appends are applied to the model at most once per frame; see flushAppends.
  */
 
 void BackendModelPrivate::ensureModel()
@@ -99,16 +340,23 @@ void BackendModelPrivate::ensureModel()
         return;
     }
 
-    connect(m_modelData, SIGNAL(modelReset(QJSValue,int)), this, SLOT(doReset(QJSValue,int)));
-    connect(m_modelData, SIGNAL(modelInsert(int,QJSValue,int)), this, SLOT(doInsert(int,QJSValue,int)));
+    connect(m_modelData, SIGNAL(modelReset(QJsonArray,int)), this, SLOT(doReset(QJsonArray,int)));
+    connect(m_modelData, SIGNAL(modelInsert(int,QJsonArray,int)), this, SLOT(doInsert(int,QJsonArray,int)));
     connect(m_modelData, SIGNAL(modelRemove(int,int)), this, SLOT(doRemove(int,int)));
     connect(m_modelData, SIGNAL(modelMove(int,int,int)), this, SLOT(doMove(int,int,int)));
-    connect(m_modelData, SIGNAL(modelUpdate(int,QJSValue)), this, SLOT(doUpdate(int,QJSValue)));
-    connect(m_modelData, SIGNAL(modelRowData(int,QJSValue)), this, SLOT(doRowData(int,QJSValue)));
+    connect(m_modelData, SIGNAL(modelUpdate(int,QJsonArray)), this, SLOT(doUpdate(int,QJsonArray)));
+    connect(m_modelData, SIGNAL(modelRowData(int,QJsonArray)), this, SLOT(doRowData(int,QJsonArray)));
+    connect(m_modelData, SIGNAL(modelUpdateRange(int,QJsonArray,QVector<int>)), this, SLOT(doUpdateRange(int,QJsonArray,QVector<int>)));
+    connect(m_modelData, SIGNAL(modelAppend(QJsonArray,int,int)), this, SLOT(doAppend(QJsonArray,int,int)));
+    connect(m_modelData, SIGNAL(projectionChanged()), this, SLOT(doProjectionChanged()));
 
     if (m_batchSize > 0) {
         m_modelData->setProperty("batchSize", m_batchSize);
     }
+    m_accessTimer.start();
+    // The backend applies the projection before reset, so it doesn't need to be waited for
+    setFetchRoles(m_fetchRoleNames, true);
+    sendSortFilter(true);
     QMetaObject::invokeMethod(m_modelData, "reset");
 }
 
@@ -134,136 +382,552 @@ QVariant QBackendModel::data(const QModelIndex &index, int role) const
     if (index.row() < 0 || index.row() >= d->m_rowCount || role < Qt::UserRole)
         return QVariant();
 
-    const QJSValue &row = d->fetchRow(index.row());
-    QJSValue data = row.property(role - Qt::UserRole);
+    int column = role - Qt::UserRole;
+    if (!d->isRoleFetched(column)) {
+        // Blocks for the new projection unless asynchronous
+        d->fetchRole(column);
+        if (d->m_asynchronous)
+            return QVariant();
+    }
 
-    if (data.isQObject())
-        return QVariant::fromValue(data.toQObject());
-    else if ((data.isArray() || data.isObject()) && !data.isVariant())
-        return QVariant::fromValue(data);
-    else
-        return data.toVariant();
+    const BackendModelPrivate::RowData *row = d->fetchRow(index.row());
+    if (!row || column >= row->size())
+        return QVariant();
+
+    const QVariant &value = row->at(column);
+    if (value.userType() == QMetaType::QJsonValue)
+        return d->resolveCell(d, value);
+    return value;
 }
 
-QJSValue BackendModelPrivate::fetchRow(int row)
+// True if value is or contains a backend object
+static bool jsonHasObject(const QJsonValue &value)
 {
-    QJSValue data = m_rowData.value(row);
-    if (!data.isUndefined()) {
-        // rowData can grow in various ways other than by fetch requests, so
-        // check if it needs cleaning here too.
-        cleanRowCache(row);
-        return data;
+    if (value.isArray()) {
+        for (const QJsonValue &v : value.toArray()) {
+            if (jsonHasObject(v))
+                return true;
+        }
+    } else if (value.isObject()) {
+        QJsonObject object = value.toObject();
+        if (object.value("_qbackend_").toString() == "object")
+            return true;
+        for (const QJsonValue &v : object) {
+            if (jsonHasObject(v))
+                return true;
+        }
+    }
+    return false;
+}
+
+// Convert a row from the backend to RowData, returning false if it's not a valid row
+bool BackendModelPrivate::rowFromJson(const QJsonValue &value, RowData &row)
+{
+    if (!value.isArray())
+        return false;
+
+    const QJsonArray array = value.toArray();
+    row.clear();
+    row.reserve(array.size());
+    for (const QJsonValue &v : array)
+        row.append(cellFromJson(v));
+    return true;
+}
+
+// Objects can't be held by the cache; the QML engine may collect them. Values with objects
+// are kept as JSON and resolved for each read, which is cheap for objects that still exist.
+// Everything else is converted to its final QVariant here.
+QVariant BackendModelPrivate::cellFromJson(const QJsonValue &value)
+{
+    if (jsonHasObject(value))
+        return QVariant::fromValue(value);
+    return value.toVariant();
+}
+
+QVariant BackendModelPrivate::resolveCell(BackendObjectPrivate *d, const QVariant &value)
+{
+    QJsonValue json = value.value<QJsonValue>();
+    if (json.isObject() && json.toObject().value("_qbackend_").toString() == "object")
+        return QVariant::fromValue(d->m_connection->ensureObject(json.toObject()));
+    return QVariant::fromValue(d->jsonValueToJSValue(d->m_connection->qmlEngine(), json));
+}
+
+bool BackendModelPrivate::isRoleFetched(int role) const
+{
+    return m_projection.isEmpty() || std::binary_search(m_projection.constBegin(), m_projection.constEnd(), role);
+}
+
+// Add role to the projection for a read of a role that isn't fetched
+void BackendModelPrivate::fetchRole(int role)
+{
+    if (role < 0 || role >= m_roleNames.size() || m_fetchRoles.contains(role))
+        return;
+
+    qCDebug(lcModel) << "adding role" << m_roleNames.value(role) << "to fetched roles on demand";
+    if (m_fetchRoles.isEmpty() && !m_trackRoles) {
+        // Roles were already projected by the backend, so the list can't be empty
+        m_fetchRoles = m_projection;
     }
+    m_fetchRoles.insert(std::lower_bound(m_fetchRoles.begin(), m_fetchRoles.end(), role), role);
+    clientPropertyChanged("fetchRoles");
+    sendProjection();
+}
+
+void BackendModelPrivate::setFetchRoles(const QStringList &names, bool initial)
+{
+    m_fetchRoleNames = names;
+    if (!m_modelData)
+        return;
 
-    // Find the nearest populated rows before and after this row
-    int start = 0, end = m_rowCount-1;
-    auto it = m_rowData.lowerBound(row);
-    if (it != m_rowData.end() && it.key() == row) {
-        // There should not be undefined values in the map, but..
-        it = it++;
+    QVector<int> roles;
+    for (const QString &name : names) {
+        int role = m_roleNames.indexOf(name);
+        if (role < 0) {
+            qCWarning(lcModel) << "Model type" << m_object->metaObject()->className() << "has no role" << name << "to fetch";
+            continue;
+        }
+        if (!roles.contains(role))
+            roles.append(role);
     }
-    if (it != m_rowData.end()) {
-        end = it.key()-1;
+    std::sort(roles.begin(), roles.end());
+
+    if (roles != m_fetchRoles) {
+        m_fetchRoles = roles;
+        clientPropertyChanged("fetchRoles");
+        sendProjection(initial);
     }
-    if (it != m_rowData.begin()) {
-        it--;
-        start = it.key()+1;
+}
+
+// Send the projection to the backend. Rows received after projectionChanged are
+// projected, and cached rows are dropped at that point. Unless asynchronous, this
+// blocks until the backend has applied the projection.
+void BackendModelPrivate::sendProjection(bool initial)
+{
+    if (!m_modelData)
+        return;
+
+    auto send = [this]() -> bool {
+        m_projectionPending = false;
+        // An empty list is all roles; with trackRoles, nothing has been read yet
+        if (m_fetchRoles.isEmpty() && m_trackRoles)
+            return false;
+        QMetaObject::invokeMethod(m_modelData, "setProjection", Q_ARG(QVector<int>, m_fetchRoles));
+        return true;
+    };
+
+    if (initial) {
+        // Before the model is reset, the projection will apply to the first rows
+        send();
+        return;
+    } else if (m_asynchronous) {
+        // Several roles are usually read at once by a new delegate
+        if (!m_projectionPending) {
+            m_projectionPending = true;
+            QTimer::singleShot(0, this, [send]() { send(); });
+        }
+        return;
     }
 
-    if (m_batchSize > 0) {
-        const int half = m_batchSize/2;
-        if (start > row-half) {
-            end = qMin(end, start+m_batchSize);
-        } else if (end < row+half) {
-            start = qMax(start, end-m_batchSize);
-        } else {
-            start = qMax(start, row-half);
-            end = qMin(end, row+half);
+    if (!send())
+        return;
+    QString modelIdentifier = m_modelData->property("_qb_identifier").toString();
+    m_connection->waitForMessage("model_projection",
+        [&](const QJsonObject &msg) {
+            return msg.value("command").toString() == "OBJECT_RESET" &&
+                   msg.value("identifier").toString() == modelIdentifier;
+        }
+    );
+}
+
+// Send the sort and filter to the backend, which responds with the changes to rows.
+// Several properties are usually set together, so this is sent once per event loop.
+void BackendModelPrivate::sendSortFilter(bool initial)
+{
+    if (!m_modelData)
+        return;
+
+    auto send = [this]() {
+        m_sortFilterPending = false;
+        int sortRole = m_sortRole.isEmpty() ? -1 : m_roleNames.indexOf(m_sortRole);
+        int filterRole = m_filterRole.isEmpty() ? -1 : m_roleNames.indexOf(m_filterRole);
+        if (!m_sortRole.isEmpty() && sortRole < 0)
+            qCWarning(lcModel) << "Model type" << m_object->metaObject()->className() << "has no role" << m_sortRole << "to sort";
+        if (!m_filterRole.isEmpty() && filterRole < 0) {
+            qCWarning(lcModel) << "Model type" << m_object->metaObject()->className() << "has no role" << m_filterRole << "to filter";
+            // -1 would match any role; a role past the end of rows is always empty
+            filterRole = m_roleNames.size();
         }
+        QMetaObject::invokeMethod(m_modelData, "setSortFilter", Q_ARG(int, sortRole),
+                                  Q_ARG(bool, m_sortOrder == Qt::DescendingOrder),
+                                  Q_ARG(int, filterRole), Q_ARG(QString, m_filter));
+    };
+
+    if (initial) {
+        // Before the model is reset, the backend has nothing to send for this
+        if (!m_sortRole.isEmpty() || !m_filter.isEmpty())
+            send();
+    } else if (!m_sortFilterPending) {
+        m_sortFilterPending = true;
+        QTimer::singleShot(0, this, send);
+    }
+}
+
+void BackendModelPrivate::doProjectionChanged()
+{
+    m_projection = m_modelData->property("projection").value<QVector<int>>();
+    qCDebug(lcModel) << "backend projection changed to" << m_projection;
+
+    // Cached rows don't have the same roles, so they need to be fetched again
+    m_rowData.clear();
+    m_cacheBytes = 0;
+    invalidatePendingFetches();
+
+    // When not asynchronous, this is called from data(), and no values have changed
+    // that could have been read.
+    if (m_asynchronous && m_rowCount > 0)
+        queueDataChanged(0, m_rowCount-1);
+}
+
+// The range of rows to fetch for row, between the nearest cached rows, up to m_batchSize
+QPair<int,int> BackendModelPrivate::fetchWindow(int row) const
+{
+    return m_rowData.missingRange(row, m_rowCount, m_batchSize);
+}
+
+const BackendModelPrivate::RowData *BackendModelPrivate::fetchRow(int row)
+{
+    touchHotWindow(row);
+
+    if (const RowData *data = m_rowData.find(row)) {
+        countStatistic(CacheHits);
+        if (m_asynchronous)
+            prefetch(row);
+        // rowData can grow in various ways other than by fetch requests, so
+        // check if it needs cleaning here too. This row is in a hot window,
+        // so it isn't removed.
+        cleanRowCache();
+        return data;
+    }
+    countStatistic(CacheMisses);
+
+    // The backend has already removed rows before m_appendTrimmed
+    if (row < m_appendTrimmed)
+        return nullptr;
+
+    QPair<int,int> window = fetchWindow(row);
+    int start = qMax(window.first, m_appendTrimmed), end = window.second;
+
+    if (m_asynchronous) {
+        if (!isFetchPending(row)) {
+            qCDebug(lcModel) << "fetching rows" << start << "to" << end << "for row" << row;
+            requestRows(start, end);
+            countStatistic(AsyncFetches);
+        }
+        prefetch(row);
+        return nullptr;
     }
 
     qCDebug(lcModel) << "blocking to fetch rows" << start << "to" << end << "to get data for row" << row;
+    countStatistic(BlockingFetches);
 
-    QMetaObject::invokeMethod(m_modelData, "requestRows", Q_ARG(int, start), Q_ARG(int, end-start+1));
+    int backendStart = start - m_appendTrimmed;
+    QMetaObject::invokeMethod(m_modelData, "requestRows", Q_ARG(int, backendStart), Q_ARG(int, end-start+1));
+    QString modelIdentifier = m_modelData->property("_qb_identifier").toString();
     m_connection->waitForMessage("model_emit",
         [&](const QJsonObject &msg) {
-            return msg.value("command").toString() == "EMIT" &&
-                   msg.value("method").toString() == "modelRowData" &&
-                   msg.value("identifier").toString() == m_modelData->property("_qb_identifier").toString();
+            if (msg.value("command").toString() != "EMIT" || msg.value("identifier").toString() != modelIdentifier)
+                return false;
+            QString method = msg.value("method").toString();
+            QJsonArray parameters = msg.value("parameters").toArray();
+            if (method == "modelAppend") {
+                // Handled after the rows, which are from after the append
+                m_queuedAppendCount += parameters.at(0).toArray().size() + parameters.at(1).toInt();
+                m_queuedAppendTrimmed += parameters.at(2).toInt();
+                return false;
+            }
+            // Asynchronous requests may also be waiting, so match the start row as well
+            return method == "modelRowData" && parameters.at(0).toInt() == backendStart;
         }
     );
+    m_queuedAppendCount = m_queuedAppendTrimmed = 0;
 
     // This should have been filled in by the doRowData slot
-    data = m_rowData.value(row);
-    if (data.isUndefined()) {
+    const RowData *data = m_rowData.find(row);
+    if (!data) {
         qCWarning(lcModel) << "row has no data after synchronous fetch";
     }
     return data;
 }
 
-void BackendModelPrivate::cleanRowCache(int rowHint)
+// Request rows from start to end without blocking
+void BackendModelPrivate::requestRows(int start, int end)
+{
+    start = qMax(start, m_appendTrimmed);
+    if (end < start)
+        return;
+    int backendStart = start - m_appendTrimmed;
+    m_pendingFetches.append({start, end-start+1, m_accessTimer.elapsed(), false, backendStart});
+    QMetaObject::invokeMethod(m_modelData, "requestRows", Q_ARG(int, backendStart), Q_ARG(int, end-start+1));
+}
+
+bool BackendModelPrivate::isFetchPending(int row) const
+{
+    for (const PendingFetch &f : m_pendingFetches) {
+        if (!f.stale && row >= f.start && row < f.start + f.count)
+            return true;
+    }
+    return false;
+}
+
+// Called for any change in row positions. Requests that are still pending will be
+// discarded when they arrive, because they could no longer be placed correctly.
+void BackendModelPrivate::invalidatePendingFetches()
+{
+    for (PendingFetch &f : m_pendingFetches)
+        f.stale = true;
+    m_lastPrefetchBucket = -1;
+}
+
+// Fetch the next rows ahead of the direction of access, far enough to arrive before
+// they are needed at the current speed.
+void BackendModelPrivate::prefetch(int row)
+{
+    qint64 now = m_accessTimer.elapsed();
+    if (m_lastAccessTime >= 0 && row != m_lastAccessRow) {
+        double dt = qMax<qint64>(1, now - m_lastAccessTime);
+        double velocity = (row - m_lastAccessRow) * 1000.0 / dt;
+        // Smooth out the delegates of a single frame being created in any order
+        m_accessVelocity = 0.8 * m_accessVelocity + 0.2 * velocity;
+    }
+    m_lastAccessRow = row;
+    m_lastAccessTime = now;
+
+    // Only look for rows to prefetch once per half batch of movement
+    int batchSize = qMax(m_batchSize, 10);
+    int bucket = row / qMax(1, batchSize / 2);
+    if (bucket == m_lastPrefetchBucket || std::abs(m_accessVelocity) < 1)
+        return;
+    m_lastPrefetchBucket = bucket;
+
+    int direction = m_accessVelocity > 0 ? 1 : -1;
+    int lookahead = batchSize + int(std::abs(m_accessVelocity) * qMax(m_fetchLatency, 16.0) / 1000);
+    int limit = direction > 0 ? qMin(m_rowCount-1, row + lookahead) : qMax(0, row - lookahead);
+
+    // Find the first row in that direction which is neither cached nor pending
+    int target = -1;
+    for (int r = row + direction; direction > 0 ? r <= limit : r >= limit; r += direction) {
+        if (!m_rowData.contains(r) && !isFetchPending(r)) {
+            target = r;
+            break;
+        }
+    }
+    if (target < 0)
+        return;
+
+    int start, end;
+    if (direction > 0) {
+        int next = m_rowData.nextRow(target);
+        start = target;
+        end = qMin(target + batchSize - 1, next >= 0 ? next-1 : m_rowCount-1);
+    } else {
+        int previous = m_rowData.previousRow(target);
+        end = target;
+        start = qMax(target - batchSize + 1, previous >= 0 ? previous+1 : 0);
+    }
+
+    qCDebug(lcModel) << "prefetching rows" << start << "to" << end << "at velocity" << m_accessVelocity;
+    requestRows(start, end);
+    countStatistic(Prefetches);
+}
+
+// Rough size of a cached row, including the cache's own overhead
+qint64 BackendModelPrivate::estimateRowSize(const RowData &row)
+{
+    qint64 size = 64 + row.size() * sizeof(QVariant);
+    for (const QVariant &v : row) {
+        switch (v.userType()) {
+        case QMetaType::QString:
+            size += 32 + v.toString().size() * 2;
+            break;
+        case QMetaType::QByteArray:
+            size += 32 + v.toByteArray().size();
+            break;
+        case QMetaType::QVariantList:
+            size += 32 + v.toList().size() * 48;
+            break;
+        case QMetaType::QVariantMap:
+            size += 32 + v.toMap().size() * 96;
+            break;
+        case QMetaType::QJsonValue:
+            size += 128;
+            break;
+        default:
+            break;
+        }
+    }
+    return size;
+}
+
+void BackendModelPrivate::cacheRow(int row, const RowData &data)
+{
+    if (const RowData *existing = m_rowData.find(row))
+        m_cacheBytes -= estimateRowSize(*existing);
+    m_rowData.insert(row, data);
+    m_cacheBytes += estimateRowSize(data);
+}
+
+// Account for cached rows from start to end that are about to be removed
+void BackendModelPrivate::uncacheRows(int start, int end)
 {
-    if (m_cacheSize < 2)
+    for (int row = m_rowData.nextRow(start-1); row >= 0 && row <= end; row = m_rowData.nextRow(row))
+        m_cacheBytes -= estimateRowSize(*m_rowData.find(row));
+}
+
+// Extend the hot window containing row, or start a new one. Windows are merged
+// when reads are within a batch of them.
+void BackendModelPrivate::touchHotWindow(int row)
+{
+    const int maxWindows = 4;
+    const int slack = qMax(m_batchSize, 10);
+
+    for (int i = 0; i < m_hotWindows.size(); i++) {
+        HotWindow w = m_hotWindows[i];
+        if (row < w.first - slack || row > w.last + slack)
+            continue;
+        w.first = qMin(w.first, row);
+        w.last = qMax(w.last, row);
+        // A window only tracks the recent viewport, not everything that was ever read
+        if (w.last - w.first > 2*slack) {
+            if (row == w.last)
+                w.first = row - 2*slack;
+            else
+                w.last = row + 2*slack;
+        }
+        m_hotWindows.remove(i);
+        m_hotWindows.prepend(w);
         return;
+    }
+
+    m_hotWindows.prepend({row, row});
+    if (m_hotWindows.size() > maxWindows)
+        m_hotWindows.removeLast();
+}
+
+int BackendModelPrivate::hotWindowDistance(int row) const
+{
+    if (m_hotWindows.isEmpty())
+        return row;
+
+    int distance = INT_MAX;
+    for (const HotWindow &w : m_hotWindows) {
+        if (row < w.first)
+            distance = qMin(distance, w.first - row);
+        else if (row > w.last)
+            distance = qMin(distance, row - w.last);
+        else
+            return 0;
+    }
+    return distance;
+}
+
+void BackendModelPrivate::cleanRowCache()
+{
+    if (m_cacheBytes <= m_cacheBudget || m_rowData.isEmpty())
+        return;
+
+    // The rows furthest from any hot window are the first and last cached rows, and the
+    // rows closest to the middle of each space between windows.
+    QVector<int> gaps;
+    QVector<HotWindow> windows = m_hotWindows;
+    std::sort(windows.begin(), windows.end(), [](const HotWindow &a, const HotWindow &b) { return a.first < b.first; });
+    for (int i = 1; i < windows.size(); i++) {
+        if (windows[i].first > windows[i-1].last)
+            gaps.append((windows[i-1].last + windows[i].first) / 2);
+    }
 
-    // Remove the rows furthest from rowHint until under m_cacheSize
     int removed = 0;
-    while (m_rowData.size() > m_cacheSize) {
-        auto first = m_rowData.begin();
-        auto last = m_rowData.end()-1;
+    while (m_cacheBytes > m_cacheBudget && m_rowData.size() > 1) {
+        int victim = -1, victimDistance = -1;
+        auto consider = [&](int row) {
+            if (row < 0)
+                return;
+            int distance = hotWindowDistance(row);
+            if (distance > victimDistance) {
+                victim = row;
+                victimDistance = distance;
+            }
+        };
 
-        if (std::abs(rowHint-first.key()) >= std::abs(last.key()-rowHint)) {
-            m_rowData.erase(first);
-        } else {
-            m_rowData.erase(last);
+        consider(m_rowData.firstRow());
+        consider(m_rowData.lastRow());
+        for (int middle : qAsConst(gaps)) {
+            consider(m_rowData.nextRow(middle-1));
+            consider(m_rowData.previousRow(middle));
         }
+
+        // Never evict rows in a window
+        if (victimDistance <= 0)
+            break;
+
+        m_cacheBytes -= estimateRowSize(*m_rowData.find(victim));
+        m_rowData.erase(victim);
         removed++;
     }
 
     if (removed > 0) {
-        qCDebug(lcModel) << "cleaned" << removed << "rows from cache based on hint" << rowHint;
+        countStatistic(CacheEvictions, removed);
+        qCDebug(lcModel) << "cleaned" << removed << "rows from cache," << m_rowData.size() << "rows and" << m_cacheBytes << "bytes remain";
     }
 }
 
-void BackendModelPrivate::doReset(const QJSValue &data, int moreRows)
+void BackendModelPrivate::doReset(const QJsonArray &data, int moreRows)
 {
+    flushDataChanged();
     model()->beginResetModel();
     m_rowData.clear();
+    m_cacheBytes = 0;
+    // The reset includes any appends that are pending
+    m_appendCount = m_appendTrimmed = 0;
+    m_hotWindows.clear();
+    invalidatePendingFetches();
 
-    int size = data.property("length").toNumber();
+    int size = data.size();
+    RowData rowData;
     for (int i = 0; i < size; i++) {
-        QJSValue rowData = data.property(i);
-        if (!rowData.isArray()) {
+        if (!rowFromJson(data.at(i), rowData)) {
             qCWarning(lcModel) << "Model row" << i << "data is not an array";
             continue;
         }
-        m_rowData.insert(i, rowData);
+        cacheRow(i, rowData);
     }
     m_rowCount = size + moreRows;
 
     model()->endResetModel();
 }
 
-void BackendModelPrivate::doInsert(int start, const QJSValue &data, int moreRows)
+void BackendModelPrivate::doInsert(int start, const QJsonArray &data, int moreRows)
 {
-    int dataSize = data.property("length").toNumber();
+    flushAppends();
+    int dataSize = data.size();
     int size = dataSize + moreRows;
     if (size < 1)
         return;
 
+    flushDataChanged();
     model()->beginInsertRows(QModelIndex(), start, start + size - 1);
 
-    // Increment keys >= start by size
-    QMap<int,QJSValue> tmp;
-    for (auto it = m_rowData.lowerBound(start); it != m_rowData.end(); ) {
-        tmp.insert(it.key()+size, it.value());
-        it = m_rowData.erase(it);
-    }
-    m_rowData.unite(tmp);
+    // Shift rows >= start by size
+    m_rowData.insertRows(start, size);
+    invalidatePendingFetches();
 
     // Insert new row data
+    RowData rowData;
     for (int i = 0; i < dataSize; i++) {
-        m_rowData.insert(start+i, data.property(i));
+        if (!rowFromJson(data.at(i), rowData)) {
+            qCWarning(lcModel) << "Model row" << start+i << "data is not an array in insert";
+            continue;
+        }
+        cacheRow(start+i, rowData);
     }
 
     m_rowCount += size;
@@ -272,106 +936,232 @@ void BackendModelPrivate::doInsert(int start, const QJSValue &data, int moreRows
 
 void BackendModelPrivate::doRemove(int start, int end)
 {
+    flushAppends();
+    flushDataChanged();
     model()->beginRemoveRows(QModelIndex(), start, end);
 
-    // Remove keys between start and end, and decrement all keys after
+    // Remove rows between start and end, and shift all rows after
     int size = end-start+1;
-    for (auto it = m_rowData.lowerBound(start); it != m_rowData.end(); ) {
-        if (it.key() > end) {
-            // Copy to the new row number. This loop runs from start to the end of
-            // the map, keys are only decremented evenly, and no key is decremented below
-            // start. Under those constraints, the new key will always be just before
-            // 'it'. That's useful as an insert hint, and to keep the loop position.
-            it = m_rowData.insert(it, it.key()-size, it.value());
-            // Increment back to the old index for the row
-            it++;
-        }
-        it = m_rowData.erase(it);
-    }
+    uncacheRows(start, end);
+    m_rowData.removeRows(start, size);
+    invalidatePendingFetches();
     m_rowCount -= size;
     model()->endRemoveRows();
 }
 
 void BackendModelPrivate::doMove(int start, int end, int destination)
 {
+    flushAppends();
+    flushDataChanged();
     model()->beginMoveRows(QModelIndex(), start, end, QModelIndex(), destination);
 
-    int size = end-start+1;
-    QMap<int,QJSValue> moveData;
-    for (auto it = m_rowData.begin(); it != m_rowData.end(); ) {
-        auto i = it.key();
-        if (i >= start && i <= end) {
-            // Copy moved rows to moveData and remove from rowData
-            if (destination < start) {
-                // When moving up, row 'start' becomes row 'destination'
-                moveData.insert(i-start+destination, it.value());
-            } else {
-                // When moving down, row 'end' becomes row 'destination-1'
-                moveData.insert(destination-end-1+i, it.value());
-            }
-            it = m_rowData.erase(it);
-        } else if (i < start && i < destination) {
-            // Rows before start or destination do not change
-            it++;
-        } else if (destination < start) {
-            if (i > end) {
-                // Rows moved up, but the source was above too. Nothing to do.
-                break;
-            } else {
-                // Rows moved up, and i is between destination and start. Shift down.
-                // This shift is not safe to do in-place, because it could overwrite
-                // an index that hasn't been updated yet. Use moveData for these.
-                moveData.insert(i+size, it.value());
-                it = m_rowData.erase(it);
-            }
-        } else {
-            if (i >= destination) {
-                // Rows moved down, with the last new row being destination-1 and the
-                // source rows above that. Remaining rows are unchanged.
-                break;
-            } else {
-                // Rows moved down, from before i to after i. Shift up.
-                // Unlike above, this is safe to do in-place. Like the loop in doRemove,
-                // it's safe to assume that the new row is immediately before this row.
-                it = m_rowData.insert(it, i-size, it.value());
-                it++;
-                it = m_rowData.erase(it);
-            }
-        }
-    }
-    m_rowData.unite(moveData);
+    m_rowData.moveRows(start, end, destination);
+    invalidatePendingFetches();
 
     model()->endMoveRows();
 }
 
-void BackendModelPrivate::doUpdate(int row, const QJSValue &data)
+void BackendModelPrivate::doUpdate(int row, const QJsonArray &data)
 {
-    if (row < 0 || row >= m_rowCount) {
+    flushAppends();
+    RowData rowData;
+    if (row < 0 || row >= m_rowCount || !rowFromJson(data.at(0), rowData)) {
         qCWarning(lcModel) << "invalid row" << row << "in model update";
         return;
     }
 
-    m_rowData[row] = data;
-    emit model()->dataChanged(model()->index(row), model()->index(row));
+    cacheRow(row, rowData);
+    queueDataChanged(row, row);
 }
 
-void BackendModelPrivate::doRowData(int start, const QJSValue &data)
+void BackendModelPrivate::doRowData(int start, const QJsonArray &data)
 {
-    int size = data.property("length").toNumber();
-    if (start < 0 || size < 1 || start+size > m_rowCount) {
+    int size = data.size();
+
+    // Match asynchronous requests; anything else is from a blocking fetch
+    bool async = false;
+    for (int i = 0; i < m_pendingFetches.size(); i++) {
+        const PendingFetch f = m_pendingFetches[i];
+        if (f.backendStart != start)
+            continue;
+        m_pendingFetches.remove(i);
+        if (f.stale) {
+            qCDebug(lcModel) << "discarding rows" << start << "to" << start+size-1 << "because rows have moved";
+            countStatistic(DiscardedFetches);
+            return;
+        }
+        m_fetchLatency = 0.7 * m_fetchLatency + 0.3 * (m_accessTimer.elapsed() - f.requested);
+        async = true;
+        break;
+    }
+
+    // This can't apply pending appends, because it may be called from a blocking fetch
+    // in data(). Rows are cached in the same positions as appended rows instead.
+    start += m_appendTrimmed + m_queuedAppendTrimmed;
+    if (start < 0 || size < 1 || start+size > m_rowCount+m_appendCount+m_queuedAppendCount) {
         qCWarning(lcModel) << "invalid rowData for" << size << "rows starting from" << start;
         return;
     }
 
+    RowData rowData;
     for (int i = 0; i < size; i++) {
-        QJSValue rowData = data.property(i);
-        if (!rowData.isArray()) {
+        if (!rowFromJson(data.at(i), rowData)) {
             qCWarning(lcModel) << "Model row" << start+i << "data is not an array in rowData";
             continue;
         }
-        m_rowData.insert(start+i, rowData);
+        cacheRow(start+i, rowData);
     }
 
     qCDebug(lcModel) << "populated rows" << start << "to" << start+size-1;
-    cleanRowCache(start+(size/2));
+    cleanRowCache();
+
+    if (async && start < m_rowCount)
+        queueDataChanged(start, qMin(start+size, m_rowCount)-1);
+}
+
+void BackendModelPrivate::doUpdateRange(int start, const QJsonArray &data, const QVector<int> &roles)
+{
+    flushAppends();
+    int size = data.size();
+    if (start < 0 || size < 1 || start+size > m_rowCount) {
+        qCWarning(lcModel) << "invalid range update for" << size << "rows starting from" << start;
+        return;
+    }
+
+    RowData update;
+    for (int i = 0; i < size; i++) {
+        // Rows that aren't cached will have the new values when they are fetched
+        const RowData *cached = m_rowData.find(start+i);
+        if (!cached)
+            continue;
+        if (!rowFromJson(data.at(i), update)) {
+            qCWarning(lcModel) << "Model row" << start+i << "data is not an array in range update";
+            continue;
+        }
+
+        if (roles.isEmpty()) {
+            cacheRow(start+i, update);
+        } else {
+            RowData row = *cached;
+            for (int role : roles) {
+                if (role < 0 || role >= m_roleNames.size())
+                    continue;
+                if (row.size() <= role)
+                    row.resize(role+1);
+                row[role] = update.value(role);
+            }
+            cacheRow(start+i, row);
+        }
+    }
+
+    QVector<int> qtRoles;
+    qtRoles.reserve(roles.size());
+    for (int role : roles)
+        qtRoles.append(Qt::UserRole + role);
+    queueDataChanged(start, start+size-1, qtRoles);
+}
+
+void BackendModelPrivate::queueDataChanged(int first, int last, const QVector<int> &roles)
+{
+    if (m_dataChanges.isEmpty())
+        QTimer::singleShot(0, this, &BackendModelPrivate::flushDataChanged);
+
+    // The common case of consecutive updates is merged here, and others when flushed
+    if (!m_dataChanges.isEmpty()) {
+        DataChange &prev = m_dataChanges.last();
+        if (prev.roles == roles && first <= prev.last+1 && last >= prev.first-1) {
+            prev.first = qMin(prev.first, first);
+            prev.last = qMax(prev.last, last);
+            return;
+        }
+    }
+    m_dataChanges.append({first, last, roles});
+}
+
+void BackendModelPrivate::flushDataChanged()
+{
+    if (m_dataChanges.isEmpty())
+        return;
+
+    // Merge overlapping or adjacent ranges that have the same roles
+    QVector<DataChange> changes;
+    changes.swap(m_dataChanges);
+    std::sort(changes.begin(), changes.end(), [](const DataChange &a, const DataChange &b) {
+        if (a.roles != b.roles)
+            return a.roles < b.roles;
+        return a.first < b.first;
+    });
+
+    int emitted = 0;
+    for (int i = 0; i < changes.size(); ) {
+        DataChange change = changes[i];
+        for (i++; i < changes.size() && changes[i].roles == change.roles && changes[i].first <= change.last+1; i++)
+            change.last = qMax(change.last, changes[i].last);
+        emit model()->dataChanged(model()->index(change.first), model()->index(change.last), change.roles);
+        emitted++;
+    }
+
+    qCDebug(lcModel) << "emitted" << emitted << "dataChanged for" << changes.size() << "updates";
+}
+
+void BackendModelPrivate::doAppend(const QJsonArray &data, int moreRows, int trimmed)
+{
+    int size = data.size() + moreRows;
+    if (size < 1 && trimmed < 1)
+        return;
+
+    // Appended rows are cached after the rows that are already pending
+    int start = m_rowCount + m_appendCount;
+    RowData rowData;
+    for (int i = 0; i < data.size(); i++) {
+        if (!rowFromJson(data.at(i), rowData)) {
+            qCWarning(lcModel) << "Model row" << start+i << "data is not an array in append";
+            continue;
+        }
+        cacheRow(start+i, rowData);
+    }
+    m_appendCount += size;
+    m_appendTrimmed += trimmed;
+
+    if (!m_appendPending) {
+        m_appendPending = true;
+        QTimer::singleShot(16, this, &BackendModelPrivate::flushAppends);
+    }
+}
+
+// Apply pending appends as one removal of trimmed rows and one insertion. This must
+// happen before any other change from the backend, which has the appends applied.
+void BackendModelPrivate::flushAppends()
+{
+    m_appendPending = false;
+    if (m_appendCount == 0 && m_appendTrimmed == 0)
+        return;
+
+    // Appended rows that were also trimmed are never added to the model
+    int trimmed = qMin(m_appendTrimmed, m_rowCount);
+    int dropped = m_appendTrimmed - trimmed;
+    int appended = m_appendCount - dropped;
+    m_appendCount = m_appendTrimmed = 0;
+
+    flushDataChanged();
+    if (trimmed > 0) {
+        model()->beginRemoveRows(QModelIndex(), 0, trimmed-1);
+        uncacheRows(0, trimmed-1);
+        m_rowData.removeRows(0, trimmed);
+        invalidatePendingFetches();
+        m_rowCount -= trimmed;
+        model()->endRemoveRows();
+    }
+    if (dropped > 0) {
+        uncacheRows(m_rowCount, m_rowCount+dropped-1);
+        m_rowData.removeRows(m_rowCount, dropped);
+    }
+    if (appended > 0) {
+        model()->beginInsertRows(QModelIndex(), m_rowCount, m_rowCount+appended-1);
+        m_rowCount += appended;
+        model()->endInsertRows();
+    }
+
+    qCDebug(lcModel) << "appended" << appended << "rows and trimmed" << trimmed << "rows";
+    cleanRowCache();
 }
@@ -2,9 +2,12 @@
 
 #include "qbackendobject_p.h"
 #include "qbackendmodel.h"
+#include "rowcache.h"
 #include <QVariant>
 #include <QVector>
-#include <QJSValue>
+#include <QJsonArray>
+#include <QElapsedTimer>
+#include <QVariantMap>
 
 class BackendModelPrivate : public BackendObjectPrivate
 {
@@ -13,23 +16,154 @@ class BackendModelPrivate : public BackendObjectPrivate
 public:
     using BackendObjectPrivate::BackendObjectPrivate;
 
+    // Values for each role in a row. Values containing objects are stored as
+    // QJsonValue and resolved when read; see cellFromJson.
+    typedef QVector<QVariant> RowData;
+
     QObject *m_modelData = nullptr;
     QStringList m_roleNames;
-    QMap<int,QJSValue> m_rowData;
+    RowCache<RowData> m_rowData;
     int m_rowCount = 0;
     int m_batchSize = 100;
-    int m_cacheSize = 1000;
+    // Estimated bytes of cached rows, which is kept under m_cacheBudget
+    qint64 m_cacheBytes = 0;
+    qint64 m_cacheBudget = 4 * 1024 * 1024;
+
+    // Properties implemented by the client, which are added to the metaobject
+    // of model types by metaObjectFromType.
+    struct ClientProperty
+    {
+        const char *name;
+        const char *type;
+        bool writable;
+    };
+    static const QVector<ClientProperty> &clientProperties();
+    int metacall(QMetaObject::Call c, int id, void **argv);
+    bool readClientProperty(const QByteArray &name, void *value);
+    bool writeClientProperty(const QByteArray &name, const void *value);
+    void clientPropertyChanged(const char *name);
+    QJSValue findRows(const QString &role, const QJSValue &value);
+
+    // Asynchronous fetching; data() returns invalid values for rows that aren't cached
+    // and dataChanged is emitted when they arrive.
+    struct PendingFetch
+    {
+        int start;
+        int count;
+        qint64 requested;
+        // Rows have moved since the request, so the data is no longer at start
+        bool stale;
+        // Start in the request, which is before start while trimmed rows are pending
+        int backendStart;
+    };
+    bool m_asynchronous = false;
+    QVector<PendingFetch> m_pendingFetches;
+    void requestRows(int start, int end);
+    bool isFetchPending(int row) const;
+    void invalidatePendingFetches();
+
+    // Prefetching follows the velocity of row access, in rows per second
+    QElapsedTimer m_accessTimer;
+    qint64 m_lastAccessTime = -1;
+    int m_lastAccessRow = -1;
+    int m_lastPrefetchBucket = -1;
+    double m_accessVelocity = 0;
+    // Milliseconds between requesting and receiving rows
+    double m_fetchLatency = 0;
+    void prefetch(int row);
+
+    enum Statistic {
+        BlockingFetches,
+        AsyncFetches,
+        Prefetches,
+        DiscardedFetches,
+        CacheHits,
+        CacheMisses,
+        CacheEvictions,
+        StatisticCount
+    };
+    int m_statistics[StatisticCount] = {};
+    bool m_statisticsPending = false;
+    void countStatistic(Statistic statistic, int count = 1);
+    QVariantMap statistics() const;
+
+    // Ranges of rows recently read through data(), most recent first. Rows near any
+    // of these are the last to be evicted from the cache.
+    struct HotWindow
+    {
+        int first;
+        int last;
+    };
+    QVector<HotWindow> m_hotWindows;
+    void touchHotWindow(int row);
+    int hotWindowDistance(int row) const;
+
+    static qint64 estimateRowSize(const RowData &row);
+    void cacheRow(int row, const RowData &data);
+    void uncacheRows(int start, int end);
+
+    // Role projection; see fetchRoles. m_fetchRoles is requested, and m_projection is
+    // what the backend has acknowledged. Both are sorted role indexes.
+    bool m_trackRoles = false;
+    QStringList m_fetchRoleNames;
+    QVector<int> m_fetchRoles;
+    QVector<int> m_projection;
+    bool m_projectionPending = false;
+    bool isRoleFetched(int role) const;
+    void fetchRole(int role);
+    void setFetchRoles(const QStringList &names, bool initial = false);
+    void sendProjection(bool initial = false);
+
+    // Sorting and filtering are done by the backend, which sends the changes to rows
+    QString m_sortRole;
+    Qt::SortOrder m_sortOrder = Qt::AscendingOrder;
+    QString m_filterRole;
+    QString m_filter;
+    bool m_sortFilterPending = false;
+    void sendSortFilter(bool initial = false);
+
+    // dataChanged is coalesced and emitted once per event loop, and before any
+    // structural change. Roles are Qt roles, and empty for all roles.
+    struct DataChange
+    {
+        int first;
+        int last;
+        QVector<int> roles;
+    };
+    QVector<DataChange> m_dataChanges;
+    void queueDataChanged(int first, int last, const QVector<int> &roles = QVector<int>());
+    void flushDataChanged();
+
+    // Appends from a LogModel are applied at most once per frame. Until then, appended
+    // rows are cached after m_rowCount, and the backend has already removed the first
+    // m_appendTrimmed rows, so backend rows are offset by that much.
+    int m_appendCount = 0;
+    int m_appendTrimmed = 0;
+    bool m_appendPending = false;
+    // Appends that arrived during a blocking fetch, and are handled after it
+    int m_queuedAppendCount = 0;
+    int m_queuedAppendTrimmed = 0;
+    void flushAppends();
 
     QBackendModel *model() { return static_cast<QBackendModel*>(m_object); }
     void ensureModel();
-    QJSValue fetchRow(int row);
-    void cleanRowCache(int rowHint);
+    QPair<int,int> fetchWindow(int row) const;
+    const RowData *fetchRow(int row);
+    void cleanRowCache();
+
+    // Also used by QBackendTreeModel
+    static bool rowFromJson(const QJsonValue &value, RowData &row);
+    static QVariant cellFromJson(const QJsonValue &value);
+    static QVariant resolveCell(BackendObjectPrivate *d, const QVariant &value);
 
 public slots:
-    void doReset(const QJSValue &data, int moreRows);
-    void doInsert(int start, const QJSValue &data, int moreRows);
+    void doReset(const QJsonArray &data, int moreRows);
+    void doInsert(int start, const QJsonArray &data, int moreRows);
     void doRemove(int start, int end);
     void doMove(int start, int end, int destination);
-    void doUpdate(int row, const QJSValue &data);
-    void doRowData(int row, const QJSValue &data);
+    void doUpdate(int row, const QJsonArray &data);
+    void doRowData(int row, const QJsonArray &data);
+    void doUpdateRange(int start, const QJsonArray &data, const QVector<int> &roles);
+    void doAppend(const QJsonArray &data, int moreRows, int trimmed);
+    void doProjectionChanged();
 };
@@ -0,0 +1,61 @@
+#include <QDebug>
+#include <QLoggingCategory>
+
+#include "qbackendmultiplexer.h"
+#include "qbackendconnection.h"
+
+Q_DECLARE_LOGGING_CATEGORY(lcConnection)
+
+QBackendMultiplexer::QBackendMultiplexer(QObject *parent)
+    : QObject(parent)
+{
+}
+
+QStringList QBackendMultiplexer::shards() const
+{
+    return m_shards.keys();
+}
+
+QObject *QBackendMultiplexer::object(const QByteArray &identifier) const
+{
+    QBackendConnection *c = connection(identifier);
+    return c ? c->object(identifier) : nullptr;
+}
+
+QBackendConnection *QBackendMultiplexer::connection(const QByteArray &identifier) const
+{
+    int p = identifier.indexOf('/');
+    if (p < 1)
+        return nullptr;
+    return m_shards.value(QString::fromUtf8(identifier.left(p)));
+}
+
+void QBackendMultiplexer::addShard(const QString &shard, QBackendConnection *connection)
+{
+    QBackendConnection *existing = m_shards.value(shard);
+    if (existing == connection)
+        return;
+    if (existing) {
+        qCWarning(lcConnection) << "Backend shard" << shard << "is used by connections" << existing << "and" << connection;
+        return;
+    }
+
+    qCDebug(lcConnection) << "Added backend shard" << shard << "on connection" << connection;
+    m_shards.insert(shard, connection);
+    emit shardsChanged();
+}
+
+void QBackendMultiplexer::removeConnection(QBackendConnection *connection)
+{
+    bool changed = false;
+    for (auto it = m_shards.begin(); it != m_shards.end(); ) {
+        if (!*it || *it == connection) {
+            it = m_shards.erase(it);
+            changed = true;
+        } else {
+            ++it;
+        }
+    }
+    if (changed)
+        emit shardsChanged();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QPointer>
+#include <QStringList>
+
+class QBackendConnection;
+
+// QBackendMultiplexer lets one QML engine use several backends, each with its
+// own BackendConnection or BackendProcess. Each backend is a shard with a name
+// (Connection.Shard in the Go backend), and the identifiers of its objects are
+// prefixed with "<shard>/". When any connection encounters an object of another
+// shard, it is created by and talks to the connection of that shard, so
+// objects can reference each other across backends.
+//
+//   BackendMultiplexer { id: backends }
+//   BackendProcess { multiplexer: backends; name: "./main" }
+//   BackendProcess { multiplexer: backends; name: "./worker" }
+class QBackendMultiplexer : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QStringList shards READ shards NOTIFY shardsChanged)
+
+public:
+    QBackendMultiplexer(QObject *parent = nullptr);
+
+    QStringList shards() const;
+    Q_INVOKABLE QObject *object(const QByteArray &identifier) const;
+
+    // The connection of the shard that owns identifier, if it is known
+    QBackendConnection *connection(const QByteArray &identifier) const;
+
+    void addShard(const QString &shard, QBackendConnection *connection);
+    void removeConnection(QBackendConnection *connection);
+
+signals:
+    void shardsChanged();
+
+private:
+    QHash<QString,QPointer<QBackendConnection>> m_shards;
+};
@@ -10,9 +10,12 @@
 #include <QQmlEngine>
 #include <QJSValueIterator>
 #include <QUuid>
+#include <QDateTime>
+#include <QVector>
 #include <QtCore/private/qmetaobjectbuilder_p.h>
 #include "qbackendobject.h"
 #include "qbackendobject_p.h"
+#include "qbackendmodel_p.h"
 #include "qbackendconnection.h"
 #include "promise.h"
 
@@ -20,6 +23,7 @@ Q_LOGGING_CATEGORY(lcObject, "backend.object")
 
 template<typename T> static void *copyMetaArg(QMetaType::Type type, void *p, const T &v);
 QJsonValue jsValueToJsonValue(const QJSValue &value);
+static QJsonObject objectReference(const QObject *object, const QString &identifier);
 
 // Create a dummy staticMetaObject that provides at least the correct type name
 QMetaObject QBackendObject::staticMetaObject =
@@ -199,11 +203,56 @@ void BackendObjectPrivate::componentComplete()
     }
 }
 
+// Compare JSON values, treating object references as equal if they have the same identifier
+static bool jsonValueEqual(const QJsonValue &a, const QJsonValue &b)
+{
+    if (a.type() != b.type())
+        return false;
+
+    if (a.isArray()) {
+        QJsonArray aa = a.toArray(), ba = b.toArray();
+        if (aa.size() != ba.size())
+            return false;
+        for (int i = 0; i < aa.size(); i++) {
+            if (!jsonValueEqual(aa[i], ba[i]))
+                return false;
+        }
+        return true;
+    } else if (a.isObject()) {
+        QJsonObject ao = a.toObject(), bo = b.toObject();
+        if (ao.value("_qbackend_").toString() == "object" && bo.value("_qbackend_").toString() == "object") {
+            // The type description may be omitted in either
+            return ao.value("identifier") == bo.value("identifier");
+        }
+        if (ao.size() != bo.size())
+            return false;
+        for (auto it = ao.constBegin(); it != ao.constEnd(); it++) {
+            if (!jsonValueEqual(it.value(), bo.value(it.key())))
+                return false;
+        }
+        return true;
+    }
+
+    return a == b;
+}
+
 void BackendObjectPrivate::resetData(const QJsonObject& object)
 {
     qCDebug(lcObject) << "Resetting " << m_identifier << " to " << object;
+    QJsonObject oldData = m_dataObject;
+    bool hadData = m_dataReady;
     m_dataObject = object;
     m_dataReady = true;
+    m_dataPending = false;
+
+    // Converted values are only kept for properties that haven't changed
+    for (auto it = m_nativeValues.begin(); it != m_nativeValues.end(); ) {
+        QString name = QString::fromUtf8(it.key());
+        if (jsonValueEqual(oldData.value(name), m_dataObject.value(name)))
+            ++it;
+        else
+            it = m_nativeValues.erase(it);
+    }
 
     // Don't emit signals for the initial query of properties; nothing could
     // have read properties before this, so it's meaningless to say that they
@@ -216,19 +265,22 @@ void BackendObjectPrivate::resetData(const QJsonObject& object)
         return;
     }
 
-    // XXX Do something smarter than signaling for every property
-    // XXX This is also wrong: any properties in the old m_dataObject that
-    // aren't in object have also changed.
+    // If there was data before, only signal properties that changed, including
+    // any that are no longer present.
     const QMetaObject *metaObject = m_object->metaObject();
-    for (auto it = m_dataObject.constBegin(); it != m_dataObject.constEnd(); it++) {
-        int index = metaObject->indexOfProperty(it.key().toUtf8());
-        if (index < 0)
-            continue;
-        QMetaProperty property = metaObject->property(index);
+    for (int i = metaObject->propertyOffset(); i < metaObject->propertyCount(); i++) {
+        QMetaProperty property = metaObject->property(i);
         int notifyIndex = property.notifySignalIndex();
-        if (notifyIndex >= 0) {
-            QMetaObject::activate(m_object, notifyIndex, nullptr);
+        if (notifyIndex < 0)
+            continue;
+        QString name = QString::fromUtf8(property.name());
+        if (hadData) {
+            if (jsonValueEqual(oldData.value(name), m_dataObject.value(name)))
+                continue;
+        } else if (!m_dataObject.contains(name)) {
+            continue;
         }
+        QMetaObject::activate(m_object, notifyIndex, nullptr);
     }
 }
 
@@ -244,14 +296,26 @@ int BackendObjectPrivate::metacall(QMetaObject::Call c, int id, void **argv)
         if (property.name() == QByteArray("_qb_identifier")) {
             jsonValueToMetaArgs(QMetaType::QString, QJsonValue(QString(m_identifier)), argv[0]);
         } else {
-            if (!m_dataReady) {
+            if (!m_dataReady && !m_dataPending) {
                 qCDebug(lcObject) << "Blocking to load data for object" << m_identifier << "from read of property" << property.name();
                 m_waitingForData = true;
                 m_connection->resetObjectData(m_identifier, true);
                 m_waitingForData = false;
             }
 
-            jsonValueToMetaArgs(static_cast<QMetaType::Type>(property.userType()), m_dataObject.value(property.name()), argv[0]);
+            auto type = static_cast<QMetaType::Type>(property.userType());
+            if (isNativeType(type)) {
+                // Convert once, instead of building the list on every read
+                auto it = m_nativeValues.constFind(property.name());
+                if (it == m_nativeValues.constEnd()) {
+                    void *value = jsonValueToMetaArgs(type, m_dataObject.value(property.name()));
+                    it = m_nativeValues.insert(property.name(), QVariant(type, value));
+                    QMetaType::destroy(type, value);
+                }
+                QMetaType::construct(type, argv[0], it->constData());
+            } else {
+                jsonValueToMetaArgs(type, m_dataObject.value(property.name()), argv[0]);
+            }
         }
 
         id -= count;
@@ -288,9 +352,27 @@ int BackendObjectPrivate::metacall(QMetaObject::Call c, int id, void **argv)
                 case QMetaType::Int:
                     args.append(QJsonValue(*reinterpret_cast<int*>(argv[i+1])));
                     break;
+                case QMetaType::LongLong:
+                    args.append(QJsonValue(*reinterpret_cast<qint64*>(argv[i+1])));
+                    break;
                 case QMetaType::QString:
                     args.append(QJsonValue(*reinterpret_cast<QString*>(argv[i+1])));
                     break;
+                case QMetaType::QStringList:
+                    args.append(QJsonArray::fromStringList(*reinterpret_cast<QStringList*>(argv[i+1])));
+                    break;
+                case QMetaType::QByteArray:
+                    args.append(QString::fromLatin1(reinterpret_cast<QByteArray*>(argv[i+1])->toBase64()));
+                    break;
+                case QMetaType::QDateTime:
+                    {
+                        const QDateTime &dt = *reinterpret_cast<QDateTime*>(argv[i+1]);
+                        if (dt.isValid())
+                            args.append(dt.toUTC().toString(Qt::ISODateWithMs));
+                        else
+                            args.append(QJsonValue());
+                    }
+                    break;
                 case QMetaType::QVariant:
                     args.append(reinterpret_cast<QVariant*>(argv[i+1])->toJsonValue());
                     break;
@@ -300,13 +382,23 @@ int BackendObjectPrivate::metacall(QMetaObject::Call c, int id, void **argv)
                     } else {
                         QString id = (*reinterpret_cast<QObject**>(argv[i+1]))->property("_qb_identifier").toString();
                         if (!id.isEmpty()) {
-                            args.append(QJsonObject{{"_qbackend_", "object"}, {"identifier", id}});
+                            args.append(objectReference(*reinterpret_cast<QObject**>(argv[i+1]), id));
                         }
                     }
                     break;
                 default:
                     if (method.parameterType(i) == QMetaType::type("QJSValue")) {
                         args.append(jsValueToJsonValue(*reinterpret_cast<QJSValue*>(argv[i+1])));
+                    } else if (method.parameterType(i) == qMetaTypeId<QVector<double>>()) {
+                        QJsonArray list;
+                        for (double v : *reinterpret_cast<QVector<double>*>(argv[i+1]))
+                            list.append(v);
+                        args.append(list);
+                    } else if (method.parameterType(i) == qMetaTypeId<QVector<int>>()) {
+                        QJsonArray list;
+                        for (int v : *reinterpret_cast<QVector<int>*>(argv[i+1]))
+                            list.append(v);
+                        args.append(list);
                     } else {
                         // XXX
                     }
@@ -371,6 +463,22 @@ QJSValue BackendObjectPrivate::jsonValueToJSValue(QJSEngine *engine, const QJson
     }
 }
 
+// Objects are passed to the backend by identifier. Objects of a shard (see
+// QBackendMultiplexer) may be passed to a different backend, which can't know
+// their type, so the name of the type is included; the connection of the shard
+// will find the full type in its cache if it needs to create the object again.
+static QJsonObject objectReference(const QObject *object, const QString &identifier)
+{
+    QJsonObject ref{{"_qbackend_", "object"}, {"identifier", identifier}};
+    if (identifier.indexOf('/') > 0) {
+        ref.insert("type", QJsonObject{
+            {"name", QString::fromUtf8(object->metaObject()->className())},
+            {"omitted", true}
+        });
+    }
+    return ref;
+}
+
 QJsonValue jsValueToJsonValue(const QJSValue &value)
 {
     if (value.isQObject()) {
@@ -381,7 +489,7 @@ QJsonValue jsValueToJsonValue(const QJSValue &value)
 
         QString id = object->property("_qb_identifier").toString();
         if (!id.isEmpty()) {
-            return QJsonObject{{"_qbackend_", "object"}, {"identifier", id}};
+            return objectReference(object, id);
         } else {
             // XXX warn about passing non-backend objects
             return QJsonValue(QJsonValue::Undefined);
@@ -416,6 +524,14 @@ QJsonValue jsValueToJsonValue(const QJSValue &value)
     }
 }
 
+// Types that are expensive to convert from JSON, which are kept in m_nativeValues
+bool BackendObjectPrivate::isNativeType(int type)
+{
+    return type == QMetaType::QStringList || type == QMetaType::QByteArray ||
+        type == QMetaType::QDateTime || type == qMetaTypeId<QVector<int>>() ||
+        type == qMetaTypeId<QVector<double>>();
+}
+
 // Construct a copy of 'v' (which is type 'type') at 'p', or allocate if 'p' is nullptr
 template<typename T> static void *copyMetaArg(QMetaType::Type type, void *p, const T &v)
 {
@@ -441,14 +557,40 @@ void *BackendObjectPrivate::jsonValueToMetaArgs(QMetaType::Type type, const QJso
         p = copyMetaArg(type, p, value.toInt());
         break;
 
+    case QMetaType::LongLong:
+        // JSON numbers are doubles, so this is only exact up to 2^53
+        p = copyMetaArg(type, p, qint64(value.toDouble()));
+        break;
+
     case QMetaType::QString:
         p = copyMetaArg(type, p, value.toString());
         break;
 
+    case QMetaType::QStringList:
+        {
+            QStringList list;
+            for (const QJsonValue &v : value.toArray())
+                list.append(v.toString());
+            p = copyMetaArg(type, p, list);
+        }
+        break;
+
+    case QMetaType::QByteArray:
+        p = copyMetaArg(type, p, QByteArray::fromBase64(value.toString().toLatin1()));
+        break;
+
+    case QMetaType::QDateTime:
+        p = copyMetaArg(type, p, QDateTime::fromString(value.toString(), Qt::ISODateWithMs));
+        break;
+
     case QMetaType::QVariant:
         p = copyMetaArg(type, p, value.toVariant());
         break;
 
+    case QMetaType::QJsonArray:
+        p = copyMetaArg(type, p, value.toArray());
+        break;
+
     case QMetaType::QObjectStar:
         {
             QObject *v = m_connection->ensureObject(value.toObject());
@@ -463,6 +605,20 @@ void *BackendObjectPrivate::jsonValueToMetaArgs(QMetaType::Type type, const QJso
         if (type == QMetaType::type("QJSValue")) {
             // m_object may not have been exposed to the engine yet, so use the connection's
             p = copyMetaArg(type, p, jsonValueToJSValue(m_connection->qmlEngine(), value));
+        } else if (type == qMetaTypeId<QVector<double>>()) {
+            const QJsonArray array = value.toArray();
+            QVector<double> list;
+            list.reserve(array.size());
+            for (const QJsonValue &v : array)
+                list.append(v.toDouble());
+            p = copyMetaArg(type, p, list);
+        } else if (type == qMetaTypeId<QVector<int>>()) {
+            const QJsonArray array = value.toArray();
+            QVector<int> list;
+            list.reserve(array.size());
+            for (const QJsonValue &v : array)
+                list.append(v.toInt());
+            p = copyMetaArg(type, p, list);
         } else {
             qCWarning(lcObject) << "Unknown type" << QMetaType::typeName(type) << "in JSON value conversion";
         }
@@ -483,6 +639,20 @@ std::pair<QString,QString> qtTypesFromType(const QString &type)
         return {"double","double"};
     else if (type == "bool")
         return {"bool","bool"};
+    else if (type == "int64")
+        return {"qlonglong","double"};
+    else if (type == "bytes")
+        return {"QByteArray","var"};
+    else if (type == "time")
+        return {"QDateTime","date"};
+    else if (type == "stringList")
+        return {"QStringList","var"};
+    else if (type == "intList")
+        return {"QVector<int>","var"};
+    else if (type == "doubleList")
+        return {"QVector<double>","var"};
+    else if (type == "rows")
+        return {"QJsonArray","var"};
     else if (type == "object")
         return {"QObject*","var"};
     else if (type == "array")
@@ -509,9 +679,16 @@ std::pair<QString,QString> qtTypesFromType(const QString &type)
  *   }
  * }
  *
- * valid type strings are: string, int, double, bool, var, object, array, map
+ * valid type strings are: string, int, double, bool, var, object, array, map,
+ * int64, bytes, time, stringList, intList, doubleList, rows
  * object is a qbackend object; it will contain the object structure.
  * var can hold any of the other types
+ *
+ * intList is only used for ints of 32 bits or less; lists of larger ints are arrays.
+ * int64 through doubleList are stored natively rather than as JS values; lists, bytes,
+ * and times are converted from JSON once, when first read after a change. bytes are
+ * base64 encoded strings and time is an ISO 8601 string, as encoded by Go. rows is
+ * an array of model rows, which is passed to models as QJsonArray.
  */
 
 /* Object structure:
@@ -553,6 +730,20 @@ QMetaObject *metaObjectFromType(const QJsonObject &type, const QMetaObject *supe
         p.setWritable(false);
     }
 
+    if (superClass && superClass->inherits(&QAbstractListModel::staticMetaObject)) {
+        // Properties implemented by the client model; see QBackendModel
+        for (const auto &cp : BackendModelPrivate::clientProperties()) {
+            if (properties.contains(QString::fromLatin1(cp.name)))
+                continue;
+            QMetaMethodBuilder notify = b.addSignal(QByteArray(cp.name) + "Changed()");
+            b.addProperty(cp.name, cp.type, notify.index()).setWritable(cp.writable);
+        }
+        if (!type.value("methods").toObject().contains("findRows")) {
+            QMetaMethodBuilder findRows = b.addMethod("findRows(QString,QJSValue)", "QJSValue");
+            findRows.setParameterNames({"role", "value"});
+        }
+    }
+
     QJsonObject signalsObj = type.value("signals").toObject();
     for (auto it = signalsObj.constBegin(); it != signalsObj.constEnd(); it++) {
         QString signature = it.key() + "(";
@@ -4,6 +4,8 @@
 #include <QJsonObject>
 #include <QMetaObject>
 #include <QJSValue>
+#include <QHash>
+#include <QVariant>
 #include "qbackendconnection.h"
 
 class Promise;
@@ -20,8 +22,14 @@ public:
     bool m_instantiated = false;
 
     QJsonObject m_dataObject;
+    // Values of native list, bytes, and time properties, converted from m_dataObject
+    // on the first read and kept until the property changes
+    QHash<QByteArray,QVariant> m_nativeValues;
     bool m_dataReady = false;
     bool m_waitingForData = false;
+    // Data will arrive without being queried, so reads shouldn't block for it.
+    // Used for the placeholder root object during asynchronous startup.
+    bool m_dataPending = false;
 
     QHash<QByteArray,Promise*> m_promises;
 
@@ -41,6 +49,7 @@ public:
     void componentComplete();
 
     void *jsonValueToMetaArgs(QMetaType::Type type, const QJsonValue &value, void *p = nullptr);
+    static bool isNativeType(int type);
     QJSValue jsonValueToJSValue(QJSEngine *engine, const QJsonValue &value);
 };
 
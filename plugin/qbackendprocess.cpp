@@ -1,11 +1,110 @@
 #include <QDebug>
 #include <QLoggingCategory>
 #include <QFile>
+#include <QHash>
+#include <QCoreApplication>
+#include <QElapsedTimer>
 
 #include "qbackendprocess.h"
 
 Q_LOGGING_CATEGORY(lcProcess, "backend.process")
 
+// ProcessPool has backend processes that were started ahead of time, for each name and
+// arguments. A pooled backend has written its handshake, which waits in the pipe until
+// the process is claimed by a QBackendProcess, so claiming one skips the exec and runtime
+// initialization of the backend. Claimed processes are replaced in the background.
+class ProcessPool : public QObject
+{
+public:
+    ProcessPool(QObject *parent)
+        : QObject(parent)
+    {
+        // Pooled processes are idle; don't wait for them to exit
+        connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, [this]() {
+            for (const QString &key : m_sizes.keys())
+                resize(key, 0);
+        });
+    }
+
+    static ProcessPool *instance()
+    {
+        static ProcessPool *pool = new ProcessPool(QCoreApplication::instance());
+        return pool;
+    }
+
+    static QString key(const QString &name, const QStringList &args)
+    {
+        return (QStringList(name) + args).join(QChar(0));
+    }
+
+    // Take a started process for key, if there is one. It becomes a child of parent.
+    QProcess *take(const QString &key, QObject *parent)
+    {
+        QList<QProcess*> &processes = m_processes[key];
+        while (!processes.isEmpty()) {
+            QProcess *process = processes.takeFirst();
+            disconnect(process, nullptr, this, nullptr);
+            if (process->state() == QProcess::NotRunning) {
+                process->deleteLater();
+                continue;
+            }
+            process->setParent(parent);
+            return process;
+        }
+        return nullptr;
+    }
+
+    // Start or stop processes to keep size processes waiting for key
+    void resize(const QString &key, int size)
+    {
+        m_sizes.insert(key, size);
+        QList<QProcess*> &processes = m_processes[key];
+        while (processes.size() > size) {
+            QProcess *process = processes.takeLast();
+            disconnect(process, nullptr, this, nullptr);
+            process->kill();
+            process->waitForFinished(1000);
+            delete process;
+        }
+
+        QStringList args = key.split(QChar(0));
+        QString name = args.takeFirst();
+        while (processes.size() < size) {
+            QProcess *process = new QProcess(this);
+            // Failed or exited processes are dropped, and not replaced until one is claimed
+            connect(process, &QProcess::errorOccurred, this, [=](QProcess::ProcessError error) {
+                qCWarning(lcProcess) << "Pooled process" << name << "failed:" << error;
+                remove(key, process);
+            });
+            connect(process, QOverload<int,QProcess::ExitStatus>::of(&QProcess::finished), this, [=]() {
+                qCWarning(lcProcess) << "Pooled process" << name << "exited:" << process->readAllStandardError();
+                remove(key, process);
+            });
+            process->start(name, args);
+            processes.append(process);
+        }
+    }
+
+    // Resize later, so starting processes doesn't delay the instance that just started
+    void refill(const QString &key, int size)
+    {
+        m_sizes.insert(key, size);
+        QMetaObject::invokeMethod(this, [=]() { resize(key, m_sizes.value(key)); }, Qt::QueuedConnection);
+    }
+
+private:
+    QHash<QString,QList<QProcess*>> m_processes;
+    QHash<QString,int> m_sizes;
+
+    void remove(const QString &key, QProcess *process)
+    {
+        if (m_processes[key].removeOne(process)) {
+            disconnect(process, nullptr, this, nullptr);
+            process->deleteLater();
+        }
+    }
+};
+
 QBackendProcess::QBackendProcess(QObject *parent)
     : QBackendConnection(parent)
 {
@@ -43,6 +142,27 @@ void QBackendProcess::setArgs(const QStringList& args)
     emit argsChanged();
 }
 
+// poolSize is the number of processes with the same name and args that are started
+// ahead of time, and are claimed by later instances to start without waiting for the
+// backend to initialize. The pool is shared by all instances, and is filled once this
+// instance has started.
+int QBackendProcess::poolSize() const
+{
+    return m_poolSize;
+}
+
+void QBackendProcess::setPoolSize(int size)
+{
+    size = qMax(size, 0);
+    if (m_poolSize == size)
+        return;
+
+    m_poolSize = size;
+    if (m_completed)
+        ProcessPool::instance()->resize(ProcessPool::key(m_name, m_args), m_poolSize);
+    emit poolSizeChanged();
+}
+
 void QBackendProcess::classBegin()
 {
 
@@ -52,19 +172,34 @@ void QBackendProcess::componentComplete()
 {
     m_completed = true;
 
-    // Start the process
-    m_process.start(m_name, m_args);
+    QElapsedTimer tm;
+    tm.start();
+
+    // Claim a started process from the pool, or start the process
+    QString poolKey = ProcessPool::key(m_name, m_args);
+    m_process = ProcessPool::instance()->take(poolKey, this);
+    bool warm = m_process != nullptr;
+    if (!m_process) {
+        m_process = new QProcess(this);
+        m_process->start(m_name, m_args);
+    }
 
-    connect(&m_process, &QProcess::stateChanged, this, [=]() {
-        qCWarning(lcProcess) << "State changed " << m_process.state();
-        if (m_process.state() != QProcess::Running) {
-            qCWarning(lcProcess) << m_process.readAllStandardError() << m_process.readAllStandardOutput();
+    connect(m_process, &QProcess::stateChanged, this, [=]() {
+        qCWarning(lcProcess) << "State changed " << m_process->state();
+        if (m_process->state() != QProcess::Running) {
+            qCWarning(lcProcess) << m_process->readAllStandardError() << m_process->readAllStandardOutput();
         }
     });
 
-    m_process.waitForStarted();
-    setBackendIo(&m_process, &m_process);
+    m_process->waitForStarted();
+    setBackendIo(m_process, m_process);
+    startupPhase(warm ? "process (warm)" : "process (cold)");
 
     QBackendConnection::componentComplete();
+    qCInfo(lcProcess) << "Backend" << m_name << "was ready in" << tm.elapsed() << "ms from a"
+        << (warm ? "pooled process" : "new process");
+
+    if (m_poolSize > 0)
+        ProcessPool::instance()->refill(poolKey, m_poolSize);
 }
 
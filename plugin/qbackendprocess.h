@@ -14,6 +14,7 @@ class QBackendProcess : public QBackendConnection
     Q_OBJECT
     Q_PROPERTY(QString name READ name WRITE setName NOTIFY nameChanged)
     Q_PROPERTY(QStringList args READ args WRITE setArgs NOTIFY argsChanged)
+    Q_PROPERTY(int poolSize READ poolSize WRITE setPoolSize NOTIFY poolSizeChanged)
 
 public:
     QBackendProcess(QObject *parent = 0);
@@ -24,6 +25,9 @@ public:
     QStringList args() const;
     void setArgs(const QStringList& args);
 
+    int poolSize() const;
+    void setPoolSize(int size);
+
 protected:
     void classBegin() override;
     void componentComplete() override;
@@ -31,11 +35,13 @@ protected:
 signals:
     void nameChanged();
     void argsChanged();
+    void poolSizeChanged();
 
 private:
     QString m_name;
     QStringList m_args;
+    int m_poolSize = 0;
     bool m_completed = false;
-    QProcess m_process;
+    QProcess *m_process = nullptr;
 };
 
@@ -0,0 +1,355 @@
+#include "qbackendtablemodel.h"
+#include "qbackendtablemodel_p.h"
+#include "qbackendmodel_p.h"
+#include <QQmlEngine>
+#include <QJsonObject>
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(lcModel)
+
+/* Table models are QBackendObjects with QAbstractTableModel behavior client-side, similar to
+ * QBackendModel. Objects with a '_qb_table' property of type 'object' construct a
+ * QBackendTableModel.
+ *
+ * Each cell has a single value, which is the display role. Cells are fetched in tiles of
+ * rows by columns, so a view of a wide table only fetches the columns that are visible.
+ * Cached cells are stored by row in a RowCache, like the rows of a list model.
+ */
+
+QBackendTableModel::QBackendTableModel(QBackendConnection *connection, QByteArray identifier, QMetaObject *metaObject, QObject *parent)
+    : QAbstractTableModel(parent)
+    , d(new BackendTableModelPrivate(this, connection, identifier))
+    , m_metaObject(metaObject)
+{
+}
+
+QBackendTableModel::QBackendTableModel(QBackendConnection *connection, QMetaObject *type)
+    : d(new BackendTableModelPrivate(type->className(), this, connection))
+    , m_metaObject(type)
+{
+}
+
+QBackendTableModel::~QBackendTableModel()
+{
+    delete d;
+    free(m_metaObject);
+}
+
+const QMetaObject *QBackendTableModel::metaObject() const
+{
+    Q_ASSERT(m_metaObject);
+    return m_metaObject;
+}
+
+int QBackendTableModel::qt_metacall(QMetaObject::Call c, int id, void **argv)
+{
+    id = QAbstractTableModel::qt_metacall(c, id, argv);
+    if (id < 0)
+        return id;
+    return d->metacall(c, id, argv);
+}
+
+void QBackendTableModel::classBegin()
+{
+    d->classBegin();
+}
+
+void QBackendTableModel::componentComplete()
+{
+    d->componentComplete();
+}
+
+/* The _qb_table object must implement:
+ *
+ * {
+ *   "properties": {
+ *     "columnNames": "stringList"
+ *   },
+ *   "methods": {
+ *     "reset": [],
+ *     "requestTile": [ "int row", "int column", "int rows", "int columns" ]
+ *   },
+ *   "signals": {
+ *     "modelReset": [ "int rows", "int columns" ],
+ *     "modelInsertRows": [ "int start", "int count" ],
+ *     "modelRemoveRows": [ "int start", "int end" ],
+ *     "modelInsertColumns": [ "int start", "int count" ],
+ *     "modelRemoveColumns": [ "int start", "int end" ],
+ *     "modelTile": [ "int row", "int column", "rows tile" ],
+ *     "modelUpdate": [ "int row", "int column", "int rows", "int columns", "rows tile" ]
+ *   }
+ * }
+ *
+ * A tile is an array of rows starting from row, and each row is an array of cells starting
+ * from column. modelTile is the response to requestTile. modelUpdate replaces the values of
+ * cached cells, or marks them to be fetched again if tile is empty.
+ */
+
+void BackendTableModelPrivate::ensureModel()
+{
+    if (m_modelData)
+        return;
+
+    m_modelData = m_object->property("_qb_table").value<QObject*>();
+    if (!m_modelData) {
+        qCWarning(lcModel) << "Missing _qb_table object on table model type" << m_object->metaObject()->className();
+        return;
+    }
+    m_modelData->setParent(this);
+    m_columnNames = m_modelData->property("columnNames").value<QStringList>();
+
+    connect(m_modelData, SIGNAL(modelReset(int,int)), this, SLOT(doReset(int,int)));
+    connect(m_modelData, SIGNAL(modelInsertRows(int,int)), this, SLOT(doInsertRows(int,int)));
+    connect(m_modelData, SIGNAL(modelRemoveRows(int,int)), this, SLOT(doRemoveRows(int,int)));
+    connect(m_modelData, SIGNAL(modelInsertColumns(int,int)), this, SLOT(doInsertColumns(int,int)));
+    connect(m_modelData, SIGNAL(modelRemoveColumns(int,int)), this, SLOT(doRemoveColumns(int,int)));
+    connect(m_modelData, SIGNAL(modelTile(int,int,QJsonArray)), this, SLOT(doTile(int,int,QJsonArray)));
+    connect(m_modelData, SIGNAL(modelUpdate(int,int,int,int,QJsonArray)), this, SLOT(doUpdate(int,int,int,int,QJsonArray)));
+    connect(m_modelData, SIGNAL(columnNamesChanged()), this, SLOT(doColumnNamesChanged()));
+
+    QMetaObject::invokeMethod(m_modelData, "reset");
+}
+
+QHash<int, QByteArray> QBackendTableModel::roleNames() const
+{
+    return {{Qt::DisplayRole, "display"}};
+}
+
+int QBackendTableModel::rowCount(const QModelIndex &parent) const
+{
+    const_cast<QBackendTableModel*>(this)->d->ensureModel();
+    return parent.isValid() ? 0 : d->m_rowCount;
+}
+
+int QBackendTableModel::columnCount(const QModelIndex &parent) const
+{
+    const_cast<QBackendTableModel*>(this)->d->ensureModel();
+    return parent.isValid() ? 0 : d->m_columnCount;
+}
+
+QVariant QBackendTableModel::data(const QModelIndex &index, int role) const
+{
+    const_cast<QBackendTableModel*>(this)->d->ensureModel();
+    if (role != Qt::DisplayRole || index.row() < 0 || index.row() >= d->m_rowCount ||
+        index.column() < 0 || index.column() >= d->m_columnCount)
+        return QVariant();
+
+    const QVariant *value = d->fetchCell(index.row(), index.column());
+    if (!value)
+        return QVariant();
+    if (value->userType() == QMetaType::QJsonValue)
+        return BackendModelPrivate::resolveCell(d, *value);
+    return *value;
+}
+
+QVariant QBackendTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    const_cast<QBackendTableModel*>(this)->d->ensureModel();
+    if (orientation == Qt::Horizontal && role == Qt::DisplayRole && section >= 0 && section < d->m_columnNames.size())
+        return d->m_columnNames.at(section);
+    return QAbstractTableModel::headerData(section, orientation, role);
+}
+
+const QVariant *BackendTableModelPrivate::fetchCell(int row, int column)
+{
+    m_lastRow = row;
+    if (const Row *data = m_rows.find(row)) {
+        if (data->fetched.testBit(column))
+            return &data->cells.at(column);
+    }
+
+    int startRow = row - row % m_tileRows;
+    int startColumn = column - column % m_tileColumns;
+    int rows = qMin(m_tileRows, m_rowCount - startRow);
+    int columns = qMin(m_tileColumns, m_columnCount - startColumn);
+    qCDebug(lcModel) << "blocking to fetch tile of" << rows << "rows from" << startRow << "and" << columns
+                     << "columns from" << startColumn << "to get data for" << row << column;
+
+    QMetaObject::invokeMethod(m_modelData, "requestTile", Q_ARG(int, startRow), Q_ARG(int, startColumn),
+                              Q_ARG(int, rows), Q_ARG(int, columns));
+    QString modelIdentifier = m_modelData->property("_qb_identifier").toString();
+    m_connection->waitForMessage("model_emit",
+        [&](const QJsonObject &msg) {
+            QJsonArray parameters = msg.value("parameters").toArray();
+            return msg.value("command").toString() == "EMIT" &&
+                   msg.value("method").toString() == "modelTile" &&
+                   msg.value("identifier").toString() == modelIdentifier &&
+                   parameters.at(0).toInt() == startRow &&
+                   parameters.at(1).toInt() == startColumn;
+        }
+    );
+
+    // This should have been filled in by the doTile slot
+    const Row *data = m_rows.find(row);
+    if (!data || column >= data->fetched.size() || !data->fetched.testBit(column)) {
+        qCWarning(lcModel) << "cell has no data after synchronous fetch";
+        return nullptr;
+    }
+    return &data->cells.at(column);
+}
+
+void BackendTableModelPrivate::cacheTile(int row, int column, const QJsonArray &tile)
+{
+    for (int i = 0; i < tile.size(); i++) {
+        if (row+i >= m_rowCount)
+            break;
+        if (!m_rows.contains(row+i)) {
+            Row empty;
+            empty.cells.resize(m_columnCount);
+            empty.fetched.resize(m_columnCount);
+            m_rows.insert(row+i, empty);
+        }
+
+        Row *data = m_rows.find(row+i);
+        const QJsonArray cells = tile.at(i).toArray();
+        for (int j = 0; j < cells.size() && column+j < m_columnCount; j++) {
+            data->cells[column+j] = BackendModelPrivate::cellFromJson(cells.at(j));
+            data->fetched.setBit(column+j);
+        }
+    }
+}
+
+// Evict the cached rows furthest from the last row that was read
+void BackendTableModelPrivate::cleanCache()
+{
+    int removed = 0;
+    while (qint64(m_rows.size()) * qMax(m_columnCount, 1) > m_cacheBudget && m_rows.size() > m_tileRows) {
+        int first = m_rows.firstRow(), last = m_rows.lastRow();
+        m_rows.erase(m_lastRow - first > last - m_lastRow ? first : last);
+        removed++;
+    }
+
+    if (removed > 0)
+        qCDebug(lcModel) << "cleaned" << removed << "rows from table cache," << m_rows.size() << "rows remain";
+}
+
+void BackendTableModelPrivate::insertBits(QBitArray &bits, int start, int count)
+{
+    QBitArray result(bits.size() + count);
+    for (int i = 0; i < bits.size(); i++) {
+        if (bits.testBit(i))
+            result.setBit(i < start ? i : i + count);
+    }
+    bits = result;
+}
+
+void BackendTableModelPrivate::removeBits(QBitArray &bits, int start, int count)
+{
+    QBitArray result(qMax(0, bits.size() - count));
+    for (int i = 0; i < bits.size(); i++) {
+        if (!bits.testBit(i) || (i >= start && i < start + count))
+            continue;
+        result.setBit(i < start ? i : i - count);
+    }
+    bits = result;
+}
+
+void BackendTableModelPrivate::doReset(int rows, int columns)
+{
+    model()->beginResetModel();
+    m_rows.clear();
+    m_rowCount = rows;
+    m_columnCount = columns;
+    model()->endResetModel();
+}
+
+void BackendTableModelPrivate::doInsertRows(int start, int count)
+{
+    if (count < 1)
+        return;
+
+    model()->beginInsertRows(QModelIndex(), start, start + count - 1);
+    m_rows.insertRows(start, count);
+    m_rowCount += count;
+    model()->endInsertRows();
+}
+
+void BackendTableModelPrivate::doRemoveRows(int start, int end)
+{
+    if (end < start)
+        return;
+
+    model()->beginRemoveRows(QModelIndex(), start, end);
+    m_rows.removeRows(start, end-start+1);
+    m_rowCount -= end-start+1;
+    model()->endRemoveRows();
+}
+
+void BackendTableModelPrivate::doInsertColumns(int start, int count)
+{
+    if (count < 1)
+        return;
+
+    model()->beginInsertColumns(QModelIndex(), start, start + count - 1);
+    for (int row = m_rows.firstRow(); row >= 0; row = m_rows.nextRow(row)) {
+        Row *data = m_rows.find(row);
+        data->cells.insert(start, count, QVariant());
+        insertBits(data->fetched, start, count);
+    }
+    m_columnCount += count;
+    model()->endInsertColumns();
+}
+
+void BackendTableModelPrivate::doRemoveColumns(int start, int end)
+{
+    if (end < start)
+        return;
+
+    model()->beginRemoveColumns(QModelIndex(), start, end);
+    for (int row = m_rows.firstRow(); row >= 0; row = m_rows.nextRow(row)) {
+        Row *data = m_rows.find(row);
+        data->cells.remove(start, end-start+1);
+        removeBits(data->fetched, start, end-start+1);
+    }
+    m_columnCount -= end-start+1;
+    model()->endRemoveColumns();
+}
+
+void BackendTableModelPrivate::doTile(int row, int column, const QJsonArray &tile)
+{
+    if (row < 0 || column < 0 || row >= m_rowCount || column >= m_columnCount) {
+        qCWarning(lcModel) << "invalid tile at" << row << column;
+        return;
+    }
+
+    cacheTile(row, column, tile);
+    qCDebug(lcModel) << "populated tile of" << tile.size() << "rows at" << row << column;
+    cleanCache();
+}
+
+void BackendTableModelPrivate::doUpdate(int row, int column, int rows, int columns, const QJsonArray &tile)
+{
+    int lastRow = qMin(row + rows, m_rowCount) - 1;
+    int lastColumn = qMin(column + columns, m_columnCount) - 1;
+    if (row < 0 || column < 0 || lastRow < row || lastColumn < column) {
+        qCWarning(lcModel) << "invalid table update at" << row << column;
+        return;
+    }
+
+    // Only cached cells are updated; others will have the new values when fetched
+    for (int r = m_rows.nextRow(row-1); r >= 0 && r <= lastRow; r = m_rows.nextRow(r)) {
+        Row *data = m_rows.find(r);
+        if (tile.isEmpty()) {
+            for (int c = column; c <= lastColumn; c++) {
+                data->cells[c] = QVariant();
+                data->fetched.clearBit(c);
+            }
+            continue;
+        }
+
+        const QJsonArray cells = tile.at(r - row).toArray();
+        for (int c = column; c <= lastColumn && c - column < cells.size(); c++) {
+            data->cells[c] = BackendModelPrivate::cellFromJson(cells.at(c - column));
+            data->fetched.setBit(c);
+        }
+    }
+
+    emit model()->dataChanged(model()->index(row, column), model()->index(lastRow, lastColumn));
+}
+
+void BackendTableModelPrivate::doColumnNamesChanged()
+{
+    m_columnNames = m_modelData->property("columnNames").value<QStringList>();
+    if (m_columnCount > 0)
+        emit model()->headerDataChanged(Qt::Horizontal, 0, m_columnCount-1);
+}
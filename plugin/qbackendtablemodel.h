@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QAbstractTableModel>
+#include <QQmlParserStatus>
+
+class QBackendConnection;
+class BackendTableModelPrivate;
+
+class QBackendTableModel : public QAbstractTableModel, public QQmlParserStatus
+{
+    friend class BackendTableModelPrivate;
+
+public:
+    QBackendTableModel(QBackendConnection *connection, QByteArray identifier, QMetaObject *metaObject, QObject *parent = nullptr);
+    virtual ~QBackendTableModel();
+
+    virtual const QMetaObject *metaObject() const override;
+    virtual int qt_metacall(QMetaObject::Call c, int id, void **argv) override;
+
+    QHash<int, QByteArray> roleNames() const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    void classBegin() override;
+    void componentComplete() override;
+
+protected:
+    QBackendTableModel(QBackendConnection *connection, QMetaObject *type);
+
+private:
+    BackendTableModelPrivate *d;
+    QMetaObject *m_metaObject = nullptr;
+};
+
+Q_DECLARE_METATYPE(QBackendTableModel*)
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "qbackendobject_p.h"
+#include "qbackendtablemodel.h"
+#include "rowcache.h"
+#include <QVector>
+#include <QVariant>
+#include <QBitArray>
+#include <QJsonArray>
+
+class BackendTableModelPrivate : public BackendObjectPrivate
+{
+    Q_OBJECT
+
+public:
+    using BackendObjectPrivate::BackendObjectPrivate;
+
+    // Cached cells of a row. Cells are fetched in tiles, so only some columns of a row
+    // may be cached, and those are set in fetched.
+    struct Row
+    {
+        QVector<QVariant> cells;
+        QBitArray fetched;
+    };
+
+    QObject *m_modelData = nullptr;
+    QStringList m_columnNames;
+    RowCache<Row> m_rows;
+    int m_rowCount = 0;
+    int m_columnCount = 0;
+    // Size of fetched tiles; tiles are aligned to multiples of their size
+    int m_tileRows = 64;
+    int m_tileColumns = 16;
+    // Approximate number of cells to keep cached, counting every column of cached rows
+    qint64 m_cacheBudget = 256 * 1024;
+    int m_lastRow = 0;
+
+    QBackendTableModel *model() { return static_cast<QBackendTableModel*>(m_object); }
+    void ensureModel();
+    const QVariant *fetchCell(int row, int column);
+    void cacheTile(int row, int column, const QJsonArray &tile);
+    void cleanCache();
+    static void insertBits(QBitArray &bits, int start, int count);
+    static void removeBits(QBitArray &bits, int start, int count);
+
+public slots:
+    void doReset(int rows, int columns);
+    void doInsertRows(int start, int count);
+    void doRemoveRows(int start, int end);
+    void doInsertColumns(int start, int count);
+    void doRemoveColumns(int start, int end);
+    void doTile(int row, int column, const QJsonArray &tile);
+    void doUpdate(int row, int column, int rows, int columns, const QJsonArray &tile);
+    void doColumnNamesChanged();
+};
@@ -0,0 +1,464 @@
+#include "qbackendtreemodel.h"
+#include "qbackendtreemodel_p.h"
+#include <QQmlEngine>
+#include <QJsonObject>
+#include <QLoggingCategory>
+
+Q_DECLARE_LOGGING_CATEGORY(lcModel)
+
+/* Tree models are QBackendObjects with QAbstractItemModel behavior client-side, similar to
+ * QBackendModel. Objects with a '_qb_tree' property of type 'object' construct a
+ * QBackendTreeModel.
+ *
+ * Models have a single column, and roles like QBackendModel. Children of a row are fetched
+ * through canFetchMore and fetchMore when a view expands the row, and the backend only sends
+ * changes for rows whose parent has been fetched. Within each parent, rows are fetched in
+ * windows of batchSize, like the rows of a list model.
+ */
+
+QBackendTreeModel::QBackendTreeModel(QBackendConnection *connection, QByteArray identifier, QMetaObject *metaObject, QObject *parent)
+    : QAbstractItemModel(parent)
+    , d(new BackendTreeModelPrivate(this, connection, identifier))
+    , m_metaObject(metaObject)
+{
+}
+
+QBackendTreeModel::QBackendTreeModel(QBackendConnection *connection, QMetaObject *type)
+    : d(new BackendTreeModelPrivate(type->className(), this, connection))
+    , m_metaObject(type)
+{
+}
+
+QBackendTreeModel::~QBackendTreeModel()
+{
+    delete d;
+    free(m_metaObject);
+}
+
+const QMetaObject *QBackendTreeModel::metaObject() const
+{
+    Q_ASSERT(m_metaObject);
+    return m_metaObject;
+}
+
+int QBackendTreeModel::qt_metacall(QMetaObject::Call c, int id, void **argv)
+{
+    id = QAbstractItemModel::qt_metacall(c, id, argv);
+    if (id < 0)
+        return id;
+    return d->metacall(c, id, argv);
+}
+
+void QBackendTreeModel::classBegin()
+{
+    d->classBegin();
+}
+
+void QBackendTreeModel::componentComplete()
+{
+    d->componentComplete();
+}
+
+/* The _qb_tree object must implement:
+ *
+ * {
+ *   "properties": {
+ *     "roleNames": "array", // string list
+ *     "batchSize": "int" // writable, max number of rows with data in a change/reset signal
+ *   },
+ *   "methods": {
+ *     "reset": [],
+ *     "fetchChildren": [ "intList parent" ],
+ *     "requestRows": [ "intList parent", "int start", "int count" ]
+ *   },
+ *   "signals": {
+ *     "modelReset": [ "rows rowData", "intList childCounts", "int moreRows" ],
+ *     "modelChildren": [ "intList parent", "rows rowData", "intList childCounts", "int moreRows" ],
+ *     "modelInsert": [ "intList parent", "int start", "rows rowData", "intList childCounts", "int moreRows" ],
+ *     "modelRemove": [ "intList parent", "int start", "int end" ],
+ *     "modelMove": [ "intList parent", "int start", "int end", "int destination" ],
+ *     "modelUpdate": [ "intList parent", "int start", "rows rowData", "intList childCounts" ],
+ *     "modelRowData": [ "intList parent", "int start", "rows rowData", "intList childCounts" ]
+ *   }
+ * }
+ *
+ * parent is the path of row indexes from the top level to the parent row, and is empty for
+ * top level rows. childCounts has the number of children of each row in rowData, which is
+ * used to know if the row can be expanded. modelChildren is the response to fetchChildren,
+ * and replaces any children the parent had.
+ */
+
+void BackendTreeModelPrivate::ensureModel()
+{
+    if (m_modelData)
+        return;
+
+    m_modelData = m_object->property("_qb_tree").value<QObject*>();
+    if (!m_modelData) {
+        qCWarning(lcModel) << "Missing _qb_tree object on tree model type" << m_object->metaObject()->className();
+        return;
+    }
+    m_modelData->setParent(this);
+
+    m_roleNames = m_modelData->property("roleNames").value<QStringList>();
+    if (m_roleNames.isEmpty()) {
+        qCWarning(lcModel) << "Tree model type" << m_object->metaObject()->className() << "has no role names";
+        return;
+    }
+
+    connect(m_modelData, SIGNAL(modelReset(QJsonArray,QVector<int>,int)), this, SLOT(doReset(QJsonArray,QVector<int>,int)));
+    connect(m_modelData, SIGNAL(modelChildren(QVector<int>,QJsonArray,QVector<int>,int)), this, SLOT(doChildren(QVector<int>,QJsonArray,QVector<int>,int)));
+    connect(m_modelData, SIGNAL(modelInsert(QVector<int>,int,QJsonArray,QVector<int>,int)), this, SLOT(doInsert(QVector<int>,int,QJsonArray,QVector<int>,int)));
+    connect(m_modelData, SIGNAL(modelRemove(QVector<int>,int,int)), this, SLOT(doRemove(QVector<int>,int,int)));
+    connect(m_modelData, SIGNAL(modelMove(QVector<int>,int,int,int)), this, SLOT(doMove(QVector<int>,int,int,int)));
+    connect(m_modelData, SIGNAL(modelUpdate(QVector<int>,int,QJsonArray,QVector<int>)), this, SLOT(doUpdate(QVector<int>,int,QJsonArray,QVector<int>)));
+    connect(m_modelData, SIGNAL(modelRowData(QVector<int>,int,QJsonArray,QVector<int>)), this, SLOT(doRowData(QVector<int>,int,QJsonArray,QVector<int>)));
+
+    if (m_batchSize > 0) {
+        m_modelData->setProperty("batchSize", m_batchSize);
+    }
+    QMetaObject::invokeMethod(m_modelData, "reset");
+}
+
+QHash<int, QByteArray> QBackendTreeModel::roleNames() const
+{
+    const_cast<QBackendTreeModel*>(this)->d->ensureModel();
+    QHash<int,QByteArray> roles;
+    for (const QString &name : d->m_roleNames)
+        roles[Qt::UserRole + roles.size()] = name.toUtf8();
+    return roles;
+}
+
+QModelIndex QBackendTreeModel::index(int row, int column, const QModelIndex &parent) const
+{
+    const_cast<QBackendTreeModel*>(this)->d->ensureModel();
+    BackendTreeModelPrivate::Node *node = d->nodeForParent(parent);
+    if (!node || row < 0 || row >= node->rowCount || column != 0)
+        return QModelIndex();
+    return createIndex(row, column, node);
+}
+
+QModelIndex QBackendTreeModel::parent(const QModelIndex &index) const
+{
+    if (!index.isValid())
+        return QModelIndex();
+    return d->nodeIndex(static_cast<BackendTreeModelPrivate::Node*>(index.internalPointer()));
+}
+
+int QBackendTreeModel::rowCount(const QModelIndex &parent) const
+{
+    const_cast<QBackendTreeModel*>(this)->d->ensureModel();
+    BackendTreeModelPrivate::Node *node = d->nodeForParent(parent);
+    return node ? node->rowCount : 0;
+}
+
+int QBackendTreeModel::columnCount(const QModelIndex &) const
+{
+    return 1;
+}
+
+bool QBackendTreeModel::hasChildren(const QModelIndex &parent) const
+{
+    if (!parent.isValid())
+        return true;
+
+    // Children may still be on their way after fetchMore, so this uses the child count
+    // sent with the row, which is updated when they arrive
+    auto node = static_cast<BackendTreeModelPrivate::Node*>(parent.internalPointer());
+    BackendTreeModelPrivate::Node *children = node->child(parent.row());
+    if (children && children->rowCount > 0)
+        return true;
+    const BackendTreeModelPrivate::Row *row = d->fetchRow(node, parent.row());
+    return row && row->childCount > 0;
+}
+
+bool QBackendTreeModel::canFetchMore(const QModelIndex &parent) const
+{
+    if (!parent.isValid())
+        return false;
+
+    auto node = static_cast<BackendTreeModelPrivate::Node*>(parent.internalPointer());
+    if (node->child(parent.row()))
+        return false;
+    const BackendTreeModelPrivate::Row *row = d->fetchRow(node, parent.row());
+    return row && row->childCount > 0;
+}
+
+void QBackendTreeModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent))
+        return;
+
+    // Children are inserted when they arrive with modelChildren
+    auto node = static_cast<BackendTreeModelPrivate::Node*>(parent.internalPointer());
+    auto children = new BackendTreeModelPrivate::Node;
+    children->parent = node;
+    children->row = parent.row();
+    node->children.append(children);
+
+    qCDebug(lcModel) << "fetching children of" << d->nodePath(children);
+    QMetaObject::invokeMethod(d->m_modelData, "fetchChildren", Q_ARG(QVector<int>, d->nodePath(children)));
+}
+
+QVariant QBackendTreeModel::data(const QModelIndex &index, int role) const
+{
+    const_cast<QBackendTreeModel*>(this)->d->ensureModel();
+    if (!index.isValid() || role < Qt::UserRole)
+        return QVariant();
+
+    auto node = static_cast<BackendTreeModelPrivate::Node*>(index.internalPointer());
+    const BackendTreeModelPrivate::Row *row = d->fetchRow(node, index.row());
+    int column = role - Qt::UserRole;
+    if (!row || column >= row->data.size())
+        return QVariant();
+
+    const QVariant &value = row->data.at(column);
+    if (value.userType() == QMetaType::QJsonValue)
+        return BackendModelPrivate::resolveCell(d, value);
+    return value;
+}
+
+BackendTreeModelPrivate::Node *BackendTreeModelPrivate::Node::child(int row) const
+{
+    for (Node *n : children) {
+        if (n->row == row)
+            return n;
+    }
+    return nullptr;
+}
+
+// The node with the children of parent, or null if they haven't been fetched
+BackendTreeModelPrivate::Node *BackendTreeModelPrivate::nodeForParent(const QModelIndex &parent) const
+{
+    if (!parent.isValid())
+        return const_cast<Node*>(&m_root);
+    return static_cast<Node*>(parent.internalPointer())->child(parent.row());
+}
+
+BackendTreeModelPrivate::Node *BackendTreeModelPrivate::findNode(const QVector<int> &path)
+{
+    Node *node = &m_root;
+    for (int row : path) {
+        node = node->child(row);
+        if (!node)
+            break;
+    }
+    return node;
+}
+
+QVector<int> BackendTreeModelPrivate::nodePath(const Node *node) const
+{
+    QVector<int> path;
+    for (; node && node != &m_root; node = node->parent)
+        path.prepend(node->row);
+    return path;
+}
+
+// The index of the row that node has the children of
+QModelIndex BackendTreeModelPrivate::nodeIndex(const Node *node) const
+{
+    if (!node || node == &m_root)
+        return QModelIndex();
+    return static_cast<QBackendTreeModel*>(m_object)->createIndex(node->row, 0, node->parent);
+}
+
+const BackendTreeModelPrivate::Row *BackendTreeModelPrivate::fetchRow(Node *node, int row)
+{
+    if (row < 0 || row >= node->rowCount)
+        return nullptr;
+    if (const Row *data = node->rows.find(row))
+        return data;
+
+    QPair<int,int> window = node->rows.missingRange(row, node->rowCount, m_batchSize);
+    int start = window.first, end = window.second;
+    QVector<int> path = nodePath(node);
+    qCDebug(lcModel) << "blocking to fetch rows" << start << "to" << end << "of" << path << "to get data for row" << row;
+
+    QMetaObject::invokeMethod(m_modelData, "requestRows", Q_ARG(QVector<int>, path), Q_ARG(int, start), Q_ARG(int, end-start+1));
+    QJsonArray jsonPath;
+    for (int r : qAsConst(path))
+        jsonPath.append(r);
+    QString modelIdentifier = m_modelData->property("_qb_identifier").toString();
+    m_connection->waitForMessage("model_emit",
+        [&](const QJsonObject &msg) {
+            QJsonArray parameters = msg.value("parameters").toArray();
+            return msg.value("command").toString() == "EMIT" &&
+                   msg.value("method").toString() == "modelRowData" &&
+                   msg.value("identifier").toString() == modelIdentifier &&
+                   parameters.at(0).toArray() == jsonPath &&
+                   parameters.at(1).toInt() == start;
+        }
+    );
+
+    // This should have been filled in by the doRowData slot, unless the node was removed
+    // while waiting, which would have deleted it
+    if (findNode(path) != node)
+        return nullptr;
+    const Row *data = node->rows.find(row);
+    if (!data) {
+        qCWarning(lcModel) << "tree row has no data after synchronous fetch";
+    }
+    return data;
+}
+
+void BackendTreeModelPrivate::cacheRows(Node *node, int start, const QJsonArray &data, const QVector<int> &childCounts)
+{
+    Row row;
+    for (int i = 0; i < data.size(); i++) {
+        if (!BackendModelPrivate::rowFromJson(data.at(i), row.data)) {
+            qCWarning(lcModel) << "Tree model row" << start+i << "data is not an array";
+            continue;
+        }
+        row.childCount = childCounts.value(i);
+        node->rows.insert(start+i, row);
+    }
+}
+
+// Remove child nodes from start to end, and shift the rows of the nodes after. The removed
+// nodes must be deleted by the caller, after any indexes for them are gone.
+QVector<BackendTreeModelPrivate::Node*> BackendTreeModelPrivate::takeChildren(Node *node, int start, int end)
+{
+    QVector<Node*> removed;
+    for (int i = node->children.size() - 1; i >= 0; i--) {
+        Node *child = node->children[i];
+        if (child->row > end) {
+            child->row -= end - start + 1;
+        } else if (child->row >= start) {
+            removed.append(child);
+            node->children.remove(i);
+        }
+    }
+    return removed;
+}
+
+// Update the child count of the row that node has the children of
+void BackendTreeModelPrivate::setChildCount(Node *node)
+{
+    if (node == &m_root)
+        return;
+    if (Row *row = node->parent->rows.find(node->row))
+        row->childCount = node->rowCount;
+}
+
+void BackendTreeModelPrivate::doReset(const QJsonArray &data, const QVector<int> &childCounts, int moreRows)
+{
+    model()->beginResetModel();
+    qDeleteAll(m_root.children);
+    m_root.children.clear();
+    m_root.rows.clear();
+    cacheRows(&m_root, 0, data, childCounts);
+    m_root.rowCount = data.size() + moreRows;
+    model()->endResetModel();
+}
+
+void BackendTreeModelPrivate::doChildren(const QVector<int> &parent, const QJsonArray &data, const QVector<int> &childCounts, int moreRows)
+{
+    Node *node = findNode(parent);
+    if (!node) {
+        // Removed before the children arrived
+        return;
+    }
+    QModelIndex index = nodeIndex(node);
+
+    if (node->rowCount > 0) {
+        model()->beginRemoveRows(index, 0, node->rowCount-1);
+        QVector<Node*> removed = takeChildren(node, 0, node->rowCount-1);
+        node->rows.clear();
+        node->rowCount = 0;
+        model()->endRemoveRows();
+        qDeleteAll(removed);
+    }
+
+    int size = data.size() + moreRows;
+    if (size > 0) {
+        model()->beginInsertRows(index, 0, size-1);
+        cacheRows(node, 0, data, childCounts);
+        node->rowCount = size;
+        model()->endInsertRows();
+    }
+    setChildCount(node);
+}
+
+void BackendTreeModelPrivate::doInsert(const QVector<int> &parent, int start, const QJsonArray &data, const QVector<int> &childCounts, int moreRows)
+{
+    Node *node = findNode(parent);
+    int size = data.size() + moreRows;
+    if (!node || size < 1)
+        return;
+
+    model()->beginInsertRows(nodeIndex(node), start, start + size - 1);
+    node->rows.insertRows(start, size);
+    for (Node *child : qAsConst(node->children)) {
+        if (child->row >= start)
+            child->row += size;
+    }
+    cacheRows(node, start, data, childCounts);
+    node->rowCount += size;
+    model()->endInsertRows();
+    setChildCount(node);
+}
+
+void BackendTreeModelPrivate::doRemove(const QVector<int> &parent, int start, int end)
+{
+    Node *node = findNode(parent);
+    if (!node || end < start)
+        return;
+
+    model()->beginRemoveRows(nodeIndex(node), start, end);
+    QVector<Node*> removed = takeChildren(node, start, end);
+    node->rows.removeRows(start, end-start+1);
+    node->rowCount -= end-start+1;
+    model()->endRemoveRows();
+    qDeleteAll(removed);
+    setChildCount(node);
+}
+
+void BackendTreeModelPrivate::doMove(const QVector<int> &parent, int start, int end, int destination)
+{
+    Node *node = findNode(parent);
+    if (!node)
+        return;
+
+    QModelIndex index = nodeIndex(node);
+    if (!model()->beginMoveRows(index, start, end, index, destination))
+        return;
+    node->rows.moveRows(start, end, destination);
+    int size = end-start+1;
+    for (Node *child : qAsConst(node->children)) {
+        int row = child->row;
+        if (destination < start) {
+            if (row >= destination && row < start)
+                child->row += size;
+            else if (row >= start && row <= end)
+                child->row -= start - destination;
+        } else {
+            if (row > end && row < destination)
+                child->row -= size;
+            else if (row >= start && row <= end)
+                child->row += destination - end - 1;
+        }
+    }
+    model()->endMoveRows();
+}
+
+void BackendTreeModelPrivate::doUpdate(const QVector<int> &parent, int start, const QJsonArray &data, const QVector<int> &childCounts)
+{
+    Node *node = findNode(parent);
+    if (!node || start < 0 || data.isEmpty() || start+data.size() > node->rowCount)
+        return;
+
+    cacheRows(node, start, data, childCounts);
+    emit model()->dataChanged(model()->createIndex(start, 0, node), model()->createIndex(start+data.size()-1, 0, node));
+}
+
+void BackendTreeModelPrivate::doRowData(const QVector<int> &parent, int start, const QJsonArray &data, const QVector<int> &childCounts)
+{
+    Node *node = findNode(parent);
+    if (!node || start < 0 || start+data.size() > node->rowCount) {
+        qCWarning(lcModel) << "invalid rowData for" << data.size() << "rows starting from" << start << "of" << parent;
+        return;
+    }
+
+    cacheRows(node, start, data, childCounts);
+    qCDebug(lcModel) << "populated rows" << start << "to" << start+data.size()-1 << "of" << parent;
+}
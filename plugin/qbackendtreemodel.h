@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QAbstractItemModel>
+#include <QQmlParserStatus>
+
+class QBackendConnection;
+class BackendTreeModelPrivate;
+
+class QBackendTreeModel : public QAbstractItemModel, public QQmlParserStatus
+{
+    friend class BackendTreeModelPrivate;
+
+public:
+    QBackendTreeModel(QBackendConnection *connection, QByteArray identifier, QMetaObject *metaObject, QObject *parent = nullptr);
+    virtual ~QBackendTreeModel();
+
+    virtual const QMetaObject *metaObject() const override;
+    virtual int qt_metacall(QMetaObject::Call c, int id, void **argv) override;
+
+    QHash<int, QByteArray> roleNames() const override;
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &index) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+    QVariant data(const QModelIndex &index, int role) const override;
+
+    void classBegin() override;
+    void componentComplete() override;
+
+protected:
+    QBackendTreeModel(QBackendConnection *connection, QMetaObject *type);
+
+private:
+    BackendTreeModelPrivate *d;
+    QMetaObject *m_metaObject = nullptr;
+};
+
+Q_DECLARE_METATYPE(QBackendTreeModel*)
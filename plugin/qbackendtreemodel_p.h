@@ -0,0 +1,67 @@
+#pragma once
+
+#include "qbackendobject_p.h"
+#include "qbackendtreemodel.h"
+#include "qbackendmodel_p.h"
+#include "rowcache.h"
+#include <QVector>
+#include <QJsonArray>
+
+class BackendTreeModelPrivate : public BackendObjectPrivate
+{
+    Q_OBJECT
+
+public:
+    using BackendObjectPrivate::BackendObjectPrivate;
+
+    typedef BackendModelPrivate::RowData RowData;
+
+    struct Row
+    {
+        RowData data;
+        int childCount = 0;
+    };
+
+    // Node has the rows under a parent row, or the top level rows for m_root. Only rows
+    // that have been expanded have a node. Indexes point to the node that contains them.
+    struct Node
+    {
+        ~Node() { qDeleteAll(children); }
+
+        Node *parent = nullptr;
+        // Row of this node in its parent
+        int row = -1;
+        int rowCount = 0;
+        RowCache<Row> rows;
+        // Expanded child rows, in no particular order
+        QVector<Node*> children;
+
+        Node *child(int row) const;
+    };
+
+    QObject *m_modelData = nullptr;
+    QStringList m_roleNames;
+    Node m_root;
+    int m_batchSize = 100;
+
+    QBackendTreeModel *model() { return static_cast<QBackendTreeModel*>(m_object); }
+    void ensureModel();
+
+    Node *nodeForParent(const QModelIndex &parent) const;
+    Node *findNode(const QVector<int> &path);
+    QVector<int> nodePath(const Node *node) const;
+    QModelIndex nodeIndex(const Node *node) const;
+    const Row *fetchRow(Node *node, int row);
+    void cacheRows(Node *node, int start, const QJsonArray &data, const QVector<int> &childCounts);
+    QVector<Node*> takeChildren(Node *node, int start, int end);
+    void setChildCount(Node *node);
+
+public slots:
+    void doReset(const QJsonArray &data, const QVector<int> &childCounts, int moreRows);
+    void doChildren(const QVector<int> &parent, const QJsonArray &data, const QVector<int> &childCounts, int moreRows);
+    void doInsert(const QVector<int> &parent, int start, const QJsonArray &data, const QVector<int> &childCounts, int moreRows);
+    void doRemove(const QVector<int> &parent, int start, int end);
+    void doMove(const QVector<int> &parent, int start, int end, int destination);
+    void doUpdate(const QVector<int> &parent, int start, const QJsonArray &data, const QVector<int> &childCounts);
+    void doRowData(const QVector<int> &parent, int start, const QJsonArray &data, const QVector<int> &childCounts);
+};
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <QtGlobal>
+#include <QPair>
+#include <utility>
+
+/* RowCache is a sparse map of row numbers to values, used for cached model rows.
+ *
+ * Models shift all rows after a change point on every insert, remove, or move. With a
+ * map keyed by row, that re-keys every cached row after the change. RowCache is a treap
+ * where each node stores its row relative to a lazy offset on its subtree. Shifting a
+ * range of rows splits the tree at the range, adjusts the offset on the root of the
+ * middle part, and merges it back, so structural changes are O(log n) regardless of how
+ * many rows are cached. Lookups, insertion, and neighbor queries are also O(log n).
+ *
+ * Rows are always non-negative. Functions returning a row return -1 if there is none.
+ */
+template<typename T> class RowCache
+{
+    Q_DISABLE_COPY(RowCache)
+
+public:
+    RowCache() = default;
+    ~RowCache() { destroy(m_root); }
+
+    int size() const { return count(m_root); }
+    bool isEmpty() const { return !m_root; }
+
+    void clear()
+    {
+        destroy(m_root);
+        m_root = nullptr;
+    }
+
+    const T *find(int row) const
+    {
+        int offset = 0;
+        for (Node *n = m_root; n; ) {
+            offset += n->offset;
+            int key = n->key + offset;
+            if (row == key)
+                return &n->value;
+            n = row < key ? n->left : n->right;
+        }
+        return nullptr;
+    }
+
+    T *find(int row)
+    {
+        return const_cast<T*>(const_cast<const RowCache*>(this)->find(row));
+    }
+
+    bool contains(int row) const { return find(row) != nullptr; }
+
+    // Set the value for row, replacing any existing value
+    void insert(int row, const T &value)
+    {
+        if (T *existing = find(row)) {
+            *existing = value;
+            return;
+        }
+
+        Node *left, *right;
+        split(m_root, row, left, right);
+        m_root = merge(merge(left, new Node(row, value, nextPriority())), right);
+    }
+
+    void erase(int row)
+    {
+        if (!contains(row))
+            return;
+        Node *left, *mid, *right;
+        split(m_root, row, left, right);
+        split(right, row+1, mid, right);
+        destroy(mid);
+        m_root = merge(left, right);
+    }
+
+    // Erase all cached rows from start to end, inclusive
+    void erase(int start, int end)
+    {
+        if (end < start)
+            return;
+        Node *left, *mid, *right;
+        split(m_root, start, left, right);
+        split(right, end+1, mid, right);
+        destroy(mid);
+        m_root = merge(left, right);
+    }
+
+    int firstRow() const
+    {
+        int offset = 0;
+        Node *n = m_root;
+        if (!n)
+            return -1;
+        for (;;) {
+            offset += n->offset;
+            if (!n->left)
+                return n->key + offset;
+            n = n->left;
+        }
+    }
+
+    int lastRow() const
+    {
+        int offset = 0;
+        Node *n = m_root;
+        if (!n)
+            return -1;
+        for (;;) {
+            offset += n->offset;
+            if (!n->right)
+                return n->key + offset;
+            n = n->right;
+        }
+    }
+
+    // Largest cached row before row
+    int previousRow(int row) const
+    {
+        int offset = 0, found = -1;
+        for (Node *n = m_root; n; ) {
+            offset += n->offset;
+            int key = n->key + offset;
+            if (key < row) {
+                found = key;
+                n = n->right;
+            } else {
+                n = n->left;
+            }
+        }
+        return found;
+    }
+
+    // Smallest cached row after row
+    int nextRow(int row) const
+    {
+        int offset = 0, found = -1;
+        for (Node *n = m_root; n; ) {
+            offset += n->offset;
+            int key = n->key + offset;
+            if (key > row) {
+                found = key;
+                n = n->left;
+            } else {
+                n = n->right;
+            }
+        }
+        return found;
+    }
+
+    // The range of rows around row, which is not cached, between the nearest cached rows
+    // and up to about maxSize rows (or unlimited if 0). rowCount is the number of rows
+    // in the model. Returns the first and last row of the range.
+    QPair<int,int> missingRange(int row, int rowCount, int maxSize) const
+    {
+        int start = 0, end = rowCount-1;
+        int next = nextRow(row);
+        if (next >= 0) {
+            end = next-1;
+        }
+        int previous = previousRow(row);
+        if (previous >= 0) {
+            start = previous+1;
+        }
+
+        if (maxSize > 0) {
+            const int half = maxSize/2;
+            if (start > row-half) {
+                end = qMin(end, start+maxSize);
+            } else if (end < row+half) {
+                start = qMax(start, end-maxSize);
+            } else {
+                start = qMax(start, row-half);
+                end = qMin(end, row+half);
+            }
+        }
+
+        return {start, end};
+    }
+
+    // Shift rows from start onwards down by count, for rows inserted at start
+    void insertRows(int start, int count)
+    {
+        if (count < 1)
+            return;
+        Node *left, *right;
+        split(m_root, start, left, right);
+        if (right)
+            right->offset += count;
+        m_root = merge(left, right);
+    }
+
+    // Remove count rows from start, and shift the following rows up
+    void removeRows(int start, int count)
+    {
+        if (count < 1)
+            return;
+        Node *left, *mid, *right;
+        split(m_root, start, left, right);
+        split(right, start+count, mid, right);
+        destroy(mid);
+        if (right)
+            right->offset -= count;
+        m_root = merge(left, right);
+    }
+
+    // Move rows start to end (inclusive) to before destination, which has the same
+    // meaning as in QAbstractItemModel::beginMoveRows. destination must not be within
+    // start to end+1.
+    void moveRows(int start, int end, int destination)
+    {
+        int size = end - start + 1;
+        if (size < 1 || (destination >= start && destination <= end+1))
+            return;
+
+        Node *a, *b, *c, *d;
+        if (destination < start) {
+            // a: before destination, b: destination to start-1, c: moved, d: after end
+            split(m_root, destination, a, b);
+            split(b, start, b, c);
+            split(c, end+1, c, d);
+            if (b)
+                b->offset += size;
+            if (c)
+                c->offset -= start - destination;
+            m_root = merge(merge(a, c), merge(b, d));
+        } else {
+            // a: before start, c: moved, b: end+1 to destination-1, d: from destination
+            split(m_root, start, a, c);
+            split(c, end+1, c, b);
+            split(b, destination, b, d);
+            if (b)
+                b->offset -= size;
+            if (c)
+                c->offset += destination - end - 1;
+            m_root = merge(merge(a, b), merge(c, d));
+        }
+    }
+
+private:
+    struct Node
+    {
+        Node(int key, const T &value, quint32 priority)
+            : key(key), priority(priority), value(value)
+        {
+        }
+
+        // Row is key plus the offset of this node and all of its ancestors
+        int key;
+        int offset = 0;
+        int count = 1;
+        quint32 priority;
+        Node *left = nullptr;
+        Node *right = nullptr;
+        T value;
+    };
+
+    Node *m_root = nullptr;
+    quint32 m_seed = 2463534242u;
+
+    static int count(Node *n) { return n ? n->count : 0; }
+
+    quint32 nextPriority()
+    {
+        // xorshift32
+        m_seed ^= m_seed << 13;
+        m_seed ^= m_seed >> 17;
+        m_seed ^= m_seed << 5;
+        return m_seed;
+    }
+
+    // Apply the offset of n to its own key and its children
+    static void push(Node *n)
+    {
+        if (!n->offset)
+            return;
+        n->key += n->offset;
+        if (n->left)
+            n->left->offset += n->offset;
+        if (n->right)
+            n->right->offset += n->offset;
+        n->offset = 0;
+    }
+
+    static void update(Node *n)
+    {
+        n->count = 1 + count(n->left) + count(n->right);
+    }
+
+    // Split t into rows before row and rows from row onwards
+    static void split(Node *t, int row, Node *&left, Node *&right)
+    {
+        if (!t) {
+            left = right = nullptr;
+            return;
+        }
+        push(t);
+        if (t->key < row) {
+            split(t->right, row, t->right, right);
+            left = t;
+        } else {
+            split(t->left, row, left, t->left);
+            right = t;
+        }
+        update(t);
+    }
+
+    // Merge trees where all rows in left are before all rows in right
+    static Node *merge(Node *left, Node *right)
+    {
+        if (!left || !right)
+            return left ? left : right;
+        if (left->priority > right->priority) {
+            push(left);
+            left->right = merge(left->right, right);
+            update(left);
+            return left;
+        } else {
+            push(right);
+            right->left = merge(left, right->left);
+            update(right);
+            return right;
+        }
+    }
+
+    static void destroy(Node *n)
+    {
+        if (!n)
+            return;
+        destroy(n->left);
+        destroy(n->right);
+        delete n;
+    }
+};
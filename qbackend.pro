@@ -1,3 +1,2 @@
 TEMPLATE = subdirs
-SUBDIRS += plugin
-
+SUBDIRS += plugin tests
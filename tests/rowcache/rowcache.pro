@@ -0,0 +1,9 @@
+TEMPLATE = app
+TARGET = tst_rowcache
+CONFIG += testcase
+QT = core testlib
+
+INCLUDEPATH += ../../plugin
+
+SOURCES += tst_rowcache.cpp
+HEADERS += ../../plugin/rowcache.h
@@ -0,0 +1,240 @@
+#include <QtTest>
+#include <QMap>
+#include <functional>
+#include <random>
+#include "rowcache.h"
+
+/* RowCache is checked against a QMap of rows, where every structural change re-keys
+ * the following rows. That's the straightforward implementation RowCache replaces.
+ */
+class tst_RowCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void randomized_data();
+    void randomized();
+    void moveRows();
+
+    void insertAtTop_data();
+    void insertAtTop();
+    void insertAtTopMap_data();
+    void insertAtTopMap();
+};
+
+typedef QMap<int,int> Reference;
+
+// Rebuild ref with each row passed through fn, which returns -1 to remove the row
+static Reference remapped(const Reference &ref, const std::function<int(int)> &fn)
+{
+    Reference re;
+    for (auto it = ref.constBegin(); it != ref.constEnd(); it++) {
+        int row = fn(it.key());
+        if (row >= 0)
+            re.insert(row, it.value());
+    }
+    return re;
+}
+
+static void refInsertRows(Reference &ref, int start, int count)
+{
+    ref = remapped(ref, [=](int row) { return row < start ? row : row + count; });
+}
+
+static void refRemoveRows(Reference &ref, int start, int count)
+{
+    ref = remapped(ref, [=](int row) {
+        if (row < start)
+            return row;
+        else if (row < start + count)
+            return -1;
+        return row - count;
+    });
+}
+
+static void refMoveRows(Reference &ref, int start, int end, int destination)
+{
+    int size = end - start + 1;
+    ref = remapped(ref, [=](int row) {
+        if (destination < start) {
+            if (row >= destination && row < start)
+                return row + size;
+            else if (row >= start && row <= end)
+                return row - (start - destination);
+        } else {
+            if (row >= start && row <= end)
+                return row + (destination - end - 1);
+            else if (row > end && row < destination)
+                return row - size;
+        }
+        return row;
+    });
+}
+
+// Compare every row up to limit, and the neighbor queries
+static bool compare(const RowCache<int> &cache, const Reference &ref, int limit)
+{
+    if (cache.size() != ref.size()) {
+        qWarning() << "size is" << cache.size() << "expected" << ref.size();
+        return false;
+    }
+    if (cache.firstRow() != (ref.isEmpty() ? -1 : ref.firstKey()) ||
+        cache.lastRow() != (ref.isEmpty() ? -1 : ref.lastKey()))
+    {
+        qWarning() << "first and last rows are" << cache.firstRow() << cache.lastRow() << "expected" << ref.keys();
+        return false;
+    }
+
+    for (int row = 0; row < limit; row++) {
+        const int *value = cache.find(row);
+        auto it = ref.constFind(row);
+        if (bool(value) != (it != ref.constEnd()) || (value && *value != it.value())) {
+            qWarning() << "row" << row << "is" << (value ? *value : -1) << "expected" << ref.value(row, -1);
+            return false;
+        }
+
+        auto next = ref.upperBound(row);
+        int expectNext = next == ref.constEnd() ? -1 : next.key();
+        auto previous = ref.lowerBound(row);
+        int expectPrevious = previous == ref.constBegin() ? -1 : (--previous).key();
+        if (cache.nextRow(row) != expectNext || cache.previousRow(row) != expectPrevious) {
+            qWarning() << "neighbors of row" << row << "are" << cache.previousRow(row) << cache.nextRow(row)
+                << "expected" << expectPrevious << expectNext;
+            return false;
+        }
+    }
+    return true;
+}
+
+void tst_RowCache::randomized_data()
+{
+    QTest::addColumn<quint32>("seed");
+    QTest::addColumn<int>("rows");
+
+    for (quint32 seed = 1; seed <= 20; seed++)
+        QTest::addRow("seed %u small", seed) << seed << 16;
+    for (quint32 seed = 1; seed <= 5; seed++)
+        QTest::addRow("seed %u large", seed) << seed << 500;
+}
+
+void tst_RowCache::randomized()
+{
+    QFETCH(quint32, seed);
+    QFETCH(int, rows);
+
+    std::mt19937 rng(seed);
+    auto random = [&](int max) { return int(rng() % quint32(max)); };
+
+    RowCache<int> cache;
+    Reference ref;
+    // Row numbers only need to be valid for the cache, not a real model, so operations
+    // may extend past the last cached row.
+    const int limit = rows * 2;
+
+    for (int i = 0; i < 2000; i++) {
+        int op = random(6);
+        if (op == 0 || op == 1) {
+            int row = random(rows), value = int(rng());
+            cache.insert(row, value);
+            ref.insert(row, value);
+        } else if (op == 2) {
+            int start = random(rows), count = random(5) + 1;
+            cache.insertRows(start, count);
+            refInsertRows(ref, start, count);
+        } else if (op == 3) {
+            int start = random(rows), count = random(5) + 1;
+            cache.removeRows(start, count);
+            refRemoveRows(ref, start, count);
+        } else if (op == 4) {
+            int start = random(rows), end = start + random(5);
+            int destination = random(rows + 6);
+            if (destination >= start && destination <= end+1)
+                continue;
+            cache.moveRows(start, end, destination);
+            refMoveRows(ref, start, end, destination);
+        } else {
+            int start = random(rows), end = start + random(3);
+            cache.erase(start, end);
+            for (int row = start; row <= end; row++)
+                ref.remove(row);
+        }
+
+        // Keep rows from growing without bound
+        while (ref.size() && ref.lastKey() >= limit) {
+            cache.erase(ref.lastKey());
+            ref.remove(ref.lastKey());
+        }
+
+        if (!compare(cache, ref, limit))
+            QFAIL(qPrintable(QString("mismatch after operation %1 (%2)").arg(i).arg(op)));
+    }
+}
+
+void tst_RowCache::moveRows()
+{
+    RowCache<int> cache;
+    Reference ref;
+    for (int row = 0; row < 10; row++) {
+        cache.insert(row, row);
+        ref.insert(row, row);
+    }
+
+    // Up and down across the whole range, and the edges of the destination
+    const int moves[][3] = { {5, 7, 0}, {0, 2, 10}, {3, 3, 9}, {8, 9, 3}, {0, 0, 2}, {9, 9, 0} };
+    for (const auto &m : moves) {
+        cache.moveRows(m[0], m[1], m[2]);
+        refMoveRows(ref, m[0], m[1], m[2]);
+        QVERIFY(compare(cache, ref, 12));
+    }
+
+    // Destinations within the moved range are ignored
+    cache.moveRows(2, 4, 3);
+    cache.moveRows(2, 4, 5);
+    QVERIFY(compare(cache, ref, 12));
+}
+
+void tst_RowCache::insertAtTop_data()
+{
+    QTest::addColumn<int>("rows");
+    QTest::newRow("1000") << 1000;
+    QTest::newRow("10000") << 10000;
+    QTest::newRow("100000") << 100000;
+}
+
+// Prepending a row to a model with many cached rows, as from a live feed
+void tst_RowCache::insertAtTop()
+{
+    QFETCH(int, rows);
+
+    RowCache<int> cache;
+    for (int row = 0; row < rows; row++)
+        cache.insert(row, row);
+
+    QBENCHMARK {
+        cache.insertRows(0, 1);
+        cache.insert(0, -1);
+    }
+}
+
+void tst_RowCache::insertAtTopMap_data()
+{
+    insertAtTop_data();
+}
+
+// The same as insertAtTop, re-keying a QMap for comparison
+void tst_RowCache::insertAtTopMap()
+{
+    QFETCH(int, rows);
+
+    Reference ref;
+    for (int row = 0; row < rows; row++)
+        ref.insert(row, row);
+
+    QBENCHMARK {
+        refInsertRows(ref, 0, 1);
+        ref.insert(0, -1);
+    }
+}
+
+QTEST_APPLESS_MAIN(tst_RowCache)
+#include "tst_rowcache.moc"